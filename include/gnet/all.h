@@ -24,8 +24,19 @@ USA.
 #ifndef __gnet_gnet_
 #define __gnet_gnet_
 
+#include <gnet/buffer.h>
 #include <gnet/socket.h>
 #include <gnet/connection.h>
 #include <gnet/host.h>
+#include <gnet/resolver.h>
+#include <gnet/poller.h>
+#include <gnet/search.h>
+#include <gnet/histogram.h>
+#include <gnet/metrics.h>
+#include <gnet/pool.h>
+#include <gnet/server.h>
+#include <gnet/shm.h>
+#include <gnet/scheduler.h>
+#include <gnet/async.h>
 
 #endif
@@ -0,0 +1,493 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+#ifndef __gnet_async_h_
+#define __gnet_async_h_
+
+#include <gnet/config.h>
+#include <gnet/socket.h>
+#include <gnet/connection.h>
+#include <gnet/scheduler.h>
+
+// C++20 coroutines, the header is empty for older standards
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+# if __has_include(<coroutine>)
+#   define GNET_COROUTINES
+# endif
+#endif
+
+#ifdef GNET_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <cstdlib>
+
+namespace gnet {
+  
+  // Coroutine based API on top of Scheduler: straight-line code, one event
+  // loop thread, no stack per connection.
+  //
+  //   Task<void> Session(Scheduler &s, TCPConnection *conn) {
+  //     std::string line;
+  //     while (co_await async::read(s, conn, line, "\n", 30000)) {
+  //       co_await async::write(s, conn, line.data(), line.size());
+  //     }
+  //   }
+  //
+  // Operations take the same timeouts as their blocking counterparts and
+  // report expiry the same way. They work on blocking and non-blocking
+  // descriptors alike, accept and connect switch their socket to non-blocking
+  // Pointer and reference arguments must outlive the operation.
+  
+  // Abort the operations coroutines are suspended on, from the same thread
+  // The operations throw, as do later ones given the same Cancellation
+  // A Cancellation can be shared by concurrent operations, it must outlive
+  // them
+  
+  class Cancellation {
+    
+    public:
+      
+      Cancellation()
+        : mCancelled(false) {
+      }
+      
+      void cancel() {
+        mCancelled = true;
+        // completions are called back by the next poll, not from here
+        for (size_t i=0; i<mWaits.size(); ++i) {
+          mWaits[i].scheduler->cancel(mWaits[i].id);
+        }
+        mWaits.clear();
+      }
+      
+      inline bool isCancelled() const {
+        return mCancelled;
+      }
+    
+    private:
+      
+      Cancellation(const Cancellation&);
+      Cancellation& operator=(const Cancellation&);
+      
+      friend class WaitFor;
+      
+      struct Wait {
+        Scheduler *scheduler;
+        unsigned long id;
+      };
+      
+      void add(Scheduler *scheduler, unsigned long id) {
+        Wait w = {scheduler, id};
+        mWaits.push_back(w);
+      }
+      
+      void remove(unsigned long id) {
+        for (size_t i=0; i<mWaits.size(); ++i) {
+          if (mWaits[i].id == id) {
+            mWaits.erase(mWaits.begin() + i);
+            return;
+          }
+        }
+      }
+      
+      // pending waits of the operations using it
+      std::vector<Wait> mWaits;
+      bool mCancelled;
+  };
+  
+  // Suspend until fd is readable (or writable) or deadline passed
+  // co_await returns Scheduler::Ready or Scheduler::TimedOut, throws if cancelled
+  // A null fd waits for the deadline only
+  // Destroying the suspended coroutine (its Task) drops the pending wait, the
+  // Scheduler must still exist then
+  
+  class WaitFor {
+    
+    public:
+      
+      WaitFor(Scheduler &scheduler, sock_t fd, bool write, long long deadline, Cancellation *cancel=0)
+        : mScheduler(scheduler), mFD(fd), mWrite(write), mDeadline(deadline)
+        , mCancel(cancel), mStatus(Scheduler::Cancelled), mWait(0) {
+      }
+      
+      ~WaitFor() {
+        if (mWait) {
+          mScheduler.remove(mWait);
+          if (mCancel) {
+            mCancel->remove(mWait);
+          }
+        }
+      }
+      
+      bool await_ready() const {
+        return (mCancel && mCancel->isCancelled());
+      }
+      
+      void await_suspend(std::coroutine_handle<> handle) {
+        mHandle = handle;
+        if (mFD == NULL_SOCKET) {
+          mWait = mScheduler.at(mDeadline, Resume, this);
+        } else {
+          mWait = mScheduler.wait(mFD, mWrite, mDeadline, Resume, this);
+        }
+        if (mCancel) {
+          mCancel->add(&mScheduler, mWait);
+        }
+      }
+      
+      Scheduler::Status await_resume() const {
+        if (mStatus == Scheduler::Cancelled) {
+          throw Exception("Cancellation", "Operation cancelled.");
+        }
+        return mStatus;
+      }
+    
+    private:
+      
+      static void Resume(void *data, Scheduler::Status status) {
+        WaitFor *self = (WaitFor*) data;
+        self->mStatus = status;
+        if (self->mCancel) {
+          self->mCancel->remove(self->mWait);
+        }
+        self->mWait = 0;
+        self->mHandle.resume();
+      }
+      
+      Scheduler &mScheduler;
+      sock_t mFD;
+      bool mWrite;
+      long long mDeadline;
+      Cancellation *mCancel;
+      Scheduler::Status mStatus;
+      // pending wait, 0 once called back
+      unsigned long mWait;
+      std::coroutine_handle<> mHandle;
+  };
+  
+  // Result storage of a Task
+  
+  template <typename T>
+  class TaskResult {
+    public:
+      
+      template <typename U>
+      void return_value(U &&value) {
+        mValue.emplace(std::forward<U>(value));
+      }
+      
+      T result() {
+        return std::move(*mValue);
+      }
+    
+    private:
+      
+      std::optional<T> mValue;
+  };
+  
+  template <>
+  class TaskResult<void> {
+    public:
+      
+      void return_void() {
+      }
+      
+      void result() {
+      }
+  };
+  
+  // Lazily started coroutine producing a T
+  // It starts when awaited, the awaiting coroutine resumes once it returns
+  // Exceptions propagate to the awaiting coroutine
+  
+  template <typename T=void>
+  class Task {
+    
+    public:
+      
+      class promise_type : public TaskResult<T> {
+        public:
+          
+          promise_type()
+            : mDetached(false) {
+          }
+          
+          Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+          }
+          
+          std::suspend_always initial_suspend() noexcept {
+            return std::suspend_always();
+          }
+          
+          struct FinalAwaiter {
+            bool await_ready() noexcept {
+              return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+              promise_type &p = handle.promise();
+              if (p.mDetached) {
+                handle.destroy();
+                return std::noop_coroutine();
+              }
+              return (p.mContinuation ? p.mContinuation : std::noop_coroutine());
+            }
+            void await_resume() noexcept {
+            }
+          };
+          
+          FinalAwaiter final_suspend() noexcept {
+            return FinalAwaiter();
+          }
+          
+          void unhandled_exception() {
+            mException = std::current_exception();
+          }
+          
+          std::coroutine_handle<> mContinuation;
+          std::exception_ptr mException;
+          bool mDetached;
+      };
+      
+      typedef std::coroutine_handle<promise_type> Handle;
+      
+      class Awaiter {
+        public:
+          
+          Awaiter(Handle handle)
+            : mHandle(handle) {
+          }
+          
+          bool await_ready() const {
+            return !mHandle || mHandle.done();
+          }
+          
+          std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+            mHandle.promise().mContinuation = caller;
+            return mHandle;
+          }
+          
+          T await_resume() {
+            if (!mHandle) {
+              throw Exception("Task", "Invalid task.");
+            }
+            if (mHandle.promise().mException) {
+              std::rethrow_exception(mHandle.promise().mException);
+            }
+            return mHandle.promise().result();
+          }
+        
+        private:
+          
+          Handle mHandle;
+      };
+    
+    public:
+      
+      Task()
+        : mHandle() {
+      }
+      
+      Task(Task &&rhs)
+        : mHandle(rhs.mHandle) {
+        rhs.mHandle = Handle();
+      }
+      
+      ~Task() {
+        if (mHandle) {
+          mHandle.destroy();
+        }
+      }
+      
+      Task& operator=(Task &&rhs) {
+        if (this != &rhs) {
+          if (mHandle) {
+            mHandle.destroy();
+          }
+          mHandle = rhs.mHandle;
+          rhs.mHandle = Handle();
+        }
+        return *this;
+      }
+      
+      Awaiter operator co_await() && {
+        return Awaiter(mHandle);
+      }
+      
+      inline bool isValid() const {
+        return bool(mHandle);
+      }
+      
+      inline bool isDone() const {
+        return (!mHandle || mHandle.done());
+      }
+      
+      // Run the task on its own, until its first suspension
+      // It frees itself when done, exceptions it lets through are lost
+      void detach() {
+        if (mHandle) {
+          Handle handle = mHandle;
+          mHandle = Handle();
+          handle.promise().mDetached = true;
+          handle.resume();
+        }
+      }
+    
+    private:
+      
+      Task(const Task&);
+      Task& operator=(const Task&);
+      
+      explicit Task(Handle handle)
+        : mHandle(handle) {
+      }
+      
+      Handle mHandle;
+  };
+  
+  namespace async {
+    
+    // Milliseconds left before deadline (-1 for none, 0 when expired)
+    inline int Remaining(long long deadline) {
+      if (deadline < 0) {
+        return -1;
+      }
+      long long left = deadline - Scheduler::Deadline(0);
+      return (left > 0 ? int(left) : 0);
+    }
+    
+    // Suspend for timeout milliseconds
+    inline Task<void> sleep(Scheduler &s, int timeout, Cancellation *cancel=0) {
+      co_await WaitFor(s, NULL_SOCKET, false, Scheduler::Deadline(timeout < 0 ? 0 : timeout), cancel);
+    }
+    
+    // TCPSocket::acceptConnection, the connection is non-blocking
+    inline Task<TCPConnection*> accept(Scheduler &s, TCPSocket *socket, int timeout=-1, Cancellation *cancel=0) {
+      long long deadline = Scheduler::Deadline(timeout);
+      if (socket->isBlocking()) {
+        socket->setBlocking(false);
+      }
+      while (true) {
+        TCPConnection *conn = socket->acceptConnection(0);
+        if (conn) {
+          conn->setBlocking(false);
+          co_return conn;
+        }
+        if (co_await WaitFor(s, socket->fd(), false, deadline, cancel) == Scheduler::TimedOut) {
+          co_return (TCPConnection*) 0;
+        }
+      }
+    }
+    
+    // TCPSocket::connect, the connection is non-blocking
+    // A timed out connect can be resumed by calling it again
+    inline Task<TCPConnection*> connect(Scheduler &s, TCPSocket *socket, int timeout=-1, Cancellation *cancel=0) {
+      long long deadline = Scheduler::Deadline(timeout);
+      if (socket->isBlocking()) {
+        socket->setBlocking(false);
+      }
+      while (true) {
+        TCPConnection *conn = socket->connect(0);
+        if (conn) {
+          co_return conn;
+        }
+        if (co_await WaitFor(s, socket->fd(), true, deadline, cancel) == Scheduler::TimedOut) {
+          co_return (TCPConnection*) 0;
+        }
+      }
+    }
+    
+    // Connection::read, into out
+    inline Task<bool> read(Scheduler &s, Connection *conn, std::string &out, const char *until=0, int timeout=-1, Cancellation *cancel=0) {
+      long long deadline = Scheduler::Deadline(timeout);
+      char *bytes = 0;
+      size_t len = 0;
+      while (!conn->read(bytes, len, until, 0)) {
+        if (co_await WaitFor(s, conn->fd(), false, deadline, cancel) == Scheduler::TimedOut) {
+          co_return false;
+        }
+      }
+      out.assign(bytes, len);
+      free(bytes);
+      co_return true;
+    }
+    
+    // Connection::readFrame, body into out
+    inline Task<bool> readFrame(Scheduler &s, Connection *conn, std::string &out, int timeout=-1, Cancellation *cancel=0) {
+      long long deadline = Scheduler::Deadline(timeout);
+      char *bytes = 0;
+      size_t len = 0;
+      while (!conn->readFrame(bytes, len, 0)) {
+        if (co_await WaitFor(s, conn->fd(), false, deadline, cancel) == Scheduler::TimedOut) {
+          co_return false;
+        }
+      }
+      out.assign(bytes, len);
+      free(bytes);
+      co_return true;
+    }
+    
+    // Connection::write
+    // Returns false if timeout expired, the connection then keeps the unsent
+    // bytes as Connection::write does
+    inline Task<bool> write(Scheduler &s, Connection *conn, const char *bytes, size_t len, int timeout=-1, Cancellation *cancel=0) {
+      long long deadline = Scheduler::Deadline(timeout);
+      while (true) {
+        size_t n = conn->writeSome(bytes, len);
+        bytes += n;
+        len -= n;
+        if (len == 0) {
+          co_return true;
+        }
+        if (co_await WaitFor(s, conn->fd(), true, deadline, cancel) == Scheduler::TimedOut) {
+          conn->write(bytes, len, 0);
+          co_return false;
+        }
+      }
+    }
+    
+    // Connection::writeFrame
+    inline Task<bool> writeFrame(Scheduler &s, Connection *conn, const char *bytes, size_t len, int timeout=-1, Cancellation *cancel=0) {
+      if (len > conn->getFraming().maxSize) {
+        throw Exception("Connection", "Frame exceeds maximum size.");
+      }
+      long long deadline = Scheduler::Deadline(timeout);
+      char header[10];
+      size_t hlen = conn->getFraming().encode(len, header);
+      if (!co_await write(s, conn, header, hlen, Remaining(deadline), cancel)) {
+        // the header tail is kept, the body must follow it
+        conn->write(bytes, len, 0);
+        co_return false;
+      }
+      co_return co_await write(s, conn, bytes, len, Remaining(deadline), cancel);
+    }
+  }
+
+}
+
+#endif
+
+#endif
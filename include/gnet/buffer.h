@@ -0,0 +1,105 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#ifndef __gnet_buffer_h_
+#define __gnet_buffer_h_
+
+#include <gnet/config.h>
+
+namespace gnet {
+  
+  // Circular byte buffer used by connections to receive data in place.
+  // Readable bytes may wrap around the end of the storage, linearize() makes
+  // a given prefix contiguous (the storage is rewound whenever it empties so
+  // this rarely has to move data).
+  
+  class GNET_API RingBuffer {
+    
+    public:
+      
+      RingBuffer(size_t capacity=0);
+      ~RingBuffer();
+      
+      inline size_t size() const {
+        return mSize;
+      }
+      
+      inline size_t capacity() const {
+        return mCapacity;
+      }
+      
+      inline size_t available() const {
+        return mCapacity - mSize;
+      }
+      
+      inline bool empty() const {
+        return (mSize == 0);
+      }
+      
+      inline bool full() const {
+        return (mSize == mCapacity);
+      }
+      
+      // Contiguous readable bytes at the front of the buffer
+      const char* front(size_t &len) const;
+      
+      // Make the first n readable bytes contiguous
+      const char* linearize(size_t n);
+      
+      // Copy the first n readable bytes to dst (n <= size())
+      void copy(char *dst, size_t n) const;
+      
+      // Release n bytes from the front of the buffer
+      void consume(size_t n);
+      
+      // Writable regions (second one is empty unless free space wraps)
+      // Returns the number of non empty regions
+      int writable(char *&p0, size_t &l0, char *&p1, size_t &l1);
+      
+      // Mark n bytes of the writable regions as readable
+      void commit(size_t n);
+      
+      // Copy n bytes at the end of the buffer, growing it if needed
+      void append(const char *src, size_t n);
+      
+      // Grow storage to at least n bytes, preserving content
+      void reserve(size_t n);
+      
+      void clear();
+      
+    private:
+      
+      RingBuffer(const RingBuffer&);
+      RingBuffer& operator=(const RingBuffer&);
+      
+    protected:
+      
+      char *mData;
+      size_t mCapacity;
+      size_t mHead;
+      size_t mSize;
+  };
+  
+}
+
+#endif
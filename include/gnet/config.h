@@ -42,6 +42,13 @@ USA.
 # define GNET_API
 #endif
 
+// Dynamic exception specifications are ill-formed from C++17 on
+#if __cplusplus >= 201703L
+# define GNET_THROWS(x) noexcept(false)
+#else
+# define GNET_THROWS(x) throw(x)
+#endif
+
 #include <string>
 #include <cstring>
 #include <cstdio>
@@ -53,8 +60,10 @@ USA.
 # define WIN32_LEAN_AND_MEAN
 # include <windows.h>
 # include <winsock2.h>
+# include <ws2tcpip.h>
 # pragma warning(disable: 4290 4251 4702)
 # pragma comment(lib, "wsock32.lib")
+# pragma comment(lib, "ws2_32.lib")
 typedef SOCKET sock_t;
 typedef int socklen_t;
 #define NULL_SOCKET INVALID_SOCKET
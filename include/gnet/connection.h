@@ -26,30 +26,139 @@ USA.
 
 #include <gnet/config.h>
 #include <gnet/host.h>
+#include <gnet/buffer.h>
+#include <gnet/metrics.h>
 
 namespace gnet {
 
   class TCPSocket;
+  class UDPSocket;
+  class UnixSocket;
+  class Poller;
+  
+  // Buffer description for vectored writes
+  
+  struct IOVec {
+    const char *bytes;
+    size_t len;
+  };
+  
+  // Length prefixed message format
+  
+  class GNET_API Framing {
+    
+    public:
+      
+      enum Header {
+        // unsigned LEB128, 1 to 10 bytes
+        VarInt = 0,
+        UInt8 = 1,
+        UInt16 = 2,
+        UInt32 = 4,
+        UInt64 = 8
+      };
+      
+      Framing(Header header=UInt32, bool bigEndian=true, size_t maxSize=16*1024*1024);
+      
+      // Write header for a frame of len bytes, returns header length
+      size_t encode(size_t len, char out[10]) const;
+      
+      // Decode header from the first n bytes of in
+      // Returns header length or 0 if more bytes are needed, throws if invalid
+      size_t decode(const char *in, size_t n, size_t &len) const GNET_THROWS(Exception);
+    
+    public:
+      
+      Header header;
+      bool bigEndian;
+      size_t maxSize;
+  };
   
   class GNET_API Connection {
     
     public:
       
+      friend class Poller;
+      
       Connection();
       virtual ~Connection();
       
-      // return value only meaning full for timeout > 0
-      virtual bool read(char *&bytes, size_t &len, const char *until=0, int timeout=-1) throw(Exception) = 0;
-      virtual void write(const char* bytes, size_t len) throw(Exception) = 0;
+      // Read available bytes or up to (and including) until
+      // bytes is allocated with malloc and null terminated, caller must free it
+      // timeout is in milliseconds: -1 waits forever, 0 only reads what is already available
+      // return false if timeout expired, bytes received so far are kept for the next read
+      virtual bool read(char *&bytes, size_t &len, const char *until=0, int timeout=-1) GNET_THROWS(Exception);
+      // return false if timeout expired before all bytes could be sent
+      // Stream connections then keep the unsent bytes (see unflushed): they go
+      // out first with the next write, writeSome or flush. Don't write them
+      // again, whatever part of them the peer already received
+      // Datagram connections send the whole datagram or nothing
+      virtual bool write(const char* bytes, size_t len, int timeout=-1) GNET_THROWS(Exception) = 0;
+      // Send count buffers in order, as if they were a single contiguous one
+      // Default implementation writes them one by one
+      virtual bool writev(const IOVec *vec, size_t count, int timeout=-1) GNET_THROWS(Exception);
+      
+      // Send what can be sent without waiting, returns the number of bytes sent
+      // Meant for event loops that track progress themselves (see async.h)
+      // Default implementation sends all of bytes or nothing, connections
+      // whose write may send part of the bytes before failing override it
+      virtual size_t writeSome(const char *bytes, size_t len) GNET_THROWS(Exception);
+      
+      // Send buffered output (see StreamConnection::setOutputBuffer) and the
+      // bytes timed out writes left behind
+      // return false if timeout expired before all of it could be sent
+      virtual bool flush(int timeout=-1) GNET_THROWS(Exception);
+      // Number of output bytes not sent yet
+      virtual size_t unflushed() const;
+      
+      // Zero-copy read, same arguments as read
+      // bytes points into the connection receive buffer and remains valid until
+      // the next read, peek or consume call. Bytes must be released using consume
+      bool peek(const char *&bytes, size_t &len, const char *until=0, int timeout=-1) GNET_THROWS(Exception);
+      void consume(size_t len);
+      
+      // Number of received bytes not read yet
+      inline size_t pending() const {
+        return mInput.size();
+      }
+      
+      // I/O counters of this connection (zero when built without GNET_METRICS)
+      inline const ConnectionStats& stats() const {
+        return mStats;
+      }
+      
+      // Length prefixed messages (see setFraming)
+      // readFrame returns the frame body in a malloc'd buffer of the exact size
+      // (null terminated), the part not yet buffered is received directly into it
+      bool readFrame(char *&bytes, size_t &len, int timeout=-1) GNET_THROWS(Exception);
+      // Zero-copy variant, body must be released using consume(len)
+      bool peekFrame(const char *&bytes, size_t &len, int timeout=-1) GNET_THROWS(Exception);
+      bool writeFrame(const char *bytes, size_t len, int timeout=-1) GNET_THROWS(Exception);
+      
+      inline const Framing& getFraming() const {
+        return mFraming;
+      }
+      
+      void setFraming(const Framing &framing);
       
       bool isValid() const;
-      // bool isAlive() const;
+      // Check, without blocking, that the peer didn't close the connection
+      // Buffered and pending bytes are left untouched
+      virtual bool isAlive() const;
       
       // for some reasons, if those 2 following functions are named 'read' and 'write'
       // calling them from TCPConnection instance will result in compilation error
       // on linux...
-      bool reads(std::string &s, const char *until=0, int timeout=-1) throw(Exception);
-      void writes(const std::string &s) throw(Exception);
+      bool reads(std::string &s, const char *until=0, int timeout=-1) GNET_THROWS(Exception);
+      bool writes(const std::string &s, int timeout=-1) GNET_THROWS(Exception);
+      
+      // Switch the underlying descriptor to non-blocking mode
+      // Timeouts are honored in both modes
+      void setBlocking(bool blocking) GNET_THROWS(Exception);
+      
+      inline bool isBlocking() const {
+        return mBlocking;
+      }
       
       inline unsigned long getBufferSize() const {
         return mBufferSize;
@@ -70,27 +179,169 @@ namespace gnet {
       
       Connection(sock_t fd);
       
+      // Receive more bytes into mInput, waiting at most timeout milliseconds
+      // Returns false if timeout expired
+      virtual bool fill(int timeout) GNET_THROWS(Exception) = 0;
+      
+      // Receive at most len bytes directly into bytes, bypassing mInput
+      // (which must be empty). waitAll asks for all len bytes at once
+      // Returns the number of bytes received, 0 if timeout expired
+      virtual size_t fill(char *bytes, size_t len, bool waitAll, int timeout) GNET_THROWS(Exception);
+      
+      // Wait for bytes to read (or until) in mInput
+      // len is set to the number of bytes to read
+      bool receive(size_t &len, const char *until, int timeout) GNET_THROWS(Exception);
+      
+      // Parse frame header, sets mFrameLength
+      bool receiveFrameHeader(long long deadline) GNET_THROWS(Exception);
+      
       sock_t mFD;
       unsigned long mBufferSize;
-      char *mBuffer;
-      unsigned long mBufferOffset;
+      RingBuffer mInput;
+      bool mBlocking;
+      // delimiter search state, bytes of mInput already known not to hold mScanUntil
+      std::string mScanUntil;
+      size_t mScanned;
+      Framing mFraming;
+      // body length of a frame whose header was already consumed
+      size_t mFrameLength;
+      // input received by a Poller (io_uring backend), up to the end of stream
+      bool mFed;
+      bool mFedEnd;
+      ConnectionStats mStats;
+  };
+  
+  // Byte stream over a connected descriptor, shared by TCP and unix sockets
+  
+  class GNET_API StreamConnection : public Connection {
+    
+    public:
+      
+      virtual ~StreamConnection();
+      
+      virtual bool write(const char* bytes, size_t len, int timeout=-1) GNET_THROWS(Exception);
+      // Uses sendmsg (WSASend on windows), partial writes resume mid vector
+      virtual bool writev(const IOVec *vec, size_t count, int timeout=-1) GNET_THROWS(Exception);
+      
+      // Send length bytes of file descriptor fd starting at offset
+      // Uses sendfile, then splice, so that data doesn't go through user space
+      // (falls back to read/write when neither applies to fd or on other systems)
+      // offset and length are updated with the bytes actually sent, a transfer
+      // that timed out can be resumed by calling sendFile again with them
+      // Return false if timeout expired before length bytes could be sent
+      bool sendFile(int fd, long long &offset, long long &length, int timeout=-1) GNET_THROWS(Exception);
+      
+      // Buffered output goes first
+      virtual size_t writeSome(const char *bytes, size_t len) GNET_THROWS(Exception);
+      
+      // Coalesce small writes: bytes are buffered until flush is called, more
+      // than highWaterMark bytes are pending, or the Poller tick that dispatched
+      // the connection ends. 0 (default) sends every write right away
+      // Writes that time out keep their unsent bytes buffered
+      // Disabling the buffer flushes it
+      void setOutputBuffer(size_t highWaterMark) GNET_THROWS(Exception);
+      
+      inline size_t getOutputBuffer() const {
+        return mHighWaterMark;
+      }
+      
+      virtual bool flush(int timeout=-1) GNET_THROWS(Exception);
+      virtual size_t unflushed() const;
+    
+    private:
+      
+      StreamConnection(const StreamConnection&);
+      StreamConnection& operator=(const StreamConnection&);
+    
+    protected:
+      
+      StreamConnection();
+      StreamConnection(sock_t fd);
+      
+      virtual bool fill(int timeout) GNET_THROWS(Exception);
+      virtual size_t fill(char *bytes, size_t len, bool waitAll, int timeout) GNET_THROWS(Exception);
+      
+      // Receive into up to 2 buffers, returns 0 if timeout expired
+      size_t recvBytes(char *p0, size_t l0, char *p1, size_t l1, bool waitAll, int timeout) GNET_THROWS(Exception);
+      
+      // Send until done or deadline expires, returns the number of bytes sent
+      size_t sendBytes(const char *bytes, size_t len, long long deadline) GNET_THROWS(Exception);
+      size_t sendVector(const IOVec *vec, size_t count, int flags, long long deadline) GNET_THROWS(Exception);
+      
+      // Append vec to the output buffer, or send both if it gets past the
+      // high-water mark (count is 0 to flush). Returns true if nothing is left
+      bool sendBuffered(const IOVec *vec, size_t count, long long deadline, int flags=0) GNET_THROWS(Exception);
+      
+      // Handle a failed send call
+      // Returns true if it can be retried, false if deadline expired
+      bool sendFailed(long long deadline) GNET_THROWS(Exception);
+      
+      // sendFile implementations, return false if not applicable to fd
+      bool sendFileKernel(int fd, long long &offset, long long &length, long long deadline, bool &timedOut) GNET_THROWS(Exception);
+      bool spliceFile(int fd, long long &offset, long long &length, long long deadline, bool &timedOut) GNET_THROWS(Exception);
+      bool copyFile(int fd, long long &offset, long long &length, long long deadline, bool &timedOut) GNET_THROWS(Exception);
+      
+      // Peer closed the connection, release descriptor
+      virtual void remotelyClosed();
+      
+      RingBuffer mOutput;
+      size_t mHighWaterMark;
   };
   
-  class GNET_API TCPConnection : public Connection {
+  // Reference to a connection tracked by a TCPSocket (see TCPSocket::connection)
+  // Resolves to NULL once the connection is closed, even after its slot was
+  // reused by a newer connection
+  
+  struct ConnectionHandle {
+    
+    ConnectionHandle() : index(0), generation(0) {
+    }
+    
+    inline bool isNull() const {
+      return (generation == 0);
+    }
+    
+    inline bool operator==(const ConnectionHandle &rhs) const {
+      return (index == rhs.index && generation == rhs.generation);
+    }
+    
+    inline bool operator!=(const ConnectionHandle &rhs) const {
+      return !operator==(rhs);
+    }
+    
+    unsigned int index;
+    // 0 for the null handle
+    unsigned int generation;
+  };
+  
+  class GNET_API TCPConnection : public StreamConnection {
     
     public:
       
       friend class TCPSocket;
+      friend class UnixConnection;
       
       virtual ~TCPConnection();
       
-      virtual bool read(char *&bytes, size_t &len, const char *until=0, int timeout=-1) throw(Exception);
-      virtual void write(const char* bytes, size_t len) throw(Exception);
+      // Hold partial segments until uncorked (TCP_CORK on linux, TCP_NOPUSH
+      // on BSD), e.g. around a header write and sendFile
+      // Throws if the platform doesn't support it
+      void setCork(bool on) GNET_THROWS(Exception);
       
       inline const Host& host() const {
         return mHost;
       }
       
+      // The socket that accepted or opened this connection
+      // NULL for connections received from another process (see UnixConnection)
+      inline TCPSocket* socket() const {
+        return mSocket;
+      }
+      
+      inline ConnectionHandle handle() const {
+        return mHandle;
+      }
+    
     private:
       
       TCPConnection();
@@ -101,11 +352,117 @@ namespace gnet {
       
       TCPConnection(TCPSocket *socket, sock_t fd, const Host &host);
       
+      virtual void remotelyClosed();
+      
       Host mHost;
       TCPSocket *mSocket;
+      ConnectionHandle mHandle;
   };
+
+#ifndef _WIN32
   
-  // class NET_API UDPConnection : public Connection
+  // Local stream connection (AF_UNIX)
+  // Descriptors, and TCP connections, can be passed to the peer process:
+  // a master accepting connections can hand them over to pre-forked workers
+  
+  class GNET_API UnixConnection : public StreamConnection {
+    
+    public:
+      
+      friend class UnixSocket;
+      
+      virtual ~UnixConnection();
+      
+      // Path of the socket, starting with '@' for the abstract namespace
+      inline const std::string& path() const {
+        return mPath;
+      }
+      
+      inline UnixSocket* socket() const {
+        return mSocket;
+      }
+      
+      // Send a duplicate of fd (SCM_RIGHTS), fd can be closed once sent
+      // Return false if timeout expired
+      bool sendFD(int fd, int timeout=-1) GNET_THROWS(Exception);
+      // fd is set to the received descriptor (close-on-exec), owned by the caller
+      // Return false if timeout expired
+      bool receiveFD(int &fd, int timeout=-1) GNET_THROWS(Exception);
+      
+      // Pass conn and its peer address to the other process
+      // conn is left open, close it through its socket once sent
+      bool sendConnection(TCPConnection *conn, int timeout=-1) GNET_THROWS(Exception);
+      // Returns a connection owned by the caller (delete closes it), NULL if
+      // timeout expired. Its socket() is NULL
+      TCPConnection* receiveConnection(int timeout=-1) GNET_THROWS(Exception);
+      
+      // Descriptor passing bypasses the input buffer: calls must be paired
+      // (sendFD with receiveFD, sendConnection with receiveConnection) and
+      // not interleaved with buffered reads
+    
+    private:
+      
+      UnixConnection();
+      UnixConnection(const UnixConnection&);
+      UnixConnection& operator=(const UnixConnection&);
+    
+    protected:
+      
+      UnixConnection(UnixSocket *socket, sock_t fd, const std::string &path);
+      
+      // Send len bytes of data with fd attached
+      bool sendWithFD(int fd, const char *data, size_t len, int timeout) GNET_THROWS(Exception);
+      // Receive exactly len bytes of data and the attached descriptor
+      bool receiveWithFD(int &fd, char *data, size_t len, int timeout) GNET_THROWS(Exception);
+      
+      virtual void remotelyClosed();
+      
+      std::string mPath;
+      UnixSocket *mSocket;
+  };
+
+#endif
+  
+  // Datagram channel to a single peer (connected UDP socket)
+  // Each write sends one datagram. Received datagrams are appended to the
+  // input buffer, so reads see their payloads as a byte stream
+  
+  class GNET_API UDPConnection : public Connection {
+    
+    public:
+      
+      friend class UDPSocket;
+      
+      virtual ~UDPConnection();
+      
+      virtual bool write(const char* bytes, size_t len, int timeout=-1) GNET_THROWS(Exception);
+      // Buffers are gathered into a single datagram
+      virtual bool writev(const IOVec *vec, size_t count, int timeout=-1) GNET_THROWS(Exception);
+      
+      inline const Host& host() const {
+        return mHost;
+      }
+      
+      inline UDPSocket* socket() const {
+        return mSocket;
+      }
+    
+    private:
+      
+      UDPConnection();
+      UDPConnection(const UDPConnection&);
+      UDPConnection& operator=(const UDPConnection&);
+    
+    protected:
+      
+      UDPConnection(UDPSocket *socket, sock_t fd, const Host &host);
+      
+      // Receive one datagram
+      virtual bool fill(int timeout) GNET_THROWS(Exception);
+      
+      Host mHost;
+      UDPSocket *mSocket;
+  };
   
 }
 
@@ -0,0 +1,90 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#ifndef __gnet_histogram_h_
+#define __gnet_histogram_h_
+
+#include <gnet/config.h>
+#include <vector>
+
+namespace gnet {
+  
+  // High dynamic range histogram of non negative integer values (usually
+  // latencies in nanoseconds), in the manner of HdrHistogram: values are
+  // bucketed by powers of two, each bucket split linearly so that recorded
+  // values keep the requested number of significant decimal digits.
+  // Values above highest() are counted as highest().
+  // Not thread safe: record into one histogram per thread and merge.
+  
+  class GNET_API Histogram {
+    
+    public:
+      
+      // highest: largest value tracked with full precision (at least 2)
+      // digits:  significant decimal digits, between 1 and 5
+      Histogram(long long highest=3600000000000LL, int digits=3);
+      
+      void record(long long value, unsigned long long count=1);
+      // Record value, plus the values that requests queued behind it would
+      // have seen when requests are expected every interval (coordinated
+      // omission correction for fixed rate load)
+      void recordCorrected(long long value, long long interval);
+      
+      // Add the counts of a histogram created with the same parameters
+      void merge(const Histogram &other);
+      void reset();
+      
+      unsigned long long count() const;
+      long long min() const;
+      long long max() const;
+      double mean() const;
+      double stddev() const;
+      // Smallest value that percent% of the recorded values don't exceed
+      // (to the histogram precision). 0 when empty
+      long long percentile(double percent) const;
+      
+      long long highest() const;
+      int digits() const;
+    
+    private:
+      
+      size_t index(long long value) const;
+      long long valueAt(size_t index) const;
+    
+    private:
+      
+      long long mHighest;
+      int mDigits;
+      int mSubBucketHalfBits;
+      long long mSubBucketMask;
+      std::vector<unsigned long long> mCounts;
+      unsigned long long mTotal;
+      long long mMin;
+      long long mMax;
+      double mSum;
+      double mSumSquares;
+  };
+  
+}
+
+#endif
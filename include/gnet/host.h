@@ -33,21 +33,44 @@ namespace gnet {
     public:
       
       Host();
-      Host(const std::string &addr, unsigned short port) throw(Exception);
+      // Literal IPv4 and IPv6 addresses are parsed (IPv6 may be enclosed in
+      // brackets), names are looked up using Resolver::Default()
+      // family selects the address used for names: AF_INET or AF_INET6 take
+      // the first address of that family, AF_UNSPEC the first IPv4 address
+      // if any, the first IPv6 address otherwise. Use Resolver and
+      // TCPSocket::connect(hosts) to try all addresses of a name
+      Host(const std::string &addr, unsigned short port, int family=AF_UNSPEC) GNET_THROWS(Exception);
+      // Same address as addr, on another port
+      Host(const Host &addr, unsigned short port);
+      Host(const struct sockaddr *addr, socklen_t len) GNET_THROWS(Exception);
       Host(const Host &rhs);
       ~Host();
 
       Host& operator=(const Host &rhs);
+      
+      bool operator==(const Host &rhs) const;
+      bool operator!=(const Host &rhs) const;
+      // arbitrary but strict ordering, for use as map key
+      bool operator<(const Host &rhs) const;
 
       unsigned short port() const;
       std::string address() const;
+      
+      // AF_INET or AF_INET6 (AF_UNSPEC for default constructed hosts)
+      int family() const;
+      // Size of the address structure for family
+      socklen_t length() const;
 
       operator struct sockaddr* ();
       operator const struct sockaddr* () const;
 
     protected:
       
-      struct sockaddr_in mAddr;
+      int compare(const Host &rhs) const;
+      
+    protected:
+      
+      struct sockaddr_storage mAddr;
     
   };
   
@@ -0,0 +1,146 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#ifndef __gnet_metrics_h_
+#define __gnet_metrics_h_
+
+#include <gnet/config.h>
+#include <string>
+
+// Build the library with GNET_METRICS=0 to compile the hot path updates out
+#ifndef GNET_METRICS
+# define GNET_METRICS 1
+#endif
+
+namespace gnet {
+  
+  // I/O counters of a single connection, updated by the thread using it
+  
+  struct ConnectionStats {
+    unsigned long long bytesIn;
+    unsigned long long bytesOut;
+    unsigned long long recvCalls;
+    unsigned long long sendCalls;
+    unsigned long long partialWrites;
+    unsigned long long wouldBlock;
+    // monotonic time of creation in microseconds (0 when not tracked)
+    long long opened;
+  };
+  
+  // Library wide I/O metrics.
+  // Each thread updates its own cache line padded block of counters and power
+  // of two histograms, with plain (relaxed) loads and stores rather than
+  // atomic read-modify-writes, so the hot paths never share or lock anything.
+  // Collect sums the blocks of all threads, past and present, into a Snapshot.
+  // Counters only grow: compare snapshots for rates.
+  
+  class GNET_API Metrics {
+    
+    public:
+      
+      enum Counter {
+        BytesIn = 0,
+        BytesOut,
+        // recv/send system calls that transferred data
+        RecvCalls,
+        SendCalls,
+        // sends that took less than what was asked
+        PartialWrites,
+        // recv/send that failed with EAGAIN
+        WouldBlock,
+        // read-until scans that didn't find the delimiter
+        UntilRescans,
+        Accepts,
+        ConnectionsOpened,
+        ConnectionsClosed,
+        NumCounters
+      };
+      
+      enum Distribution {
+        // bytes per recv (or io_uring receive completion) and per send
+        RecvSize = 0,
+        SendSize,
+        // time blocked waiting for a connection to become readable or
+        // writable, in microseconds
+        ReadWait,
+        WriteWait,
+        // from connect or accept to close, in microseconds
+        ConnectionLifetime,
+        NumDistributions
+      };
+      
+      // Bucket 0 counts 0 and 1, bucket i values in (2^(i-1), 2^i], the last
+      // one everything above
+      enum {
+        NumBuckets = 40
+      };
+      
+      struct Buckets {
+        unsigned long long count;
+        unsigned long long sum;
+        unsigned long long buckets[NumBuckets];
+      };
+      
+      class GNET_API Snapshot {
+        
+        public:
+          
+          Snapshot();
+          
+          unsigned long long counter(Counter c) const;
+          const Buckets& distribution(Distribution d) const;
+          // Mean of the recorded values, 0 when empty
+          double average(Distribution d) const;
+          // Increase per second since an earlier snapshot
+          double rate(Counter c, const Snapshot &since) const;
+          
+          // Prometheus text exposition format, names start with prefix_
+          // Sizes are reported in bytes, times in seconds
+          std::string prometheus(const char *prefix="gnet") const;
+        
+        public:
+          
+          // monotonic time of collection in microseconds
+          long long time;
+          unsigned long long counters[NumCounters];
+          Buckets distributions[NumDistributions];
+      };
+    
+    public:
+      
+      // False when the library was built with GNET_METRICS=0
+      static bool Enabled();
+      
+      static void Collect(Snapshot &snapshot);
+      
+      // Hot path updates, for the calling thread's block
+      static void Add(Counter c, unsigned long long n=1);
+      static void Record(Distribution d, unsigned long long value);
+      
+      static const char* Name(Counter c);
+      static const char* Name(Distribution d);
+  };
+  
+}
+
+#endif
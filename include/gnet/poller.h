@@ -0,0 +1,206 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#ifndef __gnet_poller_h_
+#define __gnet_poller_h_
+
+#include <gnet/config.h>
+#include <gnet/socket.h>
+#include <gnet/connection.h>
+#include <map>
+#include <vector>
+#include <atomic>
+
+namespace gnet {
+  
+  class Uring;
+  
+  // Readiness driven event loop.
+  // Uses epoll on linux and falls back to select() on other platforms.
+  // On linux 6.0 and later, the IOUring backend lets the kernel accept and
+  // receive on its own (multishot requests into provided buffers): accepted
+  // descriptors are queued in the listening socket and received bytes in the
+  // connection input buffer before handlers run, so receiving costs a single
+  // system call per tick. While registered, stream connections are read from
+  // the ring only: reads return what was already received, as with a 0
+  // timeout. Sends don't go through the ring: writes and the end of tick flush
+  // still call send() directly, as the output buffer would otherwise have to
+  // stay untouched until the kernel completes them.
+  // A single Poller can drive a listening TCPSocket and all the connections it
+  // accepts from one thread.
+  // Output buffered by a connection (see StreamConnection::setOutputBuffer) is
+  // flushed at the end of the poll that dispatched it, what can't be sent
+  // right away goes out as the connection becomes writable.
+  
+  class GNET_API Poller {
+    
+    public:
+      
+      enum Event {
+        Read = 0x01,
+        Write = 0x02,
+        // Only honored by the epoll implementation. Handlers must then drain
+        // the connection until it would block (see Connection::setBlocking)
+        EdgeTriggered = 0x04
+      };
+      
+      enum Backend {
+        // epoll (linux) or select()
+        Default = 0,
+        // io_uring, falls back to Default when the kernel doesn't support it
+        IOUring
+      };
+      
+      class GNET_API Handler {
+        public:
+          
+          Handler();
+          virtual ~Handler();
+          
+          // listening socket has pending connections
+          virtual void onAccept(Poller &poller, TCPSocket *socket);
+          // connection has data available (or was closed by peer)
+          virtual void onRead(Poller &poller, Connection *conn);
+          // connection can be written to without blocking
+          virtual void onWrite(Poller &poller, Connection *conn);
+          // error or hang up reported by the system
+          // default implementation removes the connection from the poller
+          virtual void onClose(Poller &poller, Connection *conn);
+      };
+      
+    public:
+      
+      Poller(Backend backend=Default) GNET_THROWS(Exception);
+      ~Poller();
+      
+      // Backend actually in use
+      inline Backend backend() const {
+        return (mRing ? IOUring : Default);
+      }
+      
+      // Listening sockets are always watched for Read
+      void add(TCPSocket *socket, Handler *handler) GNET_THROWS(Exception);
+      void add(Connection *conn, Handler *handler, int events=Read) GNET_THROWS(Exception);
+      void modify(Connection *conn, int events) GNET_THROWS(Exception);
+      // Connections must be removed before they are closed
+      void remove(TCPSocket *socket);
+      void remove(Connection *conn);
+      
+      bool has(sock_t fd) const;
+      size_t count() const;
+      
+      // Wait at most timeout milliseconds (-1 waits forever) and dispatch events
+      // Returns the number of dispatched events
+      int poll(int timeout=-1) GNET_THROWS(Exception);
+      // Poll until stop() is called
+      void run() GNET_THROWS(Exception);
+      // Can be called from any thread
+      void stop();
+      // Interrupt a blocking poll() from another thread
+      void wakeup();
+      
+    private:
+      
+      Poller(const Poller&);
+      Poller& operator=(const Poller&);
+      
+    protected:
+      
+      struct Entry {
+        sock_t fd;
+        int events;
+        bool dead;
+        // Write watched to send buffered output
+        bool flushing;
+        Handler *handler;
+        TCPSocket *socket;
+        Connection *conn;
+        // io_uring only
+        // requests in flight (see Op), readiness gathered for this tick
+        int armed;
+        int ready;
+        // queued for dispatch, queued for re-arming
+        bool queued;
+        bool arming;
+        // received through multishot recv (StreamConnection)
+        bool stream;
+      };
+      
+      typedef std::map<sock_t, Entry*> EntryMap;
+      typedef std::map<const void*, Entry*> OwnerMap;
+      
+      void add(Entry *e) GNET_THROWS(Exception);
+      void remove(const void *owner);
+      void dispatch(Entry *e, bool readable, bool writable, bool closed);
+      void purge();
+      // Apply events to the system (epoll only)
+      void update(Entry *e) GNET_THROWS(Exception);
+      // Send buffered output without blocking, watch Write for the rest
+      void flush(Entry *e);
+      
+      // io_uring backend
+      // user_data carries the Entry address and the operation in its low bits
+      enum Op {
+        OpAccept = 1,
+        OpRecv = 2,
+        OpPollIn = 3,
+        OpPollOut = 4,
+        OpWake = 5
+      };
+      enum { Closed = 0x08 };
+      
+      Entry* entry(sock_t fd, Handler *handler, int events);
+      // Submit the requests e needs and doesn't have in flight
+      void arm(Entry *e) GNET_THROWS(Exception);
+      // Cancel Read (and Write) requests, complete what they delivered
+      void disarm(Entry *e, bool all);
+      // Process available completions
+      void reap();
+      void complete(Entry *e, int op, int res, unsigned flags);
+      void schedule(Entry *e);
+      // Wait for completions and dispatch them
+      int pollRing(int timeout) GNET_THROWS(Exception);
+      // End of tick: re-arm requests that ended
+      void rearm() GNET_THROWS(Exception);
+      
+    protected:
+      
+      int mFD;
+      Uring *mRing;
+      // entries with completions to dispatch, entries to re-arm
+      std::vector<Entry*> mReady;
+      std::vector<Entry*> mArm;
+      sock_t mWakeFD[2];
+      EntryMap mEntries;
+      // connections lose their descriptor when remotely closed
+      OwnerMap mOwners;
+      std::vector<Entry*> mDead;
+      // connections dispatched by the current poll
+      std::vector<Entry*> mTouched;
+      // set by stop() from any thread
+      std::atomic<bool> mStop;
+  };
+  
+}
+
+#endif
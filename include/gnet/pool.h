@@ -0,0 +1,146 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#ifndef __gnet_pool_h_
+#define __gnet_pool_h_
+
+#include <gnet/config.h>
+#include <gnet/socket.h>
+#include <gnet/connection.h>
+#include <gnet/host.h>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+namespace gnet {
+  
+  // Thread-safe cache of client connections, keyed by Host.
+  // Connections returned to the pool are kept open and handed out again to
+  // later requests to the same host, saving a connection handshake.
+  
+  class GNET_API ConnectionPool {
+    
+    public:
+      
+      struct Stats {
+        // connections established by the pool
+        size_t created;
+        // acquisitions served by an idle connection
+        size_t reused;
+        // idle connections found closed (or with unread data) on acquisition
+        size_t stale;
+        // idle connections closed for being unused for too long
+        size_t evicted;
+        // connections released as not reusable, or in excess
+        size_t discarded;
+        // current number of idle and acquired connections
+        size_t idle;
+        size_t active;
+      };
+      
+    public:
+      
+      // maxPerHost limits acquired + idle connections for a given host (0 for no limit)
+      // idleTimeout in milliseconds (-1 keeps idle connections forever)
+      ConnectionPool(size_t maxPerHost=8, int idleTimeout=60000);
+      // Closes idle connections and the ones still acquired: connections
+      // obtained from acquire must not be used past the pool's lifetime
+      ~ConnectionPool();
+      
+      // Get a connection to host, reusing an idle one if possible
+      // Waits for a connection to be released if maxPerHost is reached
+      // timeout in milliseconds covers both the wait and connect
+      // Returns NULL if timeout expired
+      TCPConnection* acquire(const Host &host, int timeout=-1) GNET_THROWS(Exception);
+      
+      // Give back a connection obtained from acquire
+      // Pass reusable=false when the connection is in an unknown state
+      // (protocol error, partial read...) so that it gets closed
+      void release(TCPConnection *conn, bool reusable=true);
+      
+      // Close idle connections unused for more than idle timeout
+      // Returns the number of closed connections
+      size_t evict();
+      
+      // Close all idle connections
+      void clear();
+      
+      Stats stats() const;
+      
+      // Options for connections created from now on (not thread-safe)
+      void setOptions(const SocketOptions &options);
+      
+      inline const SocketOptions& getOptions() const {
+        return mOptions;
+      }
+      
+      inline size_t getMaxPerHost() const {
+        return mMaxPerHost;
+      }
+      
+      inline int getIdleTimeout() const {
+        return mIdleTimeout;
+      }
+      
+    private:
+      
+      ConnectionPool(const ConnectionPool&);
+      ConnectionPool& operator=(const ConnectionPool&);
+      
+    protected:
+      
+      struct Idle {
+        TCPSocket *socket;
+        TCPConnection *conn;
+        long long since;
+      };
+      
+      struct Entry {
+        // most recently used last
+        std::vector<Idle> idle;
+        size_t active;
+      };
+      
+      typedef std::map<Host, Entry> EntryMap;
+      typedef std::map<TCPConnection*, TCPSocket*> ActiveMap;
+      
+      // mutex must be locked
+      size_t evict(Entry &e, long long now);
+      TCPConnection* checkout(Entry &e);
+      
+    protected:
+      
+      size_t mMaxPerHost;
+      int mIdleTimeout;
+      SocketOptions mOptions;
+      EntryMap mEntries;
+      ActiveMap mActive;
+      Stats mStats;
+      mutable std::mutex mMutex;
+      std::condition_variable mReleased;
+  };
+  
+}
+
+#endif
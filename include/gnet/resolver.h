@@ -0,0 +1,142 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#ifndef __gnet_resolver_h_
+#define __gnet_resolver_h_
+
+#include <gnet/config.h>
+#include <gnet/host.h>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace gnet {
+  
+  // Host name resolution service.
+  // Lookups run getaddrinfo on a small pool of threads, started on first use.
+  // Results are cached for a fixed time, failures too (usually for a shorter
+  // time), and concurrent lookups of the same name share a single request.
+  
+  class GNET_API Resolver {
+    
+    public:
+      
+      class GNET_API Handler {
+        public:
+          
+          Handler();
+          virtual ~Handler();
+          
+          // Called from a resolver thread, or from the calling thread when the
+          // result is already cached. Lookups the resolver gives up on when
+          // destroyed fail from the destroying thread
+          // hosts holds at least one address, all using the requested port,
+          // IPv4 and IPv6 addresses in system preference order
+          virtual void onResolved(Resolver &resolver, const std::string &name, const std::vector<Host> &hosts) = 0;
+          virtual void onFailed(Resolver &resolver, const std::string &name, const std::string &reason) = 0;
+      };
+      
+    public:
+      
+      // ttl and negativeTTL in milliseconds, 0 disables caching
+      Resolver(size_t threads=2, int ttl=60000, int negativeTTL=5000);
+      // Waits for lookups in progress, which notify their handlers as usual.
+      // Queued lookups are not run: their handlers get onFailed. Every handler
+      // has been called when it returns
+      ~Resolver();
+      
+      // Wait at most timeout milliseconds (-1 waits forever) for the lookup
+      // Returns false if timeout expired, throws if name could not be resolved
+      bool resolve(const std::string &name, unsigned short port, std::vector<Host> &hosts, int timeout=-1) GNET_THROWS(Exception);
+      
+      // Handler must stay alive until it is called
+      void resolve(const std::string &name, unsigned short port, Handler *handler);
+      
+      // Forget cached results
+      void clear();
+      
+      inline size_t getThreads() const {
+        return mNumThreads;
+      }
+      
+      inline int getTTL() const {
+        return mTTL;
+      }
+      
+      inline int getNegativeTTL() const {
+        return mNegativeTTL;
+      }
+      
+      // Shared instance, used by Host. Released by Uninitialize(), which must
+      // not run while other threads may still use it
+      static Resolver& Default();
+      
+    private:
+      
+      Resolver(const Resolver&);
+      Resolver& operator=(const Resolver&);
+      
+    protected:
+      
+      struct Waiter {
+        Handler *handler;
+        unsigned short port;
+      };
+      
+      struct Entry {
+        // empty on failure
+        std::vector<Host> hosts;
+        std::string error;
+        long long expires;
+      };
+      
+      typedef std::map<std::string, Entry> Cache;
+      typedef std::map<std::string, std::vector<Waiter> > PendingMap;
+      
+      void run();
+      void lookup(const std::string &name, Entry &e);
+      void notify(const Waiter &w, const std::string &name, const Entry &e);
+      // forget a waiter that is no longer interested, false if already notified
+      bool cancel(const std::string &name, Handler *handler);
+      
+    protected:
+      
+      size_t mNumThreads;
+      int mTTL;
+      int mNegativeTTL;
+      
+      mutable std::mutex mMutex;
+      std::condition_variable mWork;
+      std::vector<std::thread> mThreads;
+      std::deque<std::string> mQueue;
+      Cache mCache;
+      PendingMap mPending;
+      bool mStop;
+  };
+  
+}
+
+#endif
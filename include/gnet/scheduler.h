@@ -0,0 +1,142 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+#ifndef __gnet_scheduler_h_
+#define __gnet_scheduler_h_
+
+#include <gnet/config.h>
+#include <map>
+#include <vector>
+
+namespace gnet {
+  
+  // Single threaded readiness scheduler: calls back once a descriptor becomes
+  // readable or writable, or once a deadline passes.
+  // Uses epoll on linux and falls back to select() on other platforms.
+  // It is what drives the coroutines of async.h, but doesn't depend on them.
+  // Not thread safe: all calls, stop() included, must come from the thread
+  // running it (usually from a callback).
+  
+  class GNET_API Scheduler {
+    
+    public:
+      
+      enum Status {
+        Ready = 0,
+        TimedOut,
+        Cancelled
+      };
+      
+      typedef void (*Callback)(void *data, Status status);
+    
+    public:
+      
+      Scheduler() GNET_THROWS(Exception);
+      // Pending waits are dropped, their callbacks are not called
+      ~Scheduler();
+      
+      // Monotonic deadline in milliseconds for timeout (-1 for none)
+      static long long Deadline(int timeout);
+      
+      // Call cb once fd is readable (or writable), or deadline passed
+      // A descriptor can have one read and one write wait pending
+      // Returns an identifier for cancel
+      unsigned long wait(sock_t fd, bool write, long long deadline, Callback cb, void *data) GNET_THROWS(Exception);
+      // Call cb with Ready once deadline passed (-1 or past deadlines on next poll)
+      unsigned long at(long long deadline, Callback cb, void *data);
+      // Complete a pending wait with Cancelled, cb is called by the next poll
+      // Returns false if no such wait is pending
+      bool cancel(unsigned long id);
+      // Drop a wait whose callback was not called yet, it never will be
+      // (for callback data about to be destroyed)
+      // Returns false if no such wait is pending
+      bool remove(unsigned long id);
+      
+      // Number of pending waits
+      size_t count() const;
+      
+      // Wait at most timeout milliseconds (-1 waits forever) and call back
+      // completed waits. Returns the number of callbacks called
+      size_t poll(int timeout=-1) GNET_THROWS(Exception);
+      // Poll until no wait is pending or stop() is called
+      void run() GNET_THROWS(Exception);
+      void stop();
+    
+    private:
+      
+      Scheduler(const Scheduler&);
+      Scheduler& operator=(const Scheduler&);
+    
+    protected:
+      
+      struct Wait;
+      
+      typedef std::multimap<long long, Wait*> TimerMap;
+      
+      struct Wait {
+        unsigned long id;
+        sock_t fd;
+        bool write;
+        Callback cb;
+        void *data;
+        TimerMap::iterator timer;
+        bool timed;
+      };
+      
+      // Waits on a descriptor
+      struct Watch {
+        Wait *reader;
+        Wait *writer;
+      };
+      
+      struct Done {
+        Wait *wait;
+        Status status;
+      };
+      
+      typedef std::map<unsigned long, Wait*> WaitMap;
+      typedef std::map<sock_t, Watch> WatchMap;
+      
+      // Forget w's registrations
+      void detach(Wait *w);
+      void complete(Wait *w, Status status);
+      // Arm a one shot registration for the waits on fd (epoll only)
+      void arm(sock_t fd, const Watch &watch) GNET_THROWS(Exception);
+      void ready(sock_t fd, bool readable, bool writable) GNET_THROWS(Exception);
+    
+    protected:
+      
+      int mFD;
+      unsigned long mNextId;
+      WaitMap mWaits;
+      WatchMap mWatches;
+      TimerMap mTimers;
+      std::vector<Done> mDone;
+      // completions being called back by poll, and the current one
+      std::vector<Done> mCalling;
+      size_t mCalled;
+      bool mStop;
+  };
+  
+}
+
+#endif
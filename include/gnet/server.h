@@ -0,0 +1,308 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#ifndef __gnet_server_h_
+#define __gnet_server_h_
+
+#include <gnet/config.h>
+#include <gnet/socket.h>
+#include <gnet/poller.h>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace gnet {
+  
+  // Multi-threaded listener.
+  // Binds one listening TCPSocket per shard on the same address using
+  // SO_REUSEPORT, each driven by its own Poller in its own thread, so that the
+  // system spreads incoming connections across cores. Accepted connections
+  // stay on the shard (socket and poller) that received them.
+  // The handler is shared: its methods are called concurrently from the shard
+  // threads, but never concurrently for the same connection.
+  // Listening sockets are non-blocking, onAccept should use acceptBatch.
+  // Without SO_REUSEPORT support, a single shard is used.
+  
+  class GNET_API ShardedServer {
+    
+    public:
+      
+      // shards=0 uses one shard per hardware thread
+      ShardedServer(const Host &host, Poller::Handler *handler, size_t shards=0, int backlog=128);
+      ~ShardedServer();
+      
+      // Options of the listening sockets, inherited by accepted connections
+      // Set before start()
+      void setOptions(const SocketOptions &options);
+      
+      inline const SocketOptions& getOptions() const {
+        return mOptions;
+      }
+      
+      // Event loop backend of the shard pollers, set before start()
+      void setBackend(Poller::Backend backend);
+      
+      inline Poller::Backend getBackend() const {
+        return mBackend;
+      }
+      
+      // Bind the listening sockets and start the shard threads
+      void start() GNET_THROWS(Exception);
+      // Stop and join the shard threads, close listening sockets and connections
+      // Must not be called from a shard thread
+      void stop();
+      
+      bool isRunning() const;
+      
+      size_t shards() const;
+      // Valid while running
+      TCPSocket* socket(size_t shard) const;
+      Poller* poller(size_t shard) const;
+      
+    private:
+      
+      ShardedServer(const ShardedServer&);
+      ShardedServer& operator=(const ShardedServer&);
+      
+    protected:
+      
+      struct Shard {
+        TCPSocket *socket;
+        Poller *poller;
+        std::thread thread;
+      };
+      
+      static void runShard(Shard *shard);
+      
+    protected:
+      
+      Host mHost;
+      Poller::Handler *mHandler;
+      size_t mNumShards;
+      int mBacklog;
+      SocketOptions mOptions;
+      Poller::Backend mBackend;
+      std::vector<Shard*> mShards;
+  };
+  
+  // Thread pool server.
+  // A dedicated thread accepts connections and hands each one to a worker
+  // thread, the one with the fewest connections. Every worker watches its
+  // connections with its own Poller and runs the handler on those that become
+  // readable: kept alive connections stay with their worker, a request costs
+  // no system call besides the poll and the I/O itself, and workers don't
+  // share any lock. Ready connections a worker has not reached yet are queued,
+  // idle workers steal from the back of other workers' queues.
+  // With the IOUring backend, the ring receives on behalf of its worker, so
+  // connections are never stolen.
+  
+  class GNET_API TCPServer {
+    
+    public:
+      
+      class GNET_API Handler {
+        public:
+          
+          Handler();
+          virtual ~Handler();
+          
+          // Called from a worker thread when conn has data available
+          // A connection is only ever served by one worker at a time
+          // Return true to keep the connection open for further requests
+          // Exceptions close the connection
+          virtual bool onRequest(TCPServer &server, TCPConnection *conn) = 0;
+      };
+      
+    public:
+      
+      // workers=0 uses one worker per hardware thread
+      TCPServer(const Host &host, Handler *handler, size_t workers=0, int backlog=128);
+      virtual ~TCPServer();
+      
+      // Close kept alive connections idle for more than timeout milliseconds
+      // (-1, the default, never closes them). Set before start()
+      void setIdleTimeout(int timeout);
+      
+      inline int getIdleTimeout() const {
+        return mIdleTimeout;
+      }
+      
+      // Options of the listening socket, inherited by accepted connections
+      // Set before start()
+      void setOptions(const SocketOptions &options);
+      
+      inline const SocketOptions& getOptions() const {
+        return mOptions;
+      }
+      
+      // Event loop backend of the accept thread and the workers, set before
+      // start()
+      void setBackend(Poller::Backend backend);
+      
+      inline Poller::Backend getBackend() const {
+        return mBackend;
+      }
+      
+      // Bind the listening socket and start accept and worker threads
+      void start() GNET_THROWS(Exception);
+      
+      // Graceful shutdown: stop accepting, close idle connections and wait for
+      // requests being served to complete. After timeout milliseconds (-1 waits
+      // forever), connections still in use are shut down to interrupt their
+      // handlers. Must not be called from a handler
+      void stop(int timeout=-1);
+      
+      bool isRunning() const;
+      
+      size_t workers() const;
+      // Number of open connections
+      size_t connections() const;
+      
+      // Listening socket, valid while running. Its connections belong to the
+      // server, only use it to query the bound address
+      inline TCPSocket* socket() const {
+        return mSocket;
+      }
+      
+    private:
+      
+      TCPServer(const TCPServer&);
+      TCPServer& operator=(const TCPServer&);
+      
+    protected:
+      
+      struct Worker;
+      
+      struct Client {
+        enum State {
+          // watched by the owner's poller
+          Idle = 0,
+          // in the owner's ready queue
+          Queued,
+          // being served by the owner
+          Busy,
+          // taken by another worker
+          Stolen
+        };
+        
+        TCPConnection *conn;
+        Worker *owner;
+        State state;
+        // last request, for idle timeout
+        long long last;
+        // removed from the owner's poller while stolen
+        bool detached;
+      };
+      
+      struct Served {
+        Client *client;
+        bool keep;
+      };
+      
+      struct Worker : public Poller::Handler {
+        
+        Worker(TCPServer *server, size_t index);
+        virtual ~Worker();
+        
+        virtual void onRead(Poller &poller, Connection *conn);
+        virtual void onClose(Poller &poller, Connection *conn);
+        
+        void run();
+        // pick up connections from the accept thread and stolen ones served
+        void receive();
+        Client* take();
+        Client* steal();
+        void serve(Client *c);
+        void served(Client *c, bool keep);
+        void close(Client *c);
+        void sweep(long long now);
+        
+        TCPServer *server;
+        size_t index;
+        Poller *poller;
+        std::thread thread;
+        // owner thread only
+        std::map<Connection*, Client*> clients;
+        std::vector<Client*> ready;
+        
+        // protected by mutex
+        std::mutex mutex;
+        std::deque<Client*> queue;
+        std::vector<TCPConnection*> incoming;
+        std::vector<Served> returned;
+        
+        std::atomic<size_t> count;
+        std::atomic<bool> idle;
+      };
+      
+      class Acceptor : public Poller::Handler {
+        public:
+          Acceptor(TCPServer *server);
+          virtual void onAccept(Poller &poller, TCPSocket *socket);
+        private:
+          TCPServer *mServer;
+      };
+      
+      // accept thread
+      void acceptLoop();
+      // wake an idle worker up to steal from a busy one
+      void balance(Worker *busy);
+      // close conn, from any thread
+      void close(TCPConnection *conn);
+      
+    protected:
+      
+      Host mHost;
+      Handler *mHandler;
+      size_t mNumWorkers;
+      int mBacklog;
+      int mIdleTimeout;
+      SocketOptions mOptions;
+      Poller::Backend mBackend;
+      
+      TCPSocket *mSocket;
+      Poller *mPoller;
+      Acceptor *mAcceptor;
+      std::thread mAcceptThread;
+      std::vector<Worker*> mWorkers;
+      
+      // the listening socket's connection registry, locked on accept and close
+      std::mutex mSocketMutex;
+      
+      // shutdown
+      std::mutex mStopMutex;
+      std::condition_variable mStopped;
+      size_t mRunning;
+      
+      std::atomic<bool> mDraining;
+      std::atomic<bool> mAcceptDone;
+      std::atomic<size_t> mConnections;
+  };
+  
+}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+#ifndef __gnet_shm_h_
+#define __gnet_shm_h_
+
+#include <gnet/config.h>
+#include <gnet/connection.h>
+
+#ifdef __linux__
+
+namespace gnet {
+  
+  // Connection between two processes on the same host through a shared
+  // memory mapping holding one single producer/single consumer ring per
+  // direction. Reads and writes are plain memory copies, a side spins briefly
+  // then sleeps on an eventfd when its peer has nothing for it, the peer only
+  // makes a system call to wake it up in that case.
+  //
+  // The mapping (memfd) and eventfds are exchanged over a UnixConnection.
+  // ShmConnection cannot be added to a Poller, use read/write timeouts.
+  
+  class GNET_API ShmConnection : public Connection {
+    
+    public:
+      
+      // Create a mapping with rings of capacity bytes (rounded up to a power of
+      // 2) and send it to the peer process, which must call Accept
+      // timeout is in milliseconds, returns NULL if it expired
+      static ShmConnection* Connect(UnixConnection *channel, size_t capacity=1048576, int timeout=-1) GNET_THROWS(Exception);
+      // Receive the mapping sent by Connect
+      // Returns NULL if timeout expired before the peer started the handshake
+      static ShmConnection* Accept(UnixConnection *channel, int timeout=-1) GNET_THROWS(Exception);
+      
+      // Tells the peer the connection is closed and unmaps the rings
+      virtual ~ShmConnection();
+      
+      virtual bool write(const char* bytes, size_t len, int timeout=-1) GNET_THROWS(Exception);
+      // Copy as much as fits in the send ring
+      virtual size_t writeSome(const char *bytes, size_t len) GNET_THROWS(Exception);
+      
+      // Bytes left over by timed out writes
+      virtual bool flush(int timeout=-1) GNET_THROWS(Exception);
+      virtual size_t unflushed() const;
+      
+      // Peer did not close its end yet
+      virtual bool isAlive() const;
+      
+      inline size_t capacity() const {
+        return mCapacity;
+      }
+      
+    private:
+      
+      ShmConnection();
+      ShmConnection(const ShmConnection&);
+      ShmConnection& operator=(const ShmConnection&);
+      
+    protected:
+      
+      struct Ring;
+      struct Region;
+      
+      // mapping and eventfds are owned by the connection
+      ShmConnection(int side, void *mapping, size_t size, sock_t wakeFD, sock_t peerFD);
+      
+      virtual bool fill(int timeout) GNET_THROWS(Exception);
+      virtual size_t fill(char *bytes, size_t len, bool waitAll, int timeout) GNET_THROWS(Exception);
+      
+      // Copy available bytes from the receive ring into up to 2 buffers
+      size_t pull(char *p0, size_t l0, char *p1, size_t l1);
+      // Copy as many bytes as fit into the send ring
+      size_t push(const char *bytes, size_t len);
+      // Push left over output, waiting for space until deadline if block is
+      // set. Returns false if some output is left
+      bool drain(bool block, long long deadline) GNET_THROWS(Exception);
+      
+      // Wait for data (or free space) in the receive (or send) ring
+      // Returns false if deadline expired. Throws if peer closed the connection
+      bool wait(bool space, long long deadline) GNET_THROWS(Exception);
+      
+      // Wake peer up if it sleeps on flag
+      void notify(const void *flag);
+      
+      // Receive into up to 2 buffers, returns 0 if timeout expired
+      size_t receiveBytes(char *p0, size_t l0, char *p1, size_t l1, int timeout) GNET_THROWS(Exception);
+      
+      int mSide;
+      Region *mRegion;
+      size_t mSize;
+      size_t mCapacity;
+      Ring *mTx;
+      Ring *mRx;
+      char *mTxData;
+      char *mRxData;
+      sock_t mPeerFD;
+      // unsent bytes of timed out writes
+      RingBuffer mOutput;
+  };
+  
+}
+
+#endif
+
+#endif
@@ -27,20 +27,89 @@ USA.
 #include <gnet/config.h>
 #include <gnet/connection.h>
 #include <vector>
+#include <deque>
+#include <unordered_map>
 
 namespace gnet {
   
+  // Socket tuning, fields left to Default keep the system setting
+  // Options are applied when set on a socket, to descriptors the socket
+  // creates internally (connection attempts) and to accepted connections
+  
+  class GNET_API SocketOptions {
+    
+    public:
+      
+      enum {
+        Default = -1
+      };
+      
+      enum Stage {
+        // any socket, as soon as options are set
+        Created = 0,
+        // before listen
+        Listening,
+        // before connect
+        Connecting,
+        // on accepted connections, for options they don't inherit
+        Accepted
+      };
+      
+      SocketOptions();
+      
+      // Set options that are not Default on fd, throws if one can't be set
+      // (including options the platform doesn't support)
+      void apply(sock_t fd, Stage stage=Created) const GNET_THROWS(Exception);
+      
+      // Effective values on fd, options that can't be read are left Default
+      // Note that linux reports twice the buffer sizes that were set
+      static SocketOptions Read(sock_t fd);
+    
+    public:
+      
+      // TCP_NODELAY (0 or 1)
+      int noDelay;
+      // SO_RCVBUF/SO_SNDBUF in bytes
+      int receiveBuffer;
+      int sendBuffer;
+      // SO_KEEPALIVE (0 or 1), then idle time before the first probe, time
+      // between probes (in seconds) and probes before giving up
+      int keepAlive;
+      int keepAliveIdle;
+      int keepAliveInterval;
+      int keepAliveCount;
+      // TCP_FASTOPEN: pending fast open requests for listening sockets, any
+      // positive value enables it for outgoing connections (data of the first
+      // write goes with the SYN once the server is known)
+      int fastOpen;
+      // TCP_DEFER_ACCEPT: seconds a connection may wait for its first bytes
+      // before being accepted (listening sockets, linux)
+      int deferAccept;
+      // TCP_QUICKACK (0 or 1, linux), not sticky: the system may reset it
+      int quickAck;
+      // SO_BUSY_POLL: microseconds blocking reads spin on the device queue (linux)
+      int busyPoll;
+  };
+  
   class GNET_API Socket {
     public:
       
       friend class Connection;
       
-      Socket(unsigned short port) throw(Exception);
-      Socket(const Host &host) throw(Exception);
+      // IPv4 loopback address (127.0.0.1) on port
+      Socket(unsigned short port) GNET_THROWS(Exception);
+      Socket(const Host &host) GNET_THROWS(Exception);
       virtual ~Socket();
       
       bool isValid() const;
       
+      // Switch the underlying descriptor to non-blocking mode
+      void setBlocking(bool blocking) GNET_THROWS(Exception);
+      
+      inline bool isBlocking() const {
+        return mBlocking;
+      }
+      
       inline sock_t fd() const {
         return mFD;
       }
@@ -48,7 +117,15 @@ namespace gnet {
       inline const Host& host() const {
         return mHost;
       }
-  
+      
+      // Apply options now and to descriptors the socket creates later
+      void setOptions(const SocketOptions &options) GNET_THROWS(Exception);
+      
+      // Options as set, see SocketOptions::Read for effective values
+      inline const SocketOptions& getOptions() const {
+        return mOptions;
+      }
+    
     protected:
       
       Socket();
@@ -63,6 +140,8 @@ namespace gnet {
       
       sock_t mFD;
       Host mHost;
+      bool mBlocking;
+      SocketOptions mOptions;
       
   };
   
@@ -70,18 +149,61 @@ namespace gnet {
     public:
       
       friend class TCPConnection;
+      friend class Poller;
       
-      TCPSocket(unsigned short port) throw(Exception);
-      TCPSocket(const Host &host) throw(Exception);
+      TCPSocket(unsigned short port) GNET_THROWS(Exception);
+      TCPSocket(const Host &host) GNET_THROWS(Exception);
       virtual ~TCPSocket();
       
-      void bind() throw(Exception);
-      void listen(int maxConnections) throw(Exception);
-      void bindAndListen(int maxConnections) throw(Exception);
+      // Must be called before bind
+      void setReuseAddress(bool on) GNET_THROWS(Exception);
+      // Let several sockets bind the same address and port, the system then
+      // load balances incoming connections between them
+      // Throws if the platform doesn't support it
+      void setReusePort(bool on) GNET_THROWS(Exception);
+      
+      void bind() GNET_THROWS(Exception);
+      void listen(int maxConnections) GNET_THROWS(Exception);
+      void bindAndListen(int maxConnections) GNET_THROWS(Exception);
+      
+      // timeout is in milliseconds: -1 waits forever, 0 doesn't wait
+      // return NULL if timeout expired, a timed out connect can be resumed by calling it again
+      TCPConnection* acceptConnection(int timeout=-1) GNET_THROWS(Exception);
+      TCPConnection* connect(int timeout=-1) GNET_THROWS(Exception);
+      // Happy Eyeballs (RFC 8305): race connection attempts to all hosts, as
+      // returned by Resolver, alternating address families. A new attempt
+      // starts every delay milliseconds, or as soon as the previous one fails,
+      // the first to complete wins and the others are cancelled
+      // On success, the socket takes the address of the winning host
+      // Returns NULL if timeout expired, throws if all attempts failed
+      TCPConnection* connect(const std::vector<Host> &hosts, int timeout=-1, int delay=250) GNET_THROWS(Exception);
+      // Accept all pending connections without waiting, up to max (0 for no limit)
+      // Accepted connections are appended to conns, already non-blocking and
+      // close-on-exec. Returns the number of accepted connections
+      // Meant to be called when the socket is reported readable. A blocking
+      // socket costs an extra poll per connection to avoid blocking
+      size_t acceptBatch(std::vector<TCPConnection*> &conns, size_t max=64) GNET_THROWS(Exception);
+      // Close and delete a connection of this socket. Connections of other
+      // sockets, ones already closed and stale handles are ignored (conn is
+      // looked up, not dereferenced, before it is known to be open)
+      void closeConnection(TCPConnection *conn);
+      void closeConnection(const ConnectionHandle &handle);
       
-      TCPConnection* acceptConnection() throw(Exception);
-      TCPConnection* connect() throw(Exception);
-      void closeConnection(TCPConnection*);
+      // Open connections, all lookups are constant time
+      // Returns NULL for stale handles and unknown descriptors
+      TCPConnection* connection(const ConnectionHandle &handle) const;
+      TCPConnection* connectionByFD(sock_t fd) const;
+      
+      // Iterate with connectionAt(i), i < connectionCount(). Closing a
+      // connection moves the last one to its index: iterate backwards to close
+      // connections on the way
+      inline size_t connectionCount() const {
+        return mLive.size();
+      }
+      
+      inline TCPConnection* connectionAt(size_t i) const {
+        return mSlots[mLive[i]].conn;
+      }
     
     protected:
       
@@ -89,12 +211,203 @@ namespace gnet {
       TCPSocket(const TCPSocket&);
       TCPSocket& operator=(const TCPSocket&);
       
+      // Register a new connection (slot, handle and descriptor index)
+      TCPConnection* track(TCPConnection *conn);
+      void untrack(TCPConnection *conn);
+    
     protected:
       
+      // Connection registry: a slot map. Free slots are chained through
+      // their next field and keep their generation, bumped on release, so
+      // that handles to closed connections no longer resolve.
+      struct Slot {
+        TCPConnection *conn;
+        // descriptor indexed for the connection (it loses it when remotely closed)
+        sock_t fd;
+        unsigned int generation;
+        // position in mLive, or next free slot
+        unsigned int next;
+      };
+      
       int mMaxConnections;
-      std::vector<TCPConnection*> mConnections;
-      fd_set mRead;
-      fd_set mWrite;
+      std::vector<Slot> mSlots;
+      // slots of open connections, packed
+      std::vector<unsigned int> mLive;
+      unsigned int mFreeSlot;
+#ifdef _WIN32
+      // SOCKET values are not small integers
+      std::unordered_map<sock_t, unsigned int> mFDSlots;
+#else
+      // slot + 1 per descriptor, 0 for none
+      std::vector<unsigned int> mFDSlots;
+#endif
+      // slot per open connection, to validate closeConnection arguments
+      std::unordered_map<const TCPConnection*, unsigned int> mConnSlots;
+      // descriptors accepted by a Poller (io_uring backend), non-blocking
+      std::deque<sock_t> mAccepted;
+  };
+
+#ifndef _WIN32
+  
+  // Local stream socket (AF_UNIX)
+  // A path starting with '@' names a socket in the abstract namespace (linux),
+  // it has no filesystem entry and vanishes with its last descriptor
+  
+  class GNET_API UnixSocket : public Socket {
+    public:
+      
+      friend class UnixConnection;
+      
+      UnixSocket(const std::string &path) GNET_THROWS(Exception);
+      // Removes the filesystem entry created by bind
+      virtual ~UnixSocket();
+      
+      inline const std::string& path() const {
+        return mPath;
+      }
+      
+      // Fails if path already exists
+      void bind() GNET_THROWS(Exception);
+      void listen(int maxConnections) GNET_THROWS(Exception);
+      void bindAndListen(int maxConnections) GNET_THROWS(Exception);
+      
+      // timeout is in milliseconds: -1 waits forever, 0 doesn't wait
+      // return NULL if timeout expired
+      UnixConnection* acceptConnection(int timeout=-1) GNET_THROWS(Exception);
+      // Local connections complete right away (or fail), unless the listening
+      // socket backlog is full
+      UnixConnection* connect() GNET_THROWS(Exception);
+      void closeConnection(UnixConnection*);
+    
+    protected:
+      
+      UnixSocket();
+      UnixSocket(const UnixSocket&);
+      UnixSocket& operator=(const UnixSocket&);
+    
+    protected:
+      
+      std::string mPath;
+      bool mBound;
+      std::vector<UnixConnection*> mConnections;
+  };
+
+#endif
+  
+  struct GNET_API Datagram {
+    
+    Datagram();
+    
+    char *bytes;
+    size_t len;
+    // Source (received) or destination (sent) address
+    // Datagrams sent with a default constructed host go to the connected peer
+    Host host;
+    // Segmentation offload: when not 0, bytes holds several datagrams of
+    // segment bytes each (the last one may be shorter)
+    size_t segment;
+  };
+  
+  // Preallocated receive buffers for UDPSocket::receive
+  
+  class GNET_API DatagramBatch {
+    
+    public:
+      
+      // count datagrams of at most maxSize bytes (more with GRO enabled)
+      DatagramBatch(size_t count, size_t maxSize=65536);
+      ~DatagramBatch();
+      
+      inline size_t count() const {
+        return mDatagrams.size();
+      }
+      
+      inline size_t maxSize() const {
+        return mMaxSize;
+      }
+      
+      inline Datagram& operator[](size_t i) {
+        return mDatagrams[i];
+      }
+      
+      inline const Datagram& operator[](size_t i) const {
+        return mDatagrams[i];
+      }
+    
+    private:
+      
+      DatagramBatch(const DatagramBatch&);
+      DatagramBatch& operator=(const DatagramBatch&);
+    
+    protected:
+      
+      friend class UDPSocket;
+      
+      std::vector<Datagram> mDatagrams;
+      char *mStorage;
+      size_t mMaxSize;
+      // system message headers, reused across calls
+      void *mHeaders;
+  };
+  
+  class GNET_API UDPSocket : public Socket {
+    public:
+      
+      friend class UDPConnection;
+      
+      UDPSocket(unsigned short port) GNET_THROWS(Exception);
+      // Local address for bind, or peer address for connect
+      UDPSocket(const Host &host) GNET_THROWS(Exception);
+      virtual ~UDPSocket();
+      
+      void setReuseAddress(bool on) GNET_THROWS(Exception);
+      void bind() GNET_THROWS(Exception);
+      
+      // Restrict the socket to exchanging datagrams with its host
+      // The connection shares the socket descriptor and is owned by the socket
+      UDPConnection* connect() GNET_THROWS(Exception);
+      
+      // timeout is in milliseconds: -1 waits forever, 0 doesn't wait
+      // Return false if timeout expired
+      bool sendTo(const Host &host, const char *bytes, size_t len, int timeout=-1) GNET_THROWS(Exception);
+      // len is the size of bytes on input, the size of the datagram on output
+      bool receiveFrom(Host &host, char *bytes, size_t &len, int timeout=-1) GNET_THROWS(Exception);
+      
+      // Receive up to batch.count() datagrams with a single system call
+      // (recvmmsg on linux), waiting at most timeout for the first one
+      // Returns the number of datagrams received, 0 if timeout expired
+      size_t receive(DatagramBatch &batch, int timeout=-1) GNET_THROWS(Exception);
+      // Send datagrams with as few system calls as possible (sendmmsg on linux)
+      // Returns the number of datagrams sent, less than count if timeout expired
+      // Without segmentation offload, segmented datagrams are split by gnet
+      // and a timeout can leave one of them partly sent: partial, if given,
+      // receives the bytes of datagrams[returned] already sent (a multiple of
+      // its segment size). It is also read on input, as the bytes of
+      // datagrams[0] to skip, so that passing it back with the remaining
+      // datagrams resumes where the previous call stopped
+      size_t send(const Datagram *datagrams, size_t count, int timeout=-1, size_t *partial=0) GNET_THROWS(Exception);
+      
+      // Let the system coalesce consecutive datagrams from the same source
+      // (UDP_GRO), received datagrams then have their segment size set
+      // Throws if not supported
+      void setGRO(bool on) GNET_THROWS(Exception);
+      
+      // Datagram::segment is handed to the system (UDP_SEGMENT) rather than
+      // split into individual datagrams by gnet
+      static bool SupportsGSO();
+    
+    protected:
+      
+      UDPSocket();
+      UDPSocket(const UDPSocket&);
+      UDPSocket& operator=(const UDPSocket&);
+      
+      // Handle a failed send call, returns true if it can be retried
+      bool sendFailed(long long deadline) GNET_THROWS(Exception);
+    
+    protected:
+      
+      UDPConnection *mConnection;
   };
   
 }
@@ -0,0 +1,99 @@
+#include <gnet/all.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#ifndef _WIN32
+# include <time.h>
+#endif
+
+// Responses made of many small writes, sent as is or coalesced by the
+// connection output buffer (one send per response).
+
+static double Now() {
+#ifdef _WIN32
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter(&c);
+  QueryPerformanceFrequency(&f);
+  return double(c.QuadPart) / double(f.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return double(ts.tv_sec) + 1.0e-9 * double(ts.tv_nsec);
+#endif
+}
+
+static const char *Pieces[] = {
+  "HTTP/1.1 200 OK\r\n", "Content-Type: ", "text/plain", "\r\n",
+  "Content-Length: ", "5", "\r\n", "Connection: ", "keep-alive", "\r\n",
+  "Server: ", "gnet", "\r\n", "X-Request: ", "42", "\r\n", "\r\n", "hello"
+};
+
+static const size_t PieceCount = sizeof(Pieces) / sizeof(Pieces[0]);
+
+static void Run(const char *label, gnet::TCPConnection *server, gnet::TCPConnection *client, size_t count, size_t buffer) {
+  
+  server->setOutputBuffer(buffer);
+  
+  size_t responseLength = 0;
+  for (size_t i=0; i<PieceCount; ++i) {
+    responseLength += strlen(Pieces[i]);
+  }
+  
+  double t0 = Now();
+  
+  for (size_t i=0; i<count; ++i) {
+    for (size_t j=0; j<PieceCount; ++j) {
+      server->write(Pieces[j], strlen(Pieces[j]));
+    }
+    server->flush();
+    
+    // keep socket buffers from filling up
+    size_t received = 0;
+    while (received < responseLength) {
+      char *bytes;
+      size_t len;
+      client->read(bytes, len);
+      received += len;
+      free(bytes);
+    }
+  }
+  
+  double elapsed = Now() - t0;
+  
+  fprintf(stdout, "%s: %10.0f responses/s (%.3f us each)\n",
+          label, double(count) / elapsed, 1.0e6 * elapsed / double(count));
+}
+
+int main(int argc, char **argv) {
+  
+  size_t count = 100000;
+  
+  if (argc >= 2) {
+    count = size_t(strtoul(argv[1], NULL, 10));
+  }
+  
+  gnet::Initialize();
+  
+  try {
+    gnet::TCPSocket listener(gnet::Host("127.0.0.1", 0));
+    listener.bindAndListen(1);
+    
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    getsockname(listener.fd(), (struct sockaddr*) &addr, &len);
+    
+    gnet::TCPSocket socket(gnet::Host((const struct sockaddr*) &addr, len));
+    gnet::TCPConnection *client = socket.connect();
+    gnet::TCPConnection *server = listener.acceptConnection();
+    
+    Run("   direct", server, client, count, 0);
+    Run("coalesced", server, client, count, 4096);
+    
+  } catch (gnet::Exception &e) {
+    fprintf(stdout, "%s\n", e.what());
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include <gcore/rex.h>
+#include <gnet/all.h>
+#include <cstdlib>
+#ifndef _WIN32
+# include <time.h>
+#endif
+
+// Compare Host construction rates against the former implementation
+// (gcore::Rex match then inet_aton for literals, gethostbyname for names).
+//
+// literal: dotted quad address, no lookup involved
+// name:    "localhost", resolved on every construction before, now cached
+
+static gcore::Rex IPAddressRE(RAW("\d{1,3}\.\d{1,3}\.\d{1,3}\.\d{1,3}"));
+
+static double Now() {
+#ifdef _WIN32
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter(&c);
+  QueryPerformanceFrequency(&f);
+  return double(c.QuadPart) / double(f.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return double(ts.tv_sec) + 1.0e-9 * double(ts.tv_nsec);
+#endif
+}
+
+// former Host::Host body
+static bool OldHost(const std::string &addr, unsigned short port, struct sockaddr_in &sa) {
+  memset(&sa, 0, sizeof(struct sockaddr_in));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = INADDR_ANY;
+  sa.sin_port = htons((u_short)port);
+  
+  if (IPAddressRE.match(addr) == true) {
+#ifdef _WIN32
+    sa.sin_addr.s_addr = inet_addr(addr.c_str());
+#else
+    inet_aton(addr.c_str(), &(sa.sin_addr));
+#endif
+  } else {
+    struct hostent *he = gethostbyname(addr.c_str());
+    if (he == NULL) {
+      return false;
+    }
+    memcpy(&(sa.sin_addr.s_addr), he->h_addr, he->h_length);
+  }
+  
+  return true;
+}
+
+static void Report(const char *label, size_t count, unsigned int check, double elapsed) {
+  fprintf(stdout, "%s: %10.0f constructions/s (%.3f us each) [%u]\n",
+          label, double(count) / elapsed, 1.0e6 * elapsed / double(count), check);
+}
+
+static void Run(const char *label, const std::string &addr, size_t count) {
+  struct sockaddr_in sa;
+  unsigned int check = 0;
+  
+  double t0 = Now();
+  for (size_t i=0; i<count; ++i) {
+    if (OldHost(addr, (unsigned short)i, sa)) {
+      check += sa.sin_addr.s_addr;
+    }
+  }
+  double elapsed = Now() - t0;
+  
+  std::string l = std::string(label) + " old";
+  Report(l.c_str(), count, check, elapsed);
+  
+  check = 0;
+  t0 = Now();
+  for (size_t i=0; i<count; ++i) {
+    gnet::Host h(addr, (unsigned short)i);
+    check += ((const struct sockaddr_in*)(const struct sockaddr*)h)->sin_addr.s_addr;
+  }
+  elapsed = Now() - t0;
+  
+  l = std::string(label) + " new";
+  Report(l.c_str(), count, check, elapsed);
+}
+
+int main(int argc, char **argv) {
+  
+  size_t count = 1000000;
+  
+  if (argc >= 2) {
+    count = size_t(atoi(argv[1]));
+  }
+  
+  gnet::Initialize();
+  
+  try {
+    Run("literal", "192.168.100.254", count);
+    // lookups are much slower, keep runtime reasonable
+    Run("name   ", "localhost", count / 10);
+    
+  } catch (gnet::Exception &e) {
+    
+    std::cout << e.what() << std::endl;
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
@@ -0,0 +1,226 @@
+#include <gnet/all.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+
+// Echo server driven by one thread per connection (blocking reads), by the
+// epoll Poller, and by the io_uring Poller. The server runs in a child
+// process so that its own CPU time (user and system) can be reported per
+// request: system time stands for the cost of the calls into the kernel.
+
+#ifndef __linux__
+
+int main(int, char**) {
+  fprintf(stdout, "This benchmark is only available on linux.\n");
+  return 0;
+}
+
+#else
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return double(ts.tv_sec) + 1.0e-9 * double(ts.tv_nsec);
+}
+
+static double Seconds(const struct timeval &tv) {
+  return double(tv.tv_sec) + 1.0e-6 * double(tv.tv_usec);
+}
+
+static const char Message[] = "0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopq\n";
+static const size_t MessageLength = sizeof(Message) - 1;
+
+enum Mode {
+  Blocking = 0,
+  Epoll,
+  IOUring
+};
+
+class EchoHandler : public gnet::Poller::Handler {
+  public:
+    
+    EchoHandler(size_t connections)
+      : mRemaining(connections) {
+    }
+    
+    virtual void onAccept(gnet::Poller &poller, gnet::TCPSocket *socket) {
+      std::vector<gnet::TCPConnection*> conns;
+      socket->acceptBatch(conns, 0);
+      for (size_t i=0; i<conns.size(); ++i) {
+        poller.add(conns[i], this);
+      }
+    }
+    
+    virtual void onRead(gnet::Poller &poller, gnet::Connection *conn) {
+      try {
+        const char *bytes;
+        size_t len;
+        while (conn->peek(bytes, len, 0, 0)) {
+          conn->write(bytes, len);
+          conn->consume(len);
+        }
+      } catch (gnet::Exception &) {
+        onClose(poller, conn);
+      }
+    }
+    
+    virtual void onClose(gnet::Poller &poller, gnet::Connection *conn) {
+      gnet::TCPConnection *tcpconn = (gnet::TCPConnection*) conn;
+      poller.remove(conn);
+      tcpconn->socket()->closeConnection(tcpconn);
+      if (--mRemaining == 0) {
+        poller.stop();
+      }
+    }
+  
+  private:
+    
+    size_t mRemaining;
+};
+
+static void EchoThread(gnet::TCPConnection *conn) {
+  try {
+    while (true) {
+      const char *bytes;
+      size_t len;
+      conn->peek(bytes, len);
+      conn->write(bytes, len);
+      conn->consume(len);
+    }
+  } catch (gnet::Exception &) {
+  }
+}
+
+static void Serve(gnet::TCPSocket &listener, Mode mode, size_t connections) {
+  if (mode == Blocking) {
+    std::vector<std::thread> threads;
+    for (size_t i=0; i<connections; ++i) {
+      threads.push_back(std::thread(EchoThread, listener.acceptConnection()));
+    }
+    for (size_t i=0; i<threads.size(); ++i) {
+      threads[i].join();
+    }
+  
+  } else {
+    gnet::Poller poller(mode == IOUring ? gnet::Poller::IOUring : gnet::Poller::Default);
+    if (mode == IOUring && poller.backend() != gnet::Poller::IOUring) {
+      fprintf(stdout, "  (io_uring not supported, using epoll)\n");
+    }
+    EchoHandler handler(connections);
+    listener.setBlocking(false);
+    poller.add(&listener, &handler);
+    poller.run();
+    poller.remove(&listener);
+  }
+}
+
+static void Run(const char *label, Mode mode, size_t connections, size_t rounds) {
+  
+  gnet::TCPSocket listener(gnet::Host("127.0.0.1", 0));
+  listener.bindAndListen(int(connections));
+  
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  getsockname(listener.fd(), (struct sockaddr*) &addr, &len);
+  
+  fflush(stdout);
+  
+  pid_t pid = fork();
+  
+  if (pid == 0) {
+    try {
+      Serve(listener, mode, connections);
+    } catch (gnet::Exception &e) {
+      fprintf(stdout, "%s\n", e.what());
+    }
+    fflush(stdout);
+    _exit(0);
+  }
+  
+  std::vector<gnet::TCPSocket*> sockets;
+  std::vector<gnet::TCPConnection*> conns;
+  
+  double t0 = 0.0;
+  double elapsed = 0.0;
+  
+  try {
+    for (size_t i=0; i<connections; ++i) {
+      sockets.push_back(new gnet::TCPSocket(gnet::Host((const struct sockaddr*) &addr, len)));
+      conns.push_back(sockets.back()->connect());
+    }
+    
+    t0 = Now();
+    
+    // every connection has one request in flight
+    for (size_t r=0; r<rounds; ++r) {
+      for (size_t i=0; i<connections; ++i) {
+        conns[i]->write(Message, MessageLength);
+      }
+      for (size_t i=0; i<connections; ++i) {
+        const char *bytes;
+        size_t n;
+        conns[i]->peek(bytes, n, "\n");
+        conns[i]->consume(n);
+      }
+    }
+    
+    elapsed = Now() - t0;
+    
+  } catch (gnet::Exception &e) {
+    fprintf(stdout, "%s\n", e.what());
+  }
+  
+  // closing connections stops the server
+  for (size_t i=0; i<sockets.size(); ++i) {
+    delete sockets[i];
+  }
+  
+  int status = 0;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  
+  double requests = double(connections * rounds);
+  
+  fprintf(stdout, "%s: %10.0f requests/s, server %.2f us user + %.2f us system per request\n",
+          label, requests / elapsed,
+          1.0e6 * Seconds(usage.ru_utime) / requests,
+          1.0e6 * Seconds(usage.ru_stime) / requests);
+}
+
+int main(int argc, char **argv) {
+  
+  size_t connections = 64;
+  size_t rounds = 2000;
+  
+  if (argc >= 2) {
+    connections = size_t(strtoul(argv[1], NULL, 10));
+  }
+  if (argc >= 3) {
+    rounds = size_t(strtoul(argv[2], NULL, 10));
+  }
+  
+  gnet::Initialize();
+  
+  fprintf(stdout, "%lu connections, %lu rounds\n", (unsigned long) connections, (unsigned long) rounds);
+  
+  try {
+    Run("blocking", Blocking, connections, rounds);
+    Run("   epoll", Epoll, connections, rounds);
+    Run("io_uring", IOUring, connections, rounds);
+    
+  } catch (gnet::Exception &e) {
+    fprintf(stdout, "%s\n", e.what());
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
+
+#endif
@@ -0,0 +1,289 @@
+#include <gnet/all.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+// TCPSocket connection registry with many connections and high churn.
+//
+// churn:    close a random connection and accept a new one, as a server
+//           does; closeConnection used to search and erase a vector
+// registry: the same churn on the registry alone (untrack/track), against
+//           the former std::find + vector::erase over as many connections
+// lookup:   connection(handle) and connectionByFD
+//
+// usage: bench_registry [connections [operations]]
+// Connections default to 100000, capped by the descriptor limit: both ends of
+// every connection live in this process. Clients connect from several
+// loopback addresses (127.0.0.1, 127.0.0.2, ...), each one has its own range
+// of ephemeral ports. Where only 127.0.0.1 is available (not linux), the
+// ephemeral port range caps connections too.
+
+#ifdef _WIN32
+
+int main(int, char**) {
+  fprintf(stdout, "This benchmark is not available on windows.\n");
+  return 0;
+}
+
+#else
+
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return double(ts.tv_sec) + 1.0e-9 * double(ts.tv_nsec);
+}
+
+// Exposes the registry primitives
+class Listener : public gnet::TCPSocket {
+  public:
+    
+    Listener(const gnet::Host &host)
+      : gnet::TCPSocket(host) {
+    }
+    
+    using gnet::TCPSocket::track;
+    using gnet::TCPSocket::untrack;
+};
+
+// Number of ephemeral ports for each local address
+static size_t EphemeralPorts() {
+  unsigned long lo = 49152, hi = 65535;
+  FILE *f = fopen("/proc/sys/net/ipv4/ip_local_port_range", "r");
+  if (f) {
+    if (fscanf(f, "%lu %lu", &lo, &hi) != 2 || hi < lo) {
+      lo = 49152;
+      hi = 65535;
+    }
+    fclose(f);
+  }
+  return size_t(hi - lo + 1);
+}
+
+static bool BindLoopback(sock_t fd, size_t index) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK + (unsigned int) index);
+  addr.sin_port = 0;
+  return (::bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0);
+}
+
+// Number of usable loopback source addresses, 1 if only 127.0.0.1 works
+static size_t LoopbackSources() {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  bool ok = (fd != -1 && BindLoopback(fd, 1));
+  if (fd != -1) {
+    ::close(fd);
+  }
+  return (ok ? 254 : 1);
+}
+
+// Connect a new client from the source-th loopback address
+static gnet::TCPSocket* Connect(const gnet::Host &host, size_t source) {
+  gnet::TCPSocket *client = new gnet::TCPSocket(host);
+  if (source > 0 && !BindLoopback(client->fd(), source)) {
+    delete client;
+    throw gnet::Exception("bench_registry", "Could not bind client address.", true);
+  }
+  try {
+    client->connect();
+  } catch (gnet::Exception &) {
+    delete client;
+    throw;
+  }
+  return client;
+}
+
+static gnet::Host Bound(gnet::TCPSocket &socket) {
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  getsockname(socket.fd(), (struct sockaddr*) &addr, &len);
+  return gnet::Host((const struct sockaddr*) &addr, len);
+}
+
+int main(int argc, char **argv) {
+  
+  size_t count = 100000;
+  size_t operations = 20000;
+  
+  if (argc >= 2) {
+    count = size_t(strtoul(argv[1], NULL, 10));
+  }
+  if (argc >= 3) {
+    operations = size_t(strtoul(argv[2], NULL, 10));
+  }
+  
+  struct rlimit rl;
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  getrlimit(RLIMIT_NOFILE, &rl);
+  
+  size_t maxCount = (rl.rlim_cur > 256 ? size_t(rl.rlim_cur - 256) / 2 : 0);
+  if (count > maxCount) {
+    fprintf(stdout, "descriptor limit %lu: %lu connections instead of %lu\n",
+            (unsigned long) rl.rlim_cur, (unsigned long) maxCount, (unsigned long) count);
+    count = maxCount;
+  }
+  
+  // keep clear of the end of each port range, churn doesn't spread evenly
+  size_t ports = EphemeralPorts();
+  size_t perSource = (ports > 20000 ? 20000 : ports * 3 / 4);
+  size_t maxSources = LoopbackSources();
+  
+  if (count > perSource * maxSources) {
+    fprintf(stdout, "%lu ephemeral ports on %lu address(es): %lu connections instead of %lu\n",
+            (unsigned long) ports, (unsigned long) maxSources,
+            (unsigned long) (perSource * maxSources), (unsigned long) count);
+    count = perSource * maxSources;
+  }
+  
+  // clients go to source addresses in turn
+  size_t sources = (count + perSource - 1) / perSource;
+  size_t serial = 0;
+  if (count == 0) {
+    return 1;
+  }
+  
+  gnet::Initialize();
+  
+  srand(1);
+  
+  try {
+    Listener listener(gnet::Host("127.0.0.1", 0));
+    listener.bindAndListen(1024);
+    
+    gnet::Host host = Bound(listener);
+    
+    // client socket of each server connection, by descriptor
+    std::vector<gnet::TCPSocket*> peers;
+    
+    double t0 = Now();
+    
+    for (size_t i=0; i<count; ++i) {
+      gnet::TCPSocket *client = Connect(host, (sources > 1 ? 1 + serial++ % sources : 0));
+      gnet::TCPConnection *conn = listener.acceptConnection();
+      if (peers.size() <= size_t(conn->fd())) {
+        peers.resize(size_t(conn->fd()) + 1, 0);
+      }
+      peers[size_t(conn->fd())] = client;
+    }
+    
+    fprintf(stdout, "%lu connections from %lu address(es) opened in %.2f s\n",
+            (unsigned long) count, (unsigned long) sources, Now() - t0);
+    
+    // churn: server closes, client goes away, a new client connects
+    double closing = 0.0;
+    double total = 0.0;
+    
+    t0 = Now();
+    
+    for (size_t i=0; i<operations; ++i) {
+      gnet::TCPConnection *conn = listener.connectionAt(size_t(rand()) % listener.connectionCount());
+      gnet::TCPSocket *peer = peers[size_t(conn->fd())];
+      
+      double s = Now();
+      listener.closeConnection(conn);
+      closing += Now() - s;
+      
+      delete peer;
+      
+      gnet::TCPSocket *client = Connect(host, (sources > 1 ? 1 + serial++ % sources : 0));
+      conn = listener.acceptConnection();
+      if (peers.size() <= size_t(conn->fd())) {
+        peers.resize(size_t(conn->fd()) + 1, 0);
+      }
+      peers[size_t(conn->fd())] = client;
+    }
+    
+    total = Now() - t0;
+    
+    fprintf(stdout, "churn:    %8.0f ns per closeConnection, %8.0f ns per close + connect + accept\n",
+            1.0e9 * closing / double(operations), 1.0e9 * total / double(operations));
+    
+    // registry alone, same connections and pattern
+    std::vector<gnet::TCPConnection*> former;
+    for (size_t i=0; i<listener.connectionCount(); ++i) {
+      former.push_back(listener.connectionAt(i));
+    }
+    
+    t0 = Now();
+    for (size_t i=0; i<operations; ++i) {
+      gnet::TCPConnection *conn = listener.connectionAt(size_t(rand()) % listener.connectionCount());
+      listener.untrack(conn);
+      listener.track(conn);
+    }
+    double slotmap = Now() - t0;
+    
+    t0 = Now();
+    for (size_t i=0; i<operations; ++i) {
+      gnet::TCPConnection *conn = former[size_t(rand()) % former.size()];
+      former.erase(std::find(former.begin(), former.end(), conn));
+      former.push_back(conn);
+    }
+    double vector = Now() - t0;
+    
+    fprintf(stdout, "registry: %8.1f ns per remove + insert (slot map), %8.1f ns (vector)\n",
+            1.0e9 * slotmap / double(operations), 1.0e9 * vector / double(operations));
+    
+    // lookups
+    std::vector<gnet::ConnectionHandle> handles;
+    std::vector<sock_t> fds;
+    for (size_t i=0; i<listener.connectionCount(); ++i) {
+      handles.push_back(listener.connectionAt(i)->handle());
+      fds.push_back(listener.connectionAt(i)->fd());
+    }
+    for (size_t i=handles.size()-1; i>0; --i) {
+      size_t j = size_t(rand()) % (i + 1);
+      std::swap(handles[i], handles[j]);
+      std::swap(fds[i], fds[j]);
+    }
+    
+    size_t found = 0;
+    size_t rounds = (10000000 / handles.size() > 0 ? 10000000 / handles.size() : 1);
+    
+    t0 = Now();
+    for (size_t r=0; r<rounds; ++r) {
+      for (size_t i=0; i<handles.size(); ++i) {
+        found += (listener.connection(handles[i]) ? 1 : 0);
+      }
+    }
+    double byHandle = Now() - t0;
+    
+    t0 = Now();
+    for (size_t r=0; r<rounds; ++r) {
+      for (size_t i=0; i<fds.size(); ++i) {
+        found += (listener.connectionByFD(fds[i]) ? 1 : 0);
+      }
+    }
+    double byFD = Now() - t0;
+    
+    double lookups = double(rounds * handles.size());
+    
+    fprintf(stdout, "lookup:   %8.1f ns per connection(handle), %8.1f ns per connectionByFD (%lu found)\n",
+            1.0e9 * byHandle / lookups, 1.0e9 * byFD / lookups, (unsigned long) found);
+    
+    // the listener closes the server side
+    for (size_t i=0; i<listener.connectionCount(); ++i) {
+      delete peers[size_t(listener.connectionAt(i)->fd())];
+    }
+  
+  } catch (gnet::Exception &e) {
+    fprintf(stdout, "%s\n", e.what());
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
+
+#endif
@@ -0,0 +1,103 @@
+#include <gnet/all.h>
+#include <cstdio>
+#include <cstdlib>
+
+// Round trip latency of small messages between two processes, over a unix
+// socket and over a ShmConnection set up through that same socket.
+
+#ifndef __linux__
+
+int main(int, char**) {
+  fprintf(stdout, "ShmConnection is only available on linux.\n");
+  return 0;
+}
+
+#else
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return double(ts.tv_sec) + 1.0e-9 * double(ts.tv_nsec);
+}
+
+static const char Message[] = "0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopq\n";
+static const size_t MessageLength = sizeof(Message) - 1;
+
+static void Echo(gnet::Connection *conn, size_t count) {
+  for (size_t i=0; i<count; ++i) {
+    const char *bytes;
+    size_t len;
+    conn->peek(bytes, len, "\n");
+    conn->write(bytes, len);
+    conn->consume(len);
+  }
+}
+
+static void PingPong(const char *label, gnet::Connection *conn, size_t count) {
+  double t0 = Now();
+  for (size_t i=0; i<count; ++i) {
+    const char *bytes;
+    size_t len;
+    conn->write(Message, MessageLength);
+    conn->peek(bytes, len, "\n");
+    conn->consume(len);
+  }
+  double elapsed = Now() - t0;
+  
+  fprintf(stdout, "%s: %10.0f round trips/s (%.3f us each)\n",
+          label, double(count) / elapsed, 1.0e6 * elapsed / double(count));
+}
+
+int main(int argc, char **argv) {
+  
+  size_t count = 200000;
+  
+  if (argc >= 2) {
+    count = size_t(strtoul(argv[1], NULL, 10));
+  }
+  
+  gnet::Initialize();
+  
+  try {
+    gnet::UnixSocket socket("@gnet_bench_shm");
+    socket.bindAndListen(1);
+    
+    pid_t pid = fork();
+    
+    if (pid == 0) {
+      gnet::UnixSocket peer("@gnet_bench_shm");
+      gnet::UnixConnection *conn = peer.connect();
+      
+      Echo(conn, count);
+      
+      gnet::ShmConnection *shm = gnet::ShmConnection::Accept(conn);
+      Echo(shm, count);
+      delete shm;
+      
+      _exit(0);
+    }
+    
+    gnet::UnixConnection *conn = socket.acceptConnection();
+    
+    PingPong("unix", conn, count);
+    
+    gnet::ShmConnection *shm = gnet::ShmConnection::Connect(conn);
+    PingPong(" shm", shm, count);
+    delete shm;
+    
+    waitpid(pid, 0, 0);
+    
+  } catch (gnet::Exception &e) {
+    fprintf(stdout, "%s\n", e.what());
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
+
+#endif
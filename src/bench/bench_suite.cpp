@@ -0,0 +1,508 @@
+#include <gnet/all.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#ifndef _WIN32
+# include <time.h>
+#endif
+
+// Loopback benchmarks meant to be compared between library versions.
+// Every run uses the same message sizes, counts and pseudo random streams.
+// Results go to stdout (or the -o file) as a JSON document, progress to stderr.
+//
+// pingpong:   round trip latency of one connection echoing small messages
+// throughput: bulk streaming with several write sizes
+// until:      read-until parsing of a stream of delimited messages
+// frames:     length prefixed parsing of a stream of frames
+// accept:     draining a listen backlog with acceptBatch
+// connect:    connect/accept/close cycles, latency of connect
+//
+// usage: bench_suite [-q] [-o file] [name ...]
+//        -q divides all counts by 10
+
+static double Now() {
+#ifdef _WIN32
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter(&c);
+  QueryPerformanceFrequency(&f);
+  return double(c.QuadPart) / double(f.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return double(ts.tv_sec) + 1.0e-9 * double(ts.tv_nsec);
+#endif
+}
+
+static long long Nanoseconds(double seconds) {
+  return (long long)(seconds * 1.0e9 + 0.5);
+}
+
+static size_t Scale = 1;
+
+static size_t Scaled(size_t n) {
+  return (n / Scale > 0 ? n / Scale : 1);
+}
+
+static std::vector<std::string> Results;
+
+static std::string Latency(const gnet::Histogram &h) {
+  char buffer[512];
+  snprintf(buffer, sizeof(buffer),
+           "{\"min\": %lld, \"mean\": %.0f, \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld}",
+           h.min(), h.mean(), h.percentile(50.0), h.percentile(90.0), h.percentile(99.0),
+           h.percentile(99.9), h.max());
+  return buffer;
+}
+
+// Loopback listener on a system chosen port
+class Listener {
+  public:
+    
+    Listener(int backlog)
+      : mSocket(gnet::Host("127.0.0.1", 0)) {
+      mSocket.bindAndListen(backlog);
+      struct sockaddr_storage addr;
+#ifdef _WIN32
+      int len = sizeof(addr);
+#else
+      socklen_t len = sizeof(addr);
+#endif
+      getsockname(mSocket.fd(), (struct sockaddr*) &addr, &len);
+      mHost = gnet::Host((const struct sockaddr*) &addr, len);
+    }
+    
+    gnet::TCPSocket& socket() {
+      return mSocket;
+    }
+    
+    const gnet::Host& host() const {
+      return mHost;
+    }
+  
+  private:
+    
+    gnet::TCPSocket mSocket;
+    gnet::Host mHost;
+};
+
+// Server side of a single connection benchmark, runs in its own thread
+class Peer {
+  public:
+    
+    typedef void (*Function)(gnet::TCPConnection *conn, void *data);
+    
+    Peer(Listener &listener, Function func, void *data)
+      : mListener(listener), mFunc(func), mData(data) {
+      mThread = std::thread(&Peer::run, this);
+    }
+    
+    void join() {
+      mThread.join();
+    }
+  
+  private:
+    
+    void run() {
+      gnet::TCPConnection *conn = 0;
+      try {
+        conn = mListener.socket().acceptConnection();
+        mFunc(conn, mData);
+      } catch (gnet::Exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+      }
+      if (conn) {
+        mListener.socket().closeConnection(conn);
+      }
+    }
+  
+  private:
+    
+    Listener &mListener;
+    Function mFunc;
+    void *mData;
+    std::thread mThread;
+};
+
+static void Echo(gnet::TCPConnection *conn, void *) {
+  try {
+    while (true) {
+      const char *bytes;
+      size_t len;
+      conn->peek(bytes, len);
+      conn->write(bytes, len);
+      conn->consume(len);
+    }
+  } catch (gnet::Exception &) {
+    // client closed
+  }
+}
+
+static void PingPong(size_t size, size_t count) {
+  // echoes come back in several pieces for larger messages: no Nagle delay
+  gnet::SocketOptions options;
+  options.noDelay = 1;
+  
+  Listener listener(1);
+  listener.socket().setOptions(options);
+  Peer peer(listener, Echo, 0);
+  
+  gnet::TCPSocket *socket = new gnet::TCPSocket(listener.host());
+  socket->setOptions(options);
+  gnet::TCPConnection *conn = socket->connect();
+  
+  std::string msg(size, 'x');
+  gnet::Histogram hist;
+  
+  size_t warmup = count / 10;
+  double t0 = 0.0;
+  
+  for (size_t i=0; i<warmup+count; ++i) {
+    if (i == warmup) {
+      t0 = Now();
+    }
+    double s = Now();
+    conn->write(msg.data(), size);
+    size_t received = 0;
+    while (received < size) {
+      const char *bytes;
+      size_t len;
+      conn->peek(bytes, len);
+      conn->consume(len);
+      received += len;
+    }
+    if (i >= warmup) {
+      hist.record(Nanoseconds(Now() - s));
+    }
+  }
+  
+  double elapsed = Now() - t0;
+  
+  delete socket;
+  peer.join();
+  
+  char buffer[1024];
+  snprintf(buffer, sizeof(buffer),
+           "{\"name\": \"pingpong\", \"size\": %lu, \"count\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"latency_ns\": %s}",
+           (unsigned long) size, (unsigned long) count, elapsed, double(count) / elapsed, Latency(hist).c_str());
+  Results.push_back(buffer);
+  
+  fprintf(stderr, "pingpong   %6lu B: %9.0f rtt/s  p50 %6.1f us  p99 %6.1f us  p999 %6.1f us\n",
+          (unsigned long) size, double(count) / elapsed,
+          1.0e-3 * double(hist.percentile(50.0)), 1.0e-3 * double(hist.percentile(99.0)),
+          1.0e-3 * double(hist.percentile(99.9)));
+}
+
+struct Sink {
+  size_t expected;
+  size_t received;
+};
+
+// Read everything, acknowledge with one byte once all bytes arrived
+static void Drain(gnet::TCPConnection *conn, void *data) {
+  Sink *sink = (Sink*) data;
+  while (sink->received < sink->expected) {
+    const char *bytes;
+    size_t len;
+    conn->peek(bytes, len);
+    conn->consume(len);
+    sink->received += len;
+  }
+  conn->write("!", 1);
+  conn->flush();
+}
+
+static void Throughput(size_t size, size_t total) {
+  size_t count = (total + size - 1) / size;
+  Sink sink = {count * size, 0};
+  
+  Listener listener(1);
+  Peer peer(listener, Drain, &sink);
+  
+  gnet::TCPSocket *socket = new gnet::TCPSocket(listener.host());
+  gnet::TCPConnection *conn = socket->connect();
+  
+  std::string msg(size, 'x');
+  
+  double t0 = Now();
+  
+  for (size_t i=0; i<count; ++i) {
+    conn->write(msg.data(), size);
+  }
+  const char *bytes;
+  size_t len;
+  conn->peek(bytes, len, 0, 60000);
+  
+  double elapsed = Now() - t0;
+  
+  delete socket;
+  peer.join();
+  
+  double mb = double(count * size) / (1024.0 * 1024.0);
+  
+  char buffer[1024];
+  snprintf(buffer, sizeof(buffer),
+           "{\"name\": \"throughput\", \"size\": %lu, \"count\": %lu, \"bytes\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f}",
+           (unsigned long) size, (unsigned long) count, (unsigned long) (count * size), elapsed,
+           double(count) / elapsed, mb / elapsed);
+  Results.push_back(buffer);
+  
+  fprintf(stderr, "throughput %6lu B: %9.0f msg/s  %8.1f MB/s\n",
+          (unsigned long) size, double(count) / elapsed, mb / elapsed);
+}
+
+struct Parse {
+  const char *until;
+  bool frames;
+  size_t expected;
+  size_t parsed;
+};
+
+static void Parser(gnet::TCPConnection *conn, void *data) {
+  Parse *parse = (Parse*) data;
+  const char *bytes;
+  size_t len;
+  if (parse->frames) {
+    while (parse->parsed < parse->expected) {
+      conn->peekFrame(bytes, len);
+      conn->consume(len);
+      ++parse->parsed;
+    }
+  } else {
+    while (parse->parsed < parse->expected) {
+      conn->peek(bytes, len, parse->until);
+      conn->consume(len);
+      ++parse->parsed;
+    }
+  }
+  conn->write("!", 1);
+  conn->flush();
+}
+
+// Messages of size/2 to 3*size/2 bytes, delimited or length prefixed
+static void MakeStream(std::string &stream, size_t size, size_t total, const char *until, size_t &count) {
+  gnet::Framing framing;
+  size_t dlen = (until ? strlen(until) : 0);
+  
+  stream.clear();
+  stream.reserve(total + 2 * size + 16);
+  count = 0;
+  
+  srand(1);
+  
+  while (stream.size() < total) {
+    size_t n = size / 2 + (size > 1 ? size_t(rand()) % size : 0);
+    if (!until) {
+      char header[10];
+      stream.append(header, framing.encode(n, header));
+    }
+    for (size_t i=0; i<n; ++i) {
+      stream.push_back(char('a' + rand() % 26));
+    }
+    if (until) {
+      stream.append(until, dlen);
+    }
+    ++count;
+  }
+}
+
+static void Parsing(const char *name, const char *until, size_t size, size_t total) {
+  std::string stream;
+  Parse parse = {until, (until == 0), 0, 0};
+  
+  MakeStream(stream, size, total, until, parse.expected);
+  
+  Listener listener(1);
+  Peer peer(listener, Parser, &parse);
+  
+  gnet::TCPSocket *socket = new gnet::TCPSocket(listener.host());
+  gnet::TCPConnection *conn = socket->connect();
+  
+  const size_t chunk = 64 * 1024;
+  
+  double t0 = Now();
+  
+  for (size_t off=0; off<stream.size(); off+=chunk) {
+    conn->write(stream.data() + off, (stream.size() - off < chunk ? stream.size() - off : chunk));
+  }
+  const char *bytes;
+  size_t len;
+  conn->peek(bytes, len, 0, 60000);
+  
+  double elapsed = Now() - t0;
+  
+  delete socket;
+  peer.join();
+  
+  double mb = double(stream.size()) / (1024.0 * 1024.0);
+  
+  char buffer[1024];
+  snprintf(buffer, sizeof(buffer),
+           "{\"name\": \"%s\", \"size\": %lu, \"count\": %lu, \"bytes\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f}",
+           name, (unsigned long) size, (unsigned long) parse.parsed, (unsigned long) stream.size(), elapsed,
+           double(parse.parsed) / elapsed, mb / elapsed);
+  Results.push_back(buffer);
+  
+  fprintf(stderr, "%-10s %6lu B: %9.0f msg/s  %8.1f MB/s\n",
+          name, (unsigned long) size, double(parse.parsed) / elapsed, mb / elapsed);
+}
+
+// Connections are established by the kernel before being accepted: fill the
+// backlog first, then time how fast acceptBatch empties it
+static void AcceptRate(size_t backlog, size_t rounds) {
+  Listener listener((int) backlog);
+  listener.socket().setBlocking(false);
+  
+  gnet::Histogram hist;
+  double elapsed = 0.0;
+  size_t accepted = 0;
+  
+  for (size_t r=0; r<rounds; ++r) {
+    std::vector<gnet::TCPSocket*> sockets;
+    std::vector<gnet::TCPConnection*> conns;
+    
+    for (size_t i=0; i<backlog; ++i) {
+      sockets.push_back(new gnet::TCPSocket(listener.host()));
+      sockets.back()->connect();
+    }
+    
+    double t0 = Now();
+    while (conns.size() < backlog) {
+      double s = Now();
+      size_t n = listener.socket().acceptBatch(conns, 0);
+      if (n > 0) {
+        hist.record(Nanoseconds((Now() - s) / double(n)), n);
+      }
+    }
+    elapsed += Now() - t0;
+    accepted += conns.size();
+    
+    for (size_t i=0; i<conns.size(); ++i) {
+      listener.socket().closeConnection(conns[i]);
+    }
+    for (size_t i=0; i<sockets.size(); ++i) {
+      delete sockets[i];
+    }
+  }
+  
+  char buffer[1024];
+  snprintf(buffer, sizeof(buffer),
+           "{\"name\": \"accept\", \"backlog\": %lu, \"count\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"latency_ns\": %s}",
+           (unsigned long) backlog, (unsigned long) accepted, elapsed, double(accepted) / elapsed,
+           Latency(hist).c_str());
+  Results.push_back(buffer);
+  
+  fprintf(stderr, "accept     %6lu  : %9.0f accept/s\n", (unsigned long) backlog, double(accepted) / elapsed);
+}
+
+// Full connection cycles: connect, accept, close on both ends
+static void ConnectRate(size_t count) {
+  Listener listener(16);
+  
+  gnet::Histogram hist;
+  
+  double t0 = Now();
+  
+  for (size_t i=0; i<count; ++i) {
+    double s = Now();
+    gnet::TCPSocket *socket = new gnet::TCPSocket(listener.host());
+    socket->connect();
+    hist.record(Nanoseconds(Now() - s));
+    gnet::TCPConnection *conn = listener.socket().acceptConnection();
+    listener.socket().closeConnection(conn);
+    delete socket;
+  }
+  
+  double elapsed = Now() - t0;
+  
+  char buffer[1024];
+  snprintf(buffer, sizeof(buffer),
+           "{\"name\": \"connect\", \"count\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"latency_ns\": %s}",
+           (unsigned long) count, elapsed, double(count) / elapsed, Latency(hist).c_str());
+  Results.push_back(buffer);
+  
+  fprintf(stderr, "connect           : %9.0f conn/s  p50 %6.1f us  p99 %6.1f us\n",
+          double(count) / elapsed, 1.0e-3 * double(hist.percentile(50.0)),
+          1.0e-3 * double(hist.percentile(99.0)));
+}
+
+static bool Selected(const std::vector<std::string> &names, const char *name) {
+  if (names.empty()) {
+    return true;
+  }
+  for (size_t i=0; i<names.size(); ++i) {
+    if (names[i] == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char **argv) {
+  
+  const char *output = 0;
+  std::vector<std::string> names;
+  
+  for (int i=1; i<argc; ++i) {
+    if (!strcmp(argv[i], "-q")) {
+      Scale = 10;
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      output = argv[++i];
+    } else {
+      names.push_back(argv[i]);
+    }
+  }
+  
+  gnet::Initialize();
+  
+  try {
+    if (Selected(names, "pingpong")) {
+      PingPong(64, Scaled(50000));
+      PingPong(4096, Scaled(20000));
+    }
+    if (Selected(names, "throughput")) {
+      static const size_t Sizes[] = {64, 1024, 16384, 262144};
+      for (size_t i=0; i<sizeof(Sizes)/sizeof(Sizes[0]); ++i) {
+        Throughput(Sizes[i], Scaled(Sizes[i] < 1024 ? 64*1024*1024 : 512*1024*1024));
+      }
+    }
+    if (Selected(names, "until")) {
+      Parsing("until", "\r\n", 64, Scaled(128*1024*1024));
+      Parsing("until", "\r\n", 1024, Scaled(256*1024*1024));
+    }
+    if (Selected(names, "frames")) {
+      Parsing("frames", 0, 64, Scaled(128*1024*1024));
+      Parsing("frames", 0, 1024, Scaled(256*1024*1024));
+    }
+    if (Selected(names, "accept")) {
+      AcceptRate(256, Scaled(40));
+    }
+    if (Selected(names, "connect")) {
+      ConnectRate(Scaled(10000));
+    }
+  
+  } catch (gnet::Exception &e) {
+    fprintf(stderr, "%s\n", e.what());
+  }
+  
+  FILE *out = (output ? fopen(output, "w") : stdout);
+  
+  if (out) {
+    fprintf(out, "{\n  \"suite\": \"gnet\",\n  \"scale\": %lu,\n  \"results\": [", (unsigned long) Scale);
+    for (size_t i=0; i<Results.size(); ++i) {
+      fprintf(out, "%s\n    %s", (i > 0 ? "," : ""), Results[i].c_str());
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (output) {
+      fclose(out);
+    }
+  } else {
+    fprintf(stderr, "Could not open %s\n", output);
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
@@ -0,0 +1,161 @@
+#include <gnet/all.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+// Requests per second of a TCPServer over loopback, for 1 to N workers.
+// Every client connection has one request in flight. The handler echoes a
+// line after spending the given number of microseconds blocked (standing for
+// a disk or database access): with handlers that block rather than compute,
+// throughput should grow with the number of workers even on few cores.
+
+static double Now() {
+  return 1.0e-6 * double(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static const char Message[] = "0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopq\n";
+static const size_t MessageLength = sizeof(Message) - 1;
+
+class EchoHandler : public gnet::TCPServer::Handler {
+  public:
+    
+    EchoHandler(int delay)
+      : mDelay(delay) {
+    }
+    
+    virtual bool onRequest(gnet::TCPServer &, gnet::TCPConnection *conn) {
+      const char *bytes;
+      size_t len;
+      // kept alive connections get their next request in the same packet or
+      // in a later one, never wait for it
+      while (conn->peek(bytes, len, "\n", 0)) {
+        if (mDelay > 0) {
+          std::this_thread::sleep_for(std::chrono::microseconds(mDelay));
+        }
+        conn->write(bytes, len);
+        conn->consume(len);
+      }
+      return true;
+    }
+  
+  private:
+    
+    int mDelay;
+};
+
+static void Client(gnet::TCPConnection *conn, size_t requests, bool *failed) {
+  try {
+    for (size_t i=0; i<requests; ++i) {
+      const char *bytes;
+      size_t len;
+      conn->write(Message, MessageLength);
+      conn->peek(bytes, len, "\n");
+      conn->consume(len);
+    }
+  } catch (gnet::Exception &e) {
+    fprintf(stdout, "%s\n", e.what());
+    *failed = true;
+  }
+}
+
+static void Run(size_t workers, size_t connections, size_t requests, int delay) {
+  
+  EchoHandler handler(delay);
+  gnet::TCPServer server(gnet::Host("127.0.0.1", 0), &handler, workers, int(connections));
+  
+  // replies are single small writes
+  gnet::SocketOptions options;
+  options.noDelay = 1;
+  server.setOptions(options);
+  server.start();
+  
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  getsockname(server.socket()->fd(), (struct sockaddr*) &addr, &len);
+  gnet::Host host((const struct sockaddr*) &addr, len);
+  
+  std::vector<gnet::TCPSocket*> sockets;
+  std::vector<gnet::TCPConnection*> conns;
+  
+  for (size_t i=0; i<connections; ++i) {
+    sockets.push_back(new gnet::TCPSocket(host));
+    sockets.back()->setOptions(options);
+    conns.push_back(sockets.back()->connect());
+  }
+  
+  std::vector<std::thread> threads;
+  bool *failed = new bool[connections];
+  
+  double t0 = Now();
+  
+  for (size_t i=0; i<connections; ++i) {
+    failed[i] = false;
+    threads.push_back(std::thread(Client, conns[i], requests, failed + i));
+  }
+  for (size_t i=0; i<threads.size(); ++i) {
+    threads[i].join();
+  }
+  
+  double elapsed = Now() - t0;
+  
+  bool ok = true;
+  for (size_t i=0; i<connections; ++i) {
+    ok = ok && !failed[i];
+  }
+  delete[] failed;
+  
+  for (size_t i=0; i<sockets.size(); ++i) {
+    delete sockets[i];
+  }
+  
+  server.stop();
+  
+  fprintf(stdout, "%3lu workers: %10.0f requests/s%s\n",
+          (unsigned long) workers, double(connections * requests) / elapsed,
+          ok ? "" : " (failed)");
+}
+
+int main(int argc, char **argv) {
+  
+  size_t maxWorkers = std::thread::hardware_concurrency();
+  size_t connections = 64;
+  size_t requests = 500;
+  int delay = 200;
+  
+  if (maxWorkers < 8) {
+    maxWorkers = 8;
+  }
+  
+  if (argc >= 2) {
+    maxWorkers = size_t(strtoul(argv[1], NULL, 10));
+  }
+  if (argc >= 3) {
+    connections = size_t(strtoul(argv[2], NULL, 10));
+  }
+  if (argc >= 4) {
+    requests = size_t(strtoul(argv[3], NULL, 10));
+  }
+  if (argc >= 5) {
+    delay = atoi(argv[4]);
+  }
+  
+  gnet::Initialize();
+  
+  fprintf(stdout, "%lu connections, %lu requests each, handler blocked %d us per request\n",
+          (unsigned long) connections, (unsigned long) requests, delay);
+  
+  try {
+    for (size_t workers=1; workers<=maxWorkers; workers*=2) {
+      Run(workers, connections, requests, delay);
+    }
+  
+  } catch (gnet::Exception &e) {
+    fprintf(stdout, "%s\n", e.what());
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
@@ -0,0 +1,237 @@
+#include <gnet/all.h>
+#include <vector>
+#include <cstdlib>
+#ifndef _WIN32
+# include <time.h>
+#endif
+
+// Compare the former strstr based read-until scanning with gnet::FindBytes
+// on multi-megabyte streams.
+//
+// scan:    one pass over the whole stream, delimiter after delimiter
+// chunked: stream delivered in recv sized chunks
+//          strstr: the old TCPConnection::read loop (malloc/realloc + copy per
+//                  message, search restarted at each chunk start)
+//          find:   incremental scan keeping a (delimiter length - 1) overlap
+
+static double Now() {
+#ifdef _WIN32
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter(&c);
+  QueryPerformanceFrequency(&f);
+  return double(c.QuadPart) / double(f.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return double(ts.tv_sec) + 1.0e-9 * double(ts.tv_nsec);
+#endif
+}
+
+static void MakeStream(std::vector<char> &stream, size_t total, size_t msgsize, const char *delim, size_t &count) {
+  size_t dlen = strlen(delim);
+  
+  stream.clear();
+  stream.reserve(total + msgsize + dlen + 1);
+  count = 0;
+  
+  srand(1);
+  
+  while (stream.size() < total) {
+    // message size varies between msgsize/2 and 3*msgsize/2
+    size_t n = msgsize / 2 + (msgsize > 1 ? size_t(rand()) % msgsize : 0);
+    for (size_t i=0; i<n; ++i) {
+      // printable bytes so that strstr sees the whole stream
+      stream.push_back(char('a' + rand() % 26));
+    }
+    stream.insert(stream.end(), delim, delim + dlen);
+    ++count;
+  }
+  
+  stream.push_back('\0');
+}
+
+static size_t ScanStrstr(const std::vector<char> &stream, const char *delim) {
+  size_t dlen = strlen(delim);
+  size_t found = 0;
+  const char *cur = &stream[0];
+  
+  while ((cur = strstr(cur, delim)) != NULL) {
+    cur += dlen;
+    ++found;
+  }
+  
+  return found;
+}
+
+static size_t ScanFind(const std::vector<char> &stream, const char *delim) {
+  size_t dlen = strlen(delim);
+  size_t found = 0;
+  size_t len = stream.size() - 1;
+  const char *data = &stream[0];
+  size_t off = 0;
+  
+  while (true) {
+    size_t pos = gnet::FindBytes(data + off, len - off, delim, dlen);
+    if (pos >= len - off) {
+      break;
+    }
+    off += pos + dlen;
+    ++found;
+  }
+  
+  return found;
+}
+
+static size_t ChunkedStrstr(const std::vector<char> &stream, const char *delim, size_t chunk) {
+  size_t dlen = strlen(delim);
+  size_t total = stream.size() - 1;
+  size_t found = 0;
+  size_t in = 0;
+  
+  std::vector<char> buffer(chunk + 1);
+  size_t bufferOffset = 0;
+  
+  while (in < total) {
+    
+    char *bytes = 0;
+    size_t len = 0;
+    size_t allocated = 0;
+    size_t searchOffset = 0;
+    
+    while (in < total) {
+      // 'recv'
+      size_t n = chunk - bufferOffset;
+      if (n > total - in) {
+        n = total - in;
+      }
+      memcpy(&buffer[bufferOffset], &stream[in], n);
+      in += n;
+      n += bufferOffset;
+      bufferOffset = 0;
+      
+      if (bytes == 0) {
+        len = n;
+        allocated = n;
+        bytes = (char*) malloc(allocated + 1);
+        memcpy(bytes, &buffer[0], n);
+        bytes[len] = '\0';
+        searchOffset = 0;
+      } else {
+        if ((len + n) >= allocated) {
+          while (allocated < (len + n)) {
+            allocated <<= 1;
+          }
+          bytes = (char*) realloc(bytes, allocated + 1);
+        }
+        memcpy(bytes + len, &buffer[0], n);
+        searchOffset = len;
+        len += n;
+        bytes[len] = '\0';
+      }
+      
+      char *f = strstr(bytes + searchOffset, delim);
+      if (f != NULL) {
+        size_t sublen = f + dlen - (bytes + searchOffset);
+        size_t rmnlen = n - sublen;
+        bufferOffset = rmnlen;
+        memmove(&buffer[0], &buffer[sublen], rmnlen);
+        ++found;
+        break;
+      }
+    }
+    
+    free(bytes);
+  }
+  
+  return found;
+}
+
+static size_t ChunkedFind(const std::vector<char> &stream, const char *delim, size_t chunk) {
+  size_t dlen = strlen(delim);
+  size_t total = stream.size() - 1;
+  size_t found = 0;
+  size_t in = 0;
+  
+  // data is received in place, views are handed out without copies
+  const char *data = &stream[0];
+  size_t head = 0;
+  size_t scanned = 0;
+  
+  while (head < total) {
+    size_t size = in - head;
+    
+    if (size >= dlen && size > scanned) {
+      size_t from = (scanned >= dlen - 1 ? scanned - (dlen - 1) : 0);
+      size_t pos = gnet::FindBytes(data + head + from, size - from, delim, dlen);
+      if (pos < size - from) {
+        head += from + pos + dlen;
+        scanned = 0;
+        ++found;
+        continue;
+      }
+      scanned = size;
+    }
+    
+    if (in >= total) {
+      break;
+    }
+    
+    // 'recv'
+    in += (chunk < total - in ? chunk : total - in);
+  }
+  
+  return found;
+}
+
+static void Report(const char *name, const char *delim, size_t msgsize, size_t bytes, size_t expected, size_t found, double elapsed) {
+  std::cout << name << " msgsize=" << msgsize
+            << " delim=" << strlen(delim) << "B"
+            << " found=" << found << "/" << expected
+            << " " << (double(bytes) / (1024.0 * 1024.0)) / elapsed << " MB/s"
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  
+  size_t megabytes = 64;
+  size_t chunk = 512;
+  
+  if (argc >= 2) {
+    megabytes = size_t(atoi(argv[1]));
+  }
+  if (argc >= 3) {
+    chunk = size_t(atoi(argv[2]));
+  }
+  
+  const char *delims[] = {"\n", "\r\n", "\r\n\r\n", "--boundary--"};
+  size_t msgsizes[] = {64, 1024, 16384};
+  
+  std::vector<char> stream;
+  
+  for (size_t d=0; d<sizeof(delims)/sizeof(delims[0]); ++d) {
+    for (size_t m=0; m<sizeof(msgsizes)/sizeof(msgsizes[0]); ++m) {
+      
+      size_t count = 0;
+      MakeStream(stream, megabytes * 1024 * 1024, msgsizes[m], delims[d], count);
+      size_t bytes = stream.size() - 1;
+      
+      double t0 = Now();
+      size_t found = ScanStrstr(stream, delims[d]);
+      Report("scan    strstr", delims[d], msgsizes[m], bytes, count, found, Now() - t0);
+      
+      t0 = Now();
+      found = ScanFind(stream, delims[d]);
+      Report("scan    find  ", delims[d], msgsizes[m], bytes, count, found, Now() - t0);
+      
+      t0 = Now();
+      found = ChunkedStrstr(stream, delims[d], chunk);
+      Report("chunked strstr", delims[d], msgsizes[m], bytes, count, found, Now() - t0);
+      
+      t0 = Now();
+      found = ChunkedFind(stream, delims[d], chunk);
+      Report("chunked find  ", delims[d], msgsizes[m], bytes, count, found, Now() - t0);
+    }
+  }
+  
+  return 0;
+}
@@ -0,0 +1,158 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#include <gnet/buffer.h>
+#include <cstdlib>
+
+namespace gnet {
+
+RingBuffer::RingBuffer(size_t capacity)
+  : mData(0), mCapacity(0), mHead(0), mSize(0) {
+  reserve(capacity);
+}
+
+RingBuffer::~RingBuffer() {
+  if (mData) {
+    free(mData);
+  }
+}
+
+const char* RingBuffer::front(size_t &len) const {
+  size_t tail = mCapacity - mHead;
+  len = (mSize < tail ? mSize : tail);
+  return mData + mHead;
+}
+
+const char* RingBuffer::linearize(size_t n) {
+  if (n > mSize) {
+    n = mSize;
+  }
+  
+  if (mHead + n <= mCapacity) {
+    return mData + mHead;
+  }
+  
+  // data wraps, rewind it to the beginning of a new storage
+  char *data = (char*) malloc(mCapacity);
+  copy(data, mSize);
+  free(mData);
+  mData = data;
+  mHead = 0;
+  
+  return mData;
+}
+
+void RingBuffer::copy(char *dst, size_t n) const {
+  size_t l0 = 0;
+  const char *p0 = front(l0);
+  
+  if (n <= l0) {
+    memcpy(dst, p0, n);
+  } else {
+    memcpy(dst, p0, l0);
+    memcpy(dst + l0, mData, n - l0);
+  }
+}
+
+void RingBuffer::consume(size_t n) {
+  if (n >= mSize) {
+    // rewind so that following reads stay contiguous
+    mHead = 0;
+    mSize = 0;
+  } else {
+    mHead = (mHead + n) % mCapacity;
+    mSize -= n;
+  }
+}
+
+int RingBuffer::writable(char *&p0, size_t &l0, char *&p1, size_t &l1) {
+  size_t tail = mHead + mSize;
+  
+  p1 = 0;
+  l1 = 0;
+  
+  if (tail >= mCapacity) {
+    p0 = mData + (tail - mCapacity);
+    l0 = mCapacity - mSize;
+  } else {
+    p0 = mData + tail;
+    l0 = mCapacity - tail;
+    if (mHead > 0) {
+      p1 = mData;
+      l1 = mHead;
+    }
+  }
+  
+  return (l0 > 0 ? 1 : 0) + (l1 > 0 ? 1 : 0);
+}
+
+void RingBuffer::commit(size_t n) {
+  if (n > mCapacity - mSize) {
+    n = mCapacity - mSize;
+  }
+  mSize += n;
+}
+
+void RingBuffer::append(const char *src, size_t n) {
+  if (n > mCapacity - mSize) {
+    reserve(mSize + n);
+  }
+  
+  char *p0, *p1;
+  size_t l0, l1;
+  
+  writable(p0, l0, p1, l1);
+  
+  if (n <= l0) {
+    memcpy(p0, src, n);
+  } else {
+    memcpy(p0, src, l0);
+    memcpy(p1, src + l0, n - l0);
+  }
+  
+  mSize += n;
+}
+
+void RingBuffer::reserve(size_t n) {
+  if (n <= mCapacity) {
+    return;
+  }
+  
+  char *data = (char*) malloc(n);
+  if (mSize > 0) {
+    copy(data, mSize);
+  }
+  if (mData) {
+    free(mData);
+  }
+  mData = data;
+  mCapacity = n;
+  mHead = 0;
+}
+
+void RingBuffer::clear() {
+  mHead = 0;
+  mSize = 0;
+}
+
+}
@@ -22,6 +22,12 @@ USA.
 */
 
 #include <gnet/config.h>
+#include "internal.h"
+#ifndef _WIN32
+# include <fcntl.h>
+# include <poll.h>
+# include <time.h>
+#endif
 
 namespace gnet {
 
@@ -55,9 +61,208 @@ void Initialize() {
 }
 
 void Uninitialize() {
+  ReleaseDefaultResolver();
 #ifdef _WIN32
   WSACleanup();
 #endif
 }
+
+// ---
+
+long long MonotonicTime() {
+#ifdef _WIN32
+  return (long long) GetTickCount64();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+#endif
+}
+
+long long MonotonicMicroseconds() {
+#ifdef _WIN32
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter(&c);
+  QueryPerformanceFrequency(&f);
+  return (long long)(c.QuadPart / f.QuadPart) * 1000000 + (long long)((c.QuadPart % f.QuadPart) * 1000000 / f.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((long long)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+#endif
+}
+
+long long Deadline(int timeout) {
+  return (timeout < 0 ? -1 : MonotonicTime() + timeout);
+}
+
+int Remaining(long long deadline) {
+  if (deadline < 0) {
+    return -1;
+  }
+  long long now = MonotonicTime();
+  return (now >= deadline ? 0 : int(deadline - now));
+}
+
+bool WaitFD(sock_t fd, bool write, int timeout) GNET_THROWS(Exception) {
+  
+  long long deadline = Deadline(timeout);
+  
+  while (true) {
+    
+#ifdef _WIN32
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    
+    struct timeval tv;
+    struct timeval *ptv = 0;
+    
+    if (timeout >= 0) {
+      tv.tv_sec = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+      ptv = &tv;
+    }
+    
+    int rv = ::select(0, (write ? 0 : &fds), (write ? &fds : 0), 0, ptv);
+#else
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = (write ? POLLOUT : POLLIN);
+    pfd.revents = 0;
+    
+    int rv = ::poll(&pfd, 1, timeout);
+#endif
+    
+    if (rv > 0) {
+      // errors and hang ups are reported by the following recv/send
+      return true;
+    }
+    
+    if (rv == 0) {
+      return false;
+    }
+    
+    if (!Interrupted()) {
+      throw Exception("WaitFD", "Could not wait for socket.", true);
+    }
+    
+    timeout = Remaining(deadline);
+  }
+}
+
+bool WaitFDs(const std::vector<sock_t> &fds, bool write, int timeout, std::vector<bool> &ready) GNET_THROWS(Exception) {
+  
+  long long deadline = Deadline(timeout);
+  
+  ready.assign(fds.size(), false);
+  
+  while (true) {
+    
+#ifdef _WIN32
+    fd_set iofds, efds;
+    FD_ZERO(&iofds);
+    FD_ZERO(&efds);
+    for (size_t i=0; i<fds.size(); ++i) {
+      FD_SET(fds[i], &iofds);
+      // failed connects are reported as exceptions
+      FD_SET(fds[i], &efds);
+    }
+    
+    struct timeval tv;
+    struct timeval *ptv = 0;
+    
+    if (timeout >= 0) {
+      tv.tv_sec = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+      ptv = &tv;
+    }
+    
+    int rv = ::select(0, (write ? 0 : &iofds), (write ? &iofds : 0), &efds, ptv);
+    
+    if (rv > 0) {
+      for (size_t i=0; i<fds.size(); ++i) {
+        ready[i] = (FD_ISSET(fds[i], &iofds) || FD_ISSET(fds[i], &efds));
+      }
+    }
+#else
+    std::vector<struct pollfd> pfds(fds.size());
+    for (size_t i=0; i<fds.size(); ++i) {
+      pfds[i].fd = fds[i];
+      pfds[i].events = (write ? POLLOUT : POLLIN);
+      pfds[i].revents = 0;
+    }
+    
+    int rv = ::poll((pfds.empty() ? 0 : &pfds[0]), (nfds_t) pfds.size(), timeout);
+    
+    if (rv > 0) {
+      for (size_t i=0; i<fds.size(); ++i) {
+        ready[i] = (pfds[i].revents != 0);
+      }
+    }
+#endif
+    
+    if (rv > 0) {
+      return true;
+    }
+    
+    if (rv == 0) {
+      return false;
+    }
+    
+    if (!Interrupted()) {
+      throw Exception("WaitFDs", "Could not wait for sockets.", true);
+    }
+    
+    timeout = Remaining(deadline);
+  }
+}
+
+bool SetBlocking(sock_t fd, bool blocking) {
+#ifdef _WIN32
+  u_long mode = (blocking ? 0 : 1);
+  return (ioctlsocket(fd, FIONBIO, &mode) == 0);
+#else
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1) {
+    return false;
+  }
+  flags = (blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+  return (fcntl(fd, F_SETFL, flags) == 0);
+#endif
+}
+
+void CloseFD(sock_t fd) {
+#ifdef _WIN32
+  closesocket(fd);
+#else
+  ::close(fd);
+#endif
+}
+
+bool WouldBlock() {
+#ifdef _WIN32
+  return (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+  return (errno == EAGAIN || errno == EWOULDBLOCK);
+#endif
+}
+
+bool Interrupted() {
+#ifdef _WIN32
+  return (WSAGetLastError() == WSAEINTR);
+#else
+  return (errno == EINTR);
+#endif
+}
+
+bool ConnectionLost() {
+#ifdef _WIN32
+  int err = WSAGetLastError();
+  return (err == WSAECONNRESET || err == WSAECONNABORTED || err == WSAESHUTDOWN);
+#else
+  return (errno == EPIPE || errno == ECONNRESET);
+#endif
+}
   
 }
@@ -23,66 +23,1170 @@ USA.
 
 #include <gnet/connection.h>
 #include <gnet/socket.h>
+#include <gnet/search.h>
+#include "internal.h"
 #include <exception>
 #include <cstring>
 #include <cstdlib>
-#include <ctime>
 #include <cerrno>
+#include <vector>
+#ifdef _WIN32
+# include <io.h>
+#else
+# include <sys/uio.h>
+# include <fcntl.h>
+# include <netinet/tcp.h>
+#endif
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
 
 namespace gnet {
+
+static const size_t NoFrame = size_t(-1);
+
+Framing::Framing(Header h, bool be, size_t ms)
+  : header(h), bigEndian(be), maxSize(ms) {
+}
+
+size_t Framing::encode(size_t len, char out[10]) const {
+  unsigned long long v = (unsigned long long) len;
+  
+  if (header == VarInt) {
+    size_t n = 0;
+    do {
+      unsigned char b = (unsigned char)(v & 0x7F);
+      v >>= 7;
+      out[n++] = (char)(v != 0 ? (b | 0x80) : b);
+    } while (v != 0);
+    return n;
+  }
+  
+  size_t n = size_t(header);
+  for (size_t i=0; i<n; ++i) {
+    unsigned char b = (unsigned char)((v >> (8 * i)) & 0xFF);
+    out[bigEndian ? n - 1 - i : i] = (char) b;
+  }
+  return n;
+}
+
+size_t Framing::decode(const char *in, size_t n, size_t &len) const GNET_THROWS(Exception) {
+  unsigned long long v = 0;
+  
+  if (header == VarInt) {
+    for (size_t i=0; i<n && i<10; ++i) {
+      unsigned char b = (unsigned char) in[i];
+      v |= (unsigned long long)(b & 0x7F) << (7 * i);
+      if ((b & 0x80) == 0) {
+        len = size_t(v);
+        return i + 1;
+      }
+    }
+    if (n >= 10) {
+      throw Exception("Framing", "Invalid varint header.");
+    }
+    return 0;
+  }
+  
+  size_t hlen = size_t(header);
+  if (n < hlen) {
+    return 0;
+  }
+  for (size_t i=0; i<hlen; ++i) {
+    unsigned char b = (unsigned char) in[bigEndian ? i : hlen - 1 - i];
+    v = (v << 8) | b;
+  }
+  if (v > (unsigned long long) size_t(-1)) {
+    throw Exception("Framing", "Frame length overflow.");
+  }
+  len = size_t(v);
+  return hlen;
+}
+
+// ---
+
+
+// Metrics hooks (see metrics.h)
+
+static inline void Received(ConnectionStats &stats, size_t n) {
+#if GNET_METRICS
+  ++stats.recvCalls;
+  stats.bytesIn += n;
+  Metrics::Add(Metrics::RecvCalls, 1);
+  Metrics::Add(Metrics::BytesIn, n);
+  Metrics::Record(Metrics::RecvSize, n);
+#else
+  (void) stats;
+  (void) n;
+#endif
+}
+
+static inline void Sent(ConnectionStats &stats, size_t n, bool partial) {
+#if GNET_METRICS
+  ++stats.sendCalls;
+  stats.bytesOut += n;
+  Metrics::Add(Metrics::SendCalls, 1);
+  Metrics::Add(Metrics::BytesOut, n);
+  Metrics::Record(Metrics::SendSize, n);
+  if (partial) {
+    ++stats.partialWrites;
+    Metrics::Add(Metrics::PartialWrites, 1);
+  }
+#else
+  (void) stats;
+  (void) n;
+  (void) partial;
+#endif
+}
+
+static inline void Blocked(ConnectionStats &stats) {
+#if GNET_METRICS
+  ++stats.wouldBlock;
+  Metrics::Add(Metrics::WouldBlock, 1);
+#else
+  (void) stats;
+#endif
+}
+
+// WaitFD, timed for the read and write wait metrics
+static bool WaitIO(sock_t fd, bool write, int timeout) GNET_THROWS(Exception) {
+#if GNET_METRICS
+  long long t0 = MonotonicMicroseconds();
+  bool rv = WaitFD(fd, write, timeout);
+  Metrics::Record(write ? Metrics::WriteWait : Metrics::ReadWait, (unsigned long long)(MonotonicMicroseconds() - t0));
+  return rv;
+#else
+  return WaitFD(fd, write, timeout);
+#endif
+}
+
+Connection::Connection()
+  : mFD(NULL_SOCKET), mBufferSize(0), mBlocking(true), mScanned(0), mFrameLength(NoFrame)
+  , mFed(false), mFedEnd(false) {
+  memset(&mStats, 0, sizeof(mStats));
+  setBufferSize(512);
+}
+
+Connection::Connection(sock_t fd)
+  : mFD(fd), mBufferSize(0), mBlocking(true), mScanned(0), mFrameLength(NoFrame)
+  , mFed(false), mFedEnd(false) {
+  memset(&mStats, 0, sizeof(mStats));
+  setBufferSize(512);
+}
+
+Connection::~Connection() {
+}
+
+bool Connection::isValid() const {
+  return (mFD != NULL_SOCKET);
+}
+
+bool Connection::isAlive() const {
+  if (!isValid() || mFedEnd) {
+    return false;
+  }
+  
+  try {
+    if (!WaitFD(mFD, false, 0)) {
+      // nothing to read, no hang up either
+      return true;
+    }
+  } catch (Exception &) {
+    return false;
+  }
+  
+  char c;
+  int n = recv(mFD, &c, 1, MSG_PEEK);
+  
+  if (n > 0) {
+    return true;
+  }
+  
+  // 0 when closed by peer, -1 on reset (or spurious wakeup)
+  return (n == -1 && WouldBlock());
+}
+
+void Connection::setBufferSize(unsigned long n) {
+  mInput.reserve(n);
+  mBufferSize = n;
+}
+
+bool Connection::receive(size_t &len, const char *until, int timeout) GNET_THROWS(Exception) {
+  
+  len = 0;
+  
+  if (mBufferSize == 0) {
+    setBufferSize(512);
+  }
+  
+  if (until == NULL || until[0] == '\0') {
+    if (mInput.empty()) {
+      if (mInput.available() < mBufferSize) {
+        mInput.reserve(mInput.size() + mBufferSize);
+      }
+      if (!fill(timeout)) {
+        return false;
+      }
+    }
+    len = mInput.size();
+    return true;
+  }
+
+#ifdef _DEBUG
+  std::cout << "gnet::Connection::receive: until \"" << until << "\"" << std::endl;
+#endif
+  
+  size_t ulen = strlen(until);
+  long long deadline = Deadline(timeout);
+  
+  if (mScanUntil != until) {
+    mScanUntil = until;
+    mScanned = 0;
+  }
+  
+  while (true) {
+    
+    size_t size = mInput.size();
+    
+    if (size >= ulen && size > mScanned) {
+      // a delimiter split across receives starts at most ulen-1 bytes before
+      // the end of what was already scanned
+      size_t from = (mScanned >= ulen - 1 ? mScanned - (ulen - 1) : 0);
+      const char *data = mInput.linearize(size);
+      size_t pos = FindBytes(data + from, size - from, until, ulen);
+      if (pos < size - from) {
+        len = from + pos + ulen;
+        mScanned = 0;
+        return true;
+      }
+      mScanned = size;
+      GNET_METRIC_ADD(UntilRescans, 1);
+    }
+
+#ifdef _DEBUG
+    std::cout << "gnet::Connection::receive: until not found, continue reading" << std::endl;
+#endif
+    
+    if (mInput.available() < mBufferSize) {
+      // message doesn't fit, grow receive buffer
+      mInput.reserve(2 * mInput.capacity() > mInput.size() + mBufferSize
+                     ? 2 * mInput.capacity()
+                     : mInput.size() + mBufferSize);
+    }
+    
+    if (!fill(Remaining(deadline))) {
+      return false;
+    }
+  }
+}
+
+bool Connection::read(char *&bytes, size_t &len, const char *until, int timeout) GNET_THROWS(Exception) {
+  bytes = 0;
+  
+  if (!receive(len, until, timeout)) {
+    return false;
+  }
+  
+  bytes = (char*) malloc(len+1);
+  mInput.copy(bytes, len);
+  bytes[len] = '\0';
+  consume(len);
+  
+  return true;
+}
+
+bool Connection::peek(const char *&bytes, size_t &len, const char *until, int timeout) GNET_THROWS(Exception) {
+  bytes = 0;
+  
+  if (!receive(len, until, timeout)) {
+    return false;
+  }
+  
+  bytes = mInput.linearize(len);
+  
+  return true;
+}
+
+void Connection::consume(size_t len) {
+  mInput.consume(len);
+  mScanned = (mScanned > len ? mScanned - len : 0);
+  if (mFrameLength != NoFrame) {
+    mFrameLength = (mFrameLength > len ? mFrameLength - len : NoFrame);
+  }
+}
+
+size_t Connection::fill(char *bytes, size_t len, bool, int timeout) GNET_THROWS(Exception) {
+  // generic version going through the receive buffer
+  if (mInput.empty() && !fill(timeout)) {
+    return 0;
+  }
+  size_t n = (mInput.size() < len ? mInput.size() : len);
+  mInput.copy(bytes, n);
+  mInput.consume(n);
+  return n;
+}
+
+void Connection::setFraming(const Framing &framing) {
+  mFraming = framing;
+}
+
+bool Connection::receiveFrameHeader(long long deadline) GNET_THROWS(Exception) {
+  
+  if (mFrameLength != NoFrame) {
+    return true;
+  }
+  
+  size_t len = 0;
+  size_t hlen = 0;
+  
+  while (true) {
+    if (!mInput.empty()) {
+      size_t n = (mInput.size() < 10 ? mInput.size() : 10);
+      hlen = mFraming.decode(mInput.linearize(n), n, len);
+      if (hlen > 0) {
+        break;
+      }
+    }
+    if (!fill(Remaining(deadline))) {
+      return false;
+    }
+  }
+  
+  if (len > mFraming.maxSize) {
+    throw Exception("Connection", "Frame exceeds maximum size.");
+  }
+  
+  consume(hlen);
+  
+  mFrameLength = len;
+  
+  return true;
+}
+
+bool Connection::readFrame(char *&bytes, size_t &len, int timeout) GNET_THROWS(Exception) {
+  bytes = 0;
+  len = 0;
+  
+  long long deadline = Deadline(timeout);
+  
+  if (!receiveFrameHeader(deadline)) {
+    return false;
+  }
+  
+  size_t size = mFrameLength;
+  char *data = (char*) malloc(size + 1);
+  
+  size_t got = (mInput.size() < size ? mInput.size() : size);
+  mInput.copy(data, got);
+  consume(got);
+  
+  while (got < size) {
+    
+    size_t n = fill(data + got, size - got, true, Remaining(deadline));
+    
+    if (n == 0) {
+      // keep what was received for the next call
+      mInput.append(data, got);
+      mFrameLength = size;
+      free(data);
+      return false;
+    }
+    
+    got += n;
+  }
+  
+  mFrameLength = NoFrame;
+  
+  data[size] = '\0';
+  bytes = data;
+  len = size;
+  
+  return true;
+}
+
+bool Connection::peekFrame(const char *&bytes, size_t &len, int timeout) GNET_THROWS(Exception) {
+  bytes = 0;
+  len = 0;
+  
+  long long deadline = Deadline(timeout);
+  
+  if (!receiveFrameHeader(deadline)) {
+    return false;
+  }
+  
+  if (mInput.capacity() < mFrameLength) {
+    mInput.reserve(mFrameLength);
+  }
+  
+  while (mInput.size() < mFrameLength) {
+    if (!fill(Remaining(deadline))) {
+      return false;
+    }
+  }
+  
+  bytes = mInput.linearize(mFrameLength);
+  len = mFrameLength;
+  
+  return true;
+}
+
+bool Connection::writeFrame(const char *bytes, size_t len, int timeout) GNET_THROWS(Exception) {
+  if (len > mFraming.maxSize) {
+    throw Exception("Connection", "Frame exceeds maximum size.");
+  }
+  
+  char header[10];
+  
+  IOVec vec[2];
+  vec[0].bytes = header;
+  vec[0].len = mFraming.encode(len, header);
+  vec[1].bytes = bytes;
+  vec[1].len = len;
+  
+  return writev(vec, 2, timeout);
+}
+
+size_t Connection::writeSome(const char *bytes, size_t len) GNET_THROWS(Exception) {
+  return (write(bytes, len, 0) ? len : 0);
+}
+
+bool Connection::writev(const IOVec *vec, size_t count, int timeout) GNET_THROWS(Exception) {
+  long long deadline = Deadline(timeout);
+  
+  for (size_t i=0; i<count; ++i) {
+    if (!write(vec[i].bytes, vec[i].len, Remaining(deadline))) {
+      // the unsent part of vec[i] was kept, keep the following buffers too
+      for (size_t j=i+1; j<count; ++j) {
+        write(vec[j].bytes, vec[j].len, 0);
+      }
+      return false;
+    }
+  }
+  
+  return true;
+}
+
+bool Connection::flush(int) GNET_THROWS(Exception) {
+  return true;
+}
+
+size_t Connection::unflushed() const {
+  return 0;
+}
+
+bool Connection::reads(std::string &s, const char *until, int timeout) GNET_THROWS(Exception) {
+  const char *bytes = 0;
+  size_t len = 0;
+  bool rv = peek(bytes, len, until, timeout);
+  if (rv) {
+    s.assign(bytes, len);
+    consume(len);
+  } else {
+    s = "";
+  }
+  return rv;
+}
+
+bool Connection::writes(const std::string &s, int timeout) GNET_THROWS(Exception) {
+  return this->write(s.c_str(), s.length(), timeout);
+}
+
+void Connection::setBlocking(bool blocking) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("Connection", "Invalid connection.");
+  }
+  if (blocking != mBlocking) {
+    if (!SetBlocking(mFD, blocking)) {
+      throw Exception("Connection", "Could not change blocking mode.", true);
+    }
+    mBlocking = blocking;
+  }
+}
+
+// ---
+
+StreamConnection::StreamConnection()
+  : mHighWaterMark(0) {
+}
+
+StreamConnection::StreamConnection(sock_t fd)
+  : Connection(fd), mHighWaterMark(0) {
+}
+
+StreamConnection::~StreamConnection() {
+}
+
+void StreamConnection::remotelyClosed() {
+  CloseFD(mFD);
+  mFD = NULL_SOCKET;
+}
+
+bool StreamConnection::fill(int timeout) GNET_THROWS(Exception) {
+  if (mInput.full()) {
+    mInput.reserve(mInput.capacity() + mBufferSize);
+  }
+  
+  char *p0, *p1;
+  size_t l0, l1;
+  
+  mInput.writable(p0, l0, p1, l1);
+  
+  size_t n = recvBytes(p0, l0, p1, l1, false, timeout);
+  
+  mInput.commit(n);
+  
+  return (n > 0);
+}
+
+size_t StreamConnection::fill(char *bytes, size_t len, bool waitAll, int timeout) GNET_THROWS(Exception) {
+  return recvBytes(bytes, len, 0, 0, waitAll, timeout);
+}
+
+size_t StreamConnection::recvBytes(char *p0, size_t l0, char *p1, size_t l1, bool waitAll, int timeout) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("StreamConnection", "Invalid connection.");
+  }
+  
+  if (mFed) {
+    // a Poller receives on our behalf, bytes show up in mInput
+    if (mFedEnd) {
+      remotelyClosed();
+      throw Exception("StreamConnection", "Connection was remotely closed.");
+    }
+    return 0;
+  }
+  
+  long long deadline = Deadline(timeout);
+  
+  int flags = 0;
+  
+  // MSG_WAITALL would block past the deadline
+  if (waitAll && timeout < 0 && mBlocking) {
+    flags = MSG_WAITALL;
+  }
+  
+  while (true) {
+    
+    // a blocking recv would not honor the timeout, wait for data first
+    if (timeout >= 0 && mBlocking) {
+      if (!WaitIO(mFD, false, Remaining(deadline))) {
+        return 0;
+      }
+    }
+    
+    int n;
+
+#ifndef _WIN32
+    if (l1 > 0) {
+      // free space wraps around, fill both parts at once
+      struct iovec iov[2];
+      iov[0].iov_base = p0;
+      iov[0].iov_len = l0;
+      iov[1].iov_base = p1;
+      iov[1].iov_len = l1;
+      n = int(::readv(mFD, iov, 2));
+    } else {
+      n = recv(mFD, p0, l0, flags);
+    }
+#else
+    n = recv(mFD, p0, int(l0), flags);
+#endif
+    
+    if (n == -1) {
+      if (Interrupted()) {
+        continue;
+      }
+      if (WouldBlock()) {
+        Blocked(mStats);
+        if (!WaitIO(mFD, false, Remaining(deadline))) {
+          return 0;
+        }
+        continue;
+      }
+      throw Exception("StreamConnection", "Could not read from socket.", true);
+    }
+    
+    if (n == 0) {
+      // Connection closed
+      remotelyClosed();
+      throw Exception("StreamConnection", "Connection was remotely closed.");
+    }
+
+#ifdef _DEBUG
+    std::cout << "gnet::StreamConnection::recvBytes: received " << n << " bytes" << std::endl;
+#endif
+    
+    Received(mStats, size_t(n));
+    
+    return size_t(n);
+  }
+}
+
+bool StreamConnection::sendFailed(long long deadline) GNET_THROWS(Exception) {
+  if (Interrupted()) {
+    return true;
+  }
+  if (WouldBlock()) {
+    Blocked(mStats);
+    return WaitIO(mFD, true, Remaining(deadline));
+  }
+  if (ConnectionLost()) {
+    remotelyClosed();
+    throw Exception("StreamConnection", "Connection was remotely closed.");
+  }
+  throw Exception("StreamConnection", "Could not write to socket.", true);
+}
+
+size_t StreamConnection::sendBytes(const char *bytes, size_t len, long long deadline) GNET_THROWS(Exception) {
+  size_t offset = 0;
+  size_t remaining = len;
+  
+  int flags = 0;
+#ifdef MSG_NOSIGNAL
+  // report EPIPE rather than raising SIGPIPE
+  flags = MSG_NOSIGNAL;
+#endif
+#ifdef MSG_DONTWAIT
+  // a blocking send of a large buffer would not honor the deadline
+  if (deadline >= 0) {
+    flags |= MSG_DONTWAIT;
+  }
+#endif
+  
+  while (remaining > 0) {
+    
+    if (deadline >= 0 && mBlocking) {
+      if (!WaitIO(mFD, true, Remaining(deadline))) {
+        break;
+      }
+    }
+    
+    int n = send(mFD, bytes+offset, remaining, flags);
+    
+    if (n == -1) {
+      if (!sendFailed(deadline)) {
+        break;
+      }
+    
+    } else {
+      Sent(mStats, size_t(n), size_t(n) < remaining);
+      remaining -= n;
+      offset += n;
+#ifdef _DEBUG
+      if (remaining > 0) {
+        std::cout << "gnet::StreamConnection::write: " << remaining << " bytes of " << len << " remains to send..." << std::endl;
+      }
+#endif
+    }
+  }
+  
+  return offset;
+}
+
+bool StreamConnection::write(const char *bytes, size_t len, int timeout) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("StreamConnection", "Invalid connection.");
+  }
+  
+  if (len == 0) {
+    return true;
+  }
+  
+  if (mHighWaterMark > 0 || !mOutput.empty()) {
+    IOVec vec = {bytes, len};
+    return sendBuffered(&vec, 1, Deadline(timeout));
+  }
+  
+  size_t sent = sendBytes(bytes, len, Deadline(timeout));
+  
+  if (sent < len) {
+    // keep the rest for the next write or flush, the stream stays consistent
+    mOutput.append(bytes + sent, len - sent);
+    return false;
+  }
+  
+  return true;
+}
+
+size_t StreamConnection::writeSome(const char *bytes, size_t len) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("StreamConnection", "Invalid connection.");
+  }
+  
+  long long now = Deadline(0);
+  
+  if (!mOutput.empty() && !sendBuffered(0, 0, now)) {
+    return 0;
+  }
+  
+  return sendBytes(bytes, len, now);
+}
+
+bool StreamConnection::writev(const IOVec *vec, size_t count, int timeout) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("StreamConnection", "Invalid connection.");
+  }
+  
+  if (mHighWaterMark > 0 || !mOutput.empty()) {
+    return sendBuffered(vec, count, Deadline(timeout));
+  }
+  
+  size_t sent = sendVector(vec, count, 0, Deadline(timeout));
+  bool complete = true;
+  
+  // keep the rest for the next write or flush, the stream stays consistent
+  for (size_t i=0; i<count; ++i) {
+    if (sent >= vec[i].len) {
+      sent -= vec[i].len;
+    } else {
+      mOutput.append(vec[i].bytes + sent, vec[i].len - sent);
+      sent = 0;
+      complete = false;
+    }
+  }
+  
+  return complete;
+}
+
+size_t StreamConnection::sendVector(const IOVec *vec, size_t count, int flags, long long deadline) GNET_THROWS(Exception) {
+  
+  // buffers sent per system call
+  static const size_t MaxBuffers = 64;
+
+#ifdef _WIN32
+  WSABUF iov[MaxBuffers];
+#else
+  struct iovec iov[MaxBuffers];
+
+# ifdef MSG_NOSIGNAL
+  flags |= MSG_NOSIGNAL;
+# endif
+# ifdef MSG_DONTWAIT
+  if (deadline >= 0) {
+    flags |= MSG_DONTWAIT;
+  }
+# endif
+#endif
+  
+  // current buffer and offset in it
+  size_t cur = 0;
+  size_t offset = 0;
+  size_t total = 0;
+  
+  while (true) {
+    
+    // skip empty or completed buffers
+    while (cur < count && offset >= vec[cur].len) {
+      ++cur;
+      offset = 0;
+    }
+    
+    if (cur >= count) {
+      return total;
+    }
+    
+    size_t n = 0;
+    size_t batch = 0;
+    
+    for (size_t i=cur; i<count && n<MaxBuffers; ++i) {
+      const char *bytes = vec[i].bytes;
+      size_t len = vec[i].len;
+      if (i == cur) {
+        bytes += offset;
+        len -= offset;
+      }
+      if (len == 0) {
+        continue;
+      }
+#ifdef _WIN32
+      iov[n].buf = (char*) bytes;
+      iov[n].len = (u_long) len;
+#else
+      iov[n].iov_base = (void*) bytes;
+      iov[n].iov_len = len;
+#endif
+      batch += len;
+      ++n;
+    }
+    
+    if (deadline >= 0 && mBlocking) {
+      if (!WaitIO(mFD, true, Remaining(deadline))) {
+        return total;
+      }
+    }
+
+#ifdef _WIN32
+    DWORD sent = 0;
+    long rv = (WSASend(mFD, iov, (DWORD) n, &sent, (DWORD) flags, NULL, NULL) == 0 ? long(sent) : -1);
+#else
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+    
+    long rv = long(::sendmsg(mFD, &msg, flags));
+#endif
+    
+    if (rv == -1) {
+      if (!sendFailed(deadline)) {
+        return total;
+      }
+      continue;
+    }
+    
+    // advance through the vector
+    size_t sent = size_t(rv);
+    
+    Sent(mStats, sent, sent < batch);
+    
+    total += sent;
+    
+    while (sent > 0 && cur < count) {
+      size_t left = vec[cur].len - offset;
+      if (sent < left) {
+        offset += sent;
+        sent = 0;
+      } else {
+        sent -= left;
+        ++cur;
+        offset = 0;
+      }
+    }
+  }
+}
+
+bool StreamConnection::sendBuffered(const IOVec *vec, size_t count, long long deadline, int flags) GNET_THROWS(Exception) {
+  
+  size_t total = 0;
+  
+  for (size_t i=0; i<count; ++i) {
+    total += vec[i].len;
+  }
+  
+  if (count > 0 && mOutput.size() + total < mHighWaterMark) {
+    for (size_t i=0; i<count; ++i) {
+      mOutput.append(vec[i].bytes, vec[i].len);
+    }
+    return true;
+  }
+  
+  // buffers sent along with the buffered bytes
+  static const size_t MaxBuffers = 16;
+  
+  if (count >= MaxBuffers) {
+    // too many pieces, gather them
+    for (size_t i=0; i<count; ++i) {
+      mOutput.append(vec[i].bytes, vec[i].len);
+    }
+    count = 0;
+  }
+  
+  // buffered bytes go out with the new ones in a single call
+  IOVec all[MaxBuffers];
+  size_t n = 0;
+  size_t buffered = mOutput.size();
+  
+  if (buffered > 0) {
+    all[n].bytes = mOutput.linearize(buffered);
+    all[n].len = buffered;
+    ++n;
+  }
+  
+  for (size_t i=0; i<count; ++i) {
+    all[n++] = vec[i];
+  }
+  
+  size_t sent = sendVector(all, n, flags, deadline);
+  
+  size_t fromBuffer = (sent < buffered ? sent : buffered);
+  mOutput.consume(fromBuffer);
+  sent -= fromBuffer;
+  
+  // keep what could not be sent, in order, for the next flush
+  for (size_t i=0; i<count; ++i) {
+    if (sent >= vec[i].len) {
+      sent -= vec[i].len;
+    } else {
+      mOutput.append(vec[i].bytes + sent, vec[i].len - sent);
+      sent = 0;
+    }
+  }
+  
+  return mOutput.empty();
+}
+
+bool StreamConnection::flush(int timeout) GNET_THROWS(Exception) {
+  if (mOutput.empty()) {
+    return true;
+  }
+  if (!isValid()) {
+    throw Exception("StreamConnection", "Invalid connection.");
+  }
+  return sendBuffered(0, 0, Deadline(timeout));
+}
+
+size_t StreamConnection::unflushed() const {
+  return mOutput.size();
+}
+
+void StreamConnection::setOutputBuffer(size_t highWaterMark) GNET_THROWS(Exception) {
+  mHighWaterMark = highWaterMark;
+  if (highWaterMark == 0) {
+    flush();
+  }
+}
+
+bool StreamConnection::sendFile(int fd, long long &offset, long long &length, int timeout) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("StreamConnection", "Invalid connection.");
+  }
+  
+  long long deadline = Deadline(timeout);
+  bool timedOut = false;
+
+#ifdef MSG_MORE
+  // buffered headers share segments with the start of the file
+  if (!mOutput.empty() && !sendBuffered(0, 0, deadline, MSG_MORE)) {
+    return false;
+  }
+#else
+  if (!mOutput.empty() && !sendBuffered(0, 0, deadline)) {
+    return false;
+  }
+#endif
+  
+  if (length <= 0) {
+    return true;
+  }
+  
+  // sendfile and splice have no per call non-blocking flag
+  bool toggle = (timeout >= 0 && mBlocking);
+  
+  if (toggle) {
+    SetBlocking(mFD, false);
+  }
+  
+  try {
+    if (!sendFileKernel(fd, offset, length, deadline, timedOut) &&
+        !spliceFile(fd, offset, length, deadline, timedOut)) {
+      copyFile(fd, offset, length, deadline, timedOut);
+    }
+  } catch (Exception &) {
+    if (toggle && isValid()) {
+      SetBlocking(mFD, true);
+    }
+    throw;
+  }
+  
+  if (toggle) {
+    SetBlocking(mFD, true);
+  }
+  
+  return !timedOut;
+}
+
+bool StreamConnection::sendFileKernel(int fd, long long &offset, long long &length, long long deadline, bool &timedOut) GNET_THROWS(Exception) {
+#ifdef __linux__
+  // maximum transfered by a single sendfile call
+  static const long long MaxChunk = 0x7ffff000;
+  
+  while (length > 0) {
+    
+    if (deadline >= 0 && mBlocking) {
+      if (!WaitIO(mFD, true, Remaining(deadline))) {
+        timedOut = true;
+        return true;
+      }
+    }
+    
+    off_t off = (off_t) offset;
+    size_t count = size_t(length < MaxChunk ? length : MaxChunk);
+    
+    ssize_t n = ::sendfile(mFD, fd, &off, count);
+    
+    if (n == -1) {
+      if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == ESPIPE) {
+        // fd doesn't support mmap like operations (pipe, socket...)
+        return false;
+      }
+      if (!sendFailed(deadline)) {
+        timedOut = true;
+        return true;
+      }
+      continue;
+    }
+    
+    if (n == 0) {
+      throw Exception("StreamConnection", "Unexpected end of file.");
+    }
+    
+    Sent(mStats, size_t(n), size_t(n) < count);
+    
+    offset += n;
+    length -= n;
+  }
   
-
-Connection::Connection()
-  : mBufferSize(0), mBuffer(0), mBufferOffset(0) {
-  setBufferSize(512);
-}
-
-Connection::Connection(sock_t fd)
-  : mFD(fd), mBufferSize(0), mBuffer(0) {
-  setBufferSize(512);
+  return true;
+#else
+  (void) fd;
+  (void) offset;
+  (void) length;
+  (void) deadline;
+  (void) timedOut;
+  return false;
+#endif
 }
 
-Connection::~Connection() {
-  if (mBuffer) {
-    delete[] mBuffer;
-    mBuffer = 0;
-    mBufferSize = 0;
-    mBufferOffset = 0;
+bool StreamConnection::spliceFile(int fd, long long &offset, long long &length, long long deadline, bool &timedOut) GNET_THROWS(Exception) {
+#ifdef __linux__
+  // bytes moved through the pipe at once
+  static const long long MaxChunk = 65536;
+  
+  int fds[2];
+  
+  if (::pipe2(fds, O_CLOEXEC) == -1) {
+    return false;
   }
-}
   
-bool Connection::isValid() const {
-  return (mFD != NULL_SOCKET);
-}
+  // input is read at explicit offsets unless it is a pipe itself
+  bool seekable = (lseek(fd, 0, SEEK_CUR) != -1);
   
-void Connection::setBufferSize(unsigned long n) {
-  if (n > mBufferSize) {
-    if (mBuffer) {
-      delete[] mBuffer;
-      mBuffer = 0;
+  while (length > 0) {
+    
+    loff_t off = (loff_t) offset;
+    size_t count = size_t(length < MaxChunk ? length : MaxChunk);
+    
+    ssize_t n = ::splice(fd, (seekable ? &off : NULL), fds[1], NULL, count, SPLICE_F_MOVE | SPLICE_F_MORE);
+    
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int err = errno;
+      ::close(fds[0]);
+      ::close(fds[1]);
+      if (err == EINVAL || err == ENOSYS) {
+        return false;
+      }
+      errno = err;
+      throw Exception("StreamConnection", "Could not read from file.", true);
+    }
+    
+    if (n == 0) {
+      ::close(fds[0]);
+      ::close(fds[1]);
+      throw Exception("StreamConnection", "Unexpected end of file.");
+    }
+    
+    ssize_t inPipe = n;
+    
+    while (inPipe > 0) {
+      
+      if (deadline >= 0 && mBlocking && !WaitIO(mFD, true, Remaining(deadline))) {
+        timedOut = true;
+        break;
+      }
+      
+      ssize_t m = ::splice(fds[0], NULL, mFD, NULL, size_t(inPipe), SPLICE_F_MOVE | SPLICE_F_MORE);
+      
+      if (m == -1) {
+        bool retry = false;
+        try {
+          retry = sendFailed(deadline);
+        } catch (Exception &) {
+          ::close(fds[0]);
+          ::close(fds[1]);
+          throw;
+        }
+        if (!retry) {
+          timedOut = true;
+          break;
+        }
+        continue;
+      }
+      
+      Sent(mStats, size_t(m), m < inPipe);
+      
+      inPipe -= m;
+      offset += m;
+      length -= m;
+    }
+    
+    if (timedOut) {
+      // bytes left in the pipe are dropped, they will be read again from offset
+      // (not possible when reading from a pipe)
+      break;
     }
-    mBuffer = new char[n];
-    memset(mBuffer, 0, n*sizeof(char));
-    mBufferOffset = 0;
   }
-  mBufferSize = n;
+  
+  ::close(fds[0]);
+  ::close(fds[1]);
+  
+  return true;
+#else
+  (void) fd;
+  (void) offset;
+  (void) length;
+  (void) deadline;
+  (void) timedOut;
+  return false;
+#endif
 }
 
-bool Connection::reads(std::string &s, const char *until, int timeout) throw(Exception) {
-  char *bytes = 0;
-  size_t len = 0;
-  bool rv = this->read(bytes, len, until, timeout);
-  if (bytes != 0) {
-    s = bytes;
-    free(bytes);
-  } else {
-    s = "";
-  }
-  return rv;
-}
+bool StreamConnection::copyFile(int fd, long long &offset, long long &length, long long deadline, bool &timedOut) GNET_THROWS(Exception) {
+  static const size_t ChunkSize = 65536;
+  
+  char *buffer = (char*) malloc(ChunkSize);
+  
+  while (length > 0) {
+    
+    size_t count = size_t(length < (long long)ChunkSize ? length : (long long)ChunkSize);
 
-void Connection::writes(const std::string &s) throw(Exception) {
-   this->write(s.c_str(), s.length());
+#ifdef _WIN32
+    long n = -1;
+    if (_lseeki64(fd, offset, SEEK_SET) != -1) {
+      n = _read(fd, buffer, (unsigned int) count);
+    }
+#else
+    ssize_t n = ::pread(fd, buffer, count, (off_t) offset);
+    if (n == -1 && errno == ESPIPE) {
+      n = ::read(fd, buffer, count);
+    }
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+#endif
+    
+    if (n <= 0) {
+      free(buffer);
+      if (n == 0) {
+        throw Exception("StreamConnection", "Unexpected end of file.");
+      }
+      throw Exception("StreamConnection", "Could not read from file.", true);
+    }
+    
+    // for pipes, bytes read but not sent when the deadline expires are lost
+    size_t sent;
+    
+    try {
+      sent = sendBytes(buffer, size_t(n), deadline);
+    } catch (Exception &) {
+      free(buffer);
+      throw;
+    }
+    
+    offset += sent;
+    length -= sent;
+    
+    if (sent < size_t(n)) {
+      timedOut = true;
+      break;
+    }
+  }
+  
+  free(buffer);
+  
+  return true;
 }
 
 // ---
@@ -92,207 +1196,439 @@ TCPConnection::TCPConnection()
 }
 
 TCPConnection::TCPConnection(TCPSocket *socket, sock_t fd, const Host &host)
-  : Connection(fd), mHost(host), mSocket(socket) {
+  : StreamConnection(fd), mHost(host), mSocket(socket) {
+#if GNET_METRICS
+  mStats.opened = MonotonicMicroseconds();
+  Metrics::Add(Metrics::ConnectionsOpened, 1);
+#endif
 }
 
 TCPConnection::~TCPConnection() {
+#if GNET_METRICS
+  if (mStats.opened != 0) {
+    Metrics::Add(Metrics::ConnectionsClosed, 1);
+    Metrics::Record(Metrics::ConnectionLifetime, (unsigned long long)(MonotonicMicroseconds() - mStats.opened));
+  }
+#endif
+  // not tracked by any socket, nobody else will close it
+  if (!mSocket && mFD != NULL_SOCKET) {
+    CloseFD(mFD);
+  }
 }
 
-bool TCPConnection::read(char *&bytes, size_t &len, const char *until, int timeout) throw(Exception) {
+void TCPConnection::setCork(bool on) GNET_THROWS(Exception) {
   if (!isValid()) {
-    throw Exception("TCPConnection", "Invalid connections.");
+    throw Exception("TCPConnection", "Invalid connection.");
   }
   
-  if (mBufferSize == 0) {
-    setBufferSize(512);
+  if (!on) {
+    // buffered bytes must be in the socket before it is uncorked
+    flush();
   }
   
-  int n = 0;
-  size_t allocated = 0;
-  bool full = false;
-  size_t searchOffset = 0;
+  int val = (on ? 1 : 0);
+
+#if defined(TCP_CORK)
+  if (::setsockopt(mFD, IPPROTO_TCP, TCP_CORK, (const char*)&val, sizeof(val)) != 0) {
+    throw Exception("TCPConnection", "Could not set TCP_CORK.", true);
+  }
+#elif defined(TCP_NOPUSH)
+  if (::setsockopt(mFD, IPPROTO_TCP, TCP_NOPUSH, (const char*)&val, sizeof(val)) != 0) {
+    throw Exception("TCPConnection", "Could not set TCP_NOPUSH.", true);
+  }
+#else
+  if (on) {
+    throw Exception("TCPConnection", "TCP_CORK not supported.");
+  }
+#endif
+}
+
+void TCPConnection::remotelyClosed() {
+  if (mSocket && mSocket->fd() == mFD) {
+    mSocket->invalidate();
+  }
+  StreamConnection::remotelyClosed();
+}
+
+// ---
+
+#ifndef _WIN32
+
+UnixConnection::UnixConnection()
+  : mSocket(0) {
+}
+
+UnixConnection::UnixConnection(UnixSocket *socket, sock_t fd, const std::string &path)
+  : StreamConnection(fd), mPath(path), mSocket(socket) {
+}
+
+UnixConnection::~UnixConnection() {
+}
+
+void UnixConnection::remotelyClosed() {
+  if (mSocket && mSocket->fd() == mFD) {
+    mSocket->invalidate();
+  }
+  StreamConnection::remotelyClosed();
+}
+
+bool UnixConnection::sendWithFD(int fd, const char *data, size_t len, int timeout) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("UnixConnection", "Invalid connection.");
+  }
   
-  bytes = 0;
-  len = 0;
+  long long deadline = Deadline(timeout);
   
-#ifdef _DEBUG
-  std::cout << "gnet::TCPConnection::read: until \"" << (until ? until : "") << "\"" << std::endl;
+  int flags = 0;
+#ifdef MSG_NOSIGNAL
+  flags = MSG_NOSIGNAL;
 #endif
+  if (deadline >= 0) {
+    flags |= MSG_DONTWAIT;
+  }
   
-  if (until != NULL && mBufferOffset > 0)
-  {
-    size_t ulen = strlen(until);
-    char *found = strstr(mBuffer, until);
-    if (found != NULL)
-    {
-#ifdef _DEBUG
-      std::cout << "gnet::TCPConnection::read: until found in remaining buffer" << std::endl;
-#endif
-      size_t sublen = found + ulen - mBuffer;
-      size_t rmnlen = mBufferOffset - sublen;
-      bytes = (char*) malloc(sublen+1);
-      len = sublen;
-      memcpy(bytes, mBuffer, sublen);
-      bytes[sublen] = '\0';
-      mBufferOffset = (unsigned long)rmnlen;
-      for (size_t i=0; i<rmnlen; ++i) {
-        mBuffer[i] = mBuffer[sublen+i];
-      }
-      mBuffer[rmnlen] = '\0';
-#ifdef _DEBUG
-      std::cout << "gnet::TCPConnection::read: \"" << mBuffer << "\" remains in buffer" << std::endl;
-#endif
-      return true;
+  union {
+    struct cmsghdr align;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  
+  memset(&control, 0, sizeof(control));
+  
+  struct iovec iov;
+  iov.iov_base = (void*) data;
+  iov.iov_len = len;
+  
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
+  
+  struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(c), &fd, sizeof(int));
+  
+  while (true) {
+    
+    if (deadline >= 0 && mBlocking) {
+      if (!WaitFD(mFD, true, Remaining(deadline))) {
+        return false;
+      }
+    }
+    
+    ssize_t n = ::sendmsg(mFD, &msg, flags);
+    
+    if (n == -1) {
+      if (!sendFailed(deadline)) {
+        return false;
+      }
+      continue;
     }
+    
+    // the descriptor went with the first byte, send the rest as usual
+    return (size_t(n) == len || sendBytes(data + n, len - n, deadline) == len - n);
   }
+}
+
+bool UnixConnection::receiveWithFD(int &fd, char *data, size_t len, int timeout) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("UnixConnection", "Invalid connection.");
+  }
+  
+  // buffered bytes would be out of order, their descriptor already lost
+  if (mInput.size() > 0) {
+    throw Exception("UnixConnection", "Input buffer not empty.");
+  }
+  
+  long long deadline = Deadline(timeout);
+  
+  int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+  flags = MSG_CMSG_CLOEXEC;
+#endif
+  
+  union {
+    struct cmsghdr align;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
   
-  time_t st, et;
+  struct iovec iov;
+  iov.iov_base = data;
+  iov.iov_len = len;
   
-  st = time(NULL);
+  struct msghdr msg;
   
-  do {
+  fd = -1;
+  
+  while (true) {
     
-    if (timeout > 0) {
-      et = time(NULL);
-      if ((et - st) >= time_t(timeout)) {
-        // return current state
+    if (timeout >= 0 && mBlocking) {
+      if (!WaitFD(mFD, false, Remaining(deadline))) {
         return false;
       }
     }
     
-    // flags? will this be blocking? then what about our timeout?
-    // => might need to set options on the socket itself for non-blocking read
-    n = recv(mFD, mBuffer+mBufferOffset, mBufferSize-mBufferOffset, 0);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    
+    ssize_t n = ::recvmsg(mFD, &msg, flags);
     
     if (n == -1) {
-      // Should notify socket ?
-      if (timeout > 0 && errno == EAGAIN) {
+      if (Interrupted()) {
         continue;
       }
-      if (bytes) {
-         free(bytes);
-         bytes = 0;
-         len = 0;
+      if (WouldBlock()) {
+        if (!WaitFD(mFD, false, Remaining(deadline))) {
+          return false;
+        }
+        continue;
       }
-      throw Exception("TCPConnection", "Could not read from socket.", true);
+      throw Exception("UnixConnection", "Could not read from socket.", true);
     }
     
     if (n == 0) {
-      // Connection closed
-      if (mSocket->fd() == mFD) {
-        mSocket->invalidate();
-      }
-      mFD = NULL_SOCKET;
-      if (bytes) {
-         free(bytes);
-         bytes = 0;
-         len = 0;
-      }
-      throw Exception("TCPConnection", "Connection was remotely closed.");
+      remotelyClosed();
+      throw Exception("UnixConnection", "Connection was remotely closed.");
     }
     
-    full = (n == int(mBufferSize - mBufferOffset));
-    mBufferOffset = 0;
+    for (struct cmsghdr *c=CMSG_FIRSTHDR(&msg); c!=NULL; c=CMSG_NXTHDR(&msg, c)) {
+      if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(c), sizeof(int));
+      }
+    }
     
-#ifdef _DEBUG
-    std::cout << "gnet::TCPConnection::read: received " << n << " characters" << std::endl;
+    if (fd == -1) {
+      throw Exception("UnixConnection", "No descriptor received.");
+    }
+
+#ifndef MSG_CMSG_CLOEXEC
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
 #endif
     
-    if (bytes == 0) {
-      len = n;
-      allocated = n;
-      bytes = (char*) malloc(allocated+1);
-      memcpy(bytes, mBuffer, n);
-      bytes[len] = '\0';
-      searchOffset = 0;
-      
-    } else {
-      if ((len + n) >= allocated) {
-        while (allocated < (len + n)) {
-          allocated <<= 1;
-        }
-        bytes = (char*) realloc(bytes, allocated+1);
+    size_t got = size_t(n);
+    
+    // rest of the message, sent right after the first byte
+    while (got < len) {
+      size_t r = recvBytes(data + got, len - got, 0, 0, true, Remaining(deadline));
+      if (r == 0) {
+        // can't leave the stream mid message
+        ::close(fd);
+        fd = -1;
+        throw Exception("UnixConnection", "Incomplete descriptor message.");
       }
-      memcpy(bytes+len, mBuffer, n);
-      searchOffset = len;
-      len += n;
-      bytes[len] = '\0';
+      got += r;
     }
     
-#ifdef _DEBUG
-    std::cout << "gnet::TCPConnection::read: \"" << (bytes+len-n) << "\"" << std::endl;
-#endif
-        
-    if (until != NULL) {
-      size_t ulen = strlen(until);
-      char *found = strstr(bytes+searchOffset, until);
-      if (found != NULL) {
-        size_t sublen = found + ulen - (bytes + searchOffset);
-        size_t rmnlen = n - sublen;
-        found[ulen] = '\0';
-        len -= rmnlen;
-        // keep remaining bits in buffer
-        mBufferOffset = (unsigned long)rmnlen;
-        for (size_t i=0; i<rmnlen; ++i) {
-          mBuffer[i] = mBuffer[sublen+i];
-        }
-        mBuffer[rmnlen] = '\0';
-#ifdef _DEBUG
-        std::cout << "gnet::TCPConnection::read: \"" << mBuffer << "\" remains in buffer" << std::endl;
+    return true;
+  }
+}
+
+bool UnixConnection::sendFD(int fd, int timeout) GNET_THROWS(Exception) {
+  char tag = 0;
+  return sendWithFD(fd, &tag, 1, timeout);
+}
+
+bool UnixConnection::receiveFD(int &fd, int timeout) GNET_THROWS(Exception) {
+  char tag = 0;
+  return receiveWithFD(fd, &tag, 1, timeout);
+}
+
+bool UnixConnection::sendConnection(TCPConnection *conn, int timeout) GNET_THROWS(Exception) {
+  if (!conn || !conn->isValid()) {
+    throw Exception("UnixConnection", "Invalid connection to send.");
+  }
+  
+  // peer address travels as the message body
+  struct sockaddr_storage addr;
+  memset(&addr, 0, sizeof(addr));
+  memcpy(&addr, (const struct sockaddr*) conn->host(), conn->host().length());
+  
+  return sendWithFD(conn->fd(), (const char*) &addr, sizeof(addr), timeout);
+}
+
+TCPConnection* UnixConnection::receiveConnection(int timeout) GNET_THROWS(Exception) {
+  struct sockaddr_storage addr;
+  int fd = -1;
+  
+  if (!receiveWithFD(fd, (char*) &addr, sizeof(addr), timeout)) {
+    return NULL;
+  }
+  
+  Host host;
+  
+  try {
+    host = Host((const struct sockaddr*) &addr, sizeof(addr));
+  } catch (Exception &) {
+    // unknown peer address, the connection itself is still usable
+  }
+  
+  TCPConnection *conn = new TCPConnection(0, fd, host);
+  // blocking mode is shared with the sending process
+  conn->mBlocking = ((fcntl(fd, F_GETFL) & O_NONBLOCK) == 0);
+  
+  return conn;
+}
+
 #endif
-        return true;
-      } else {
-#ifdef _DEBUG
-        std::cout << "gnet::TCPConnection::read: until not found, continue reading" << std::endl;
+
+// ---
+
+// room left in the input buffer before receiving a datagram
+static const size_t MaxDatagramSize = 65536;
+
+UDPConnection::UDPConnection()
+  : mSocket(0) {
+}
+
+UDPConnection::UDPConnection(UDPSocket *socket, sock_t fd, const Host &host)
+  : Connection(fd), mHost(host), mSocket(socket) {
+}
+
+UDPConnection::~UDPConnection() {
+}
+
+bool UDPConnection::fill(int timeout) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("UDPConnection", "Invalid connection.");
+  }
+  
+  // datagrams don't span several receive calls, the whole space must be there
+  if (mInput.available() < MaxDatagramSize) {
+    mInput.reserve(mInput.size() + MaxDatagramSize);
+  }
+  
+  char *p0, *p1;
+  size_t l0, l1;
+  
+  mInput.writable(p0, l0, p1, l1);
+  
+  long long deadline = Deadline(timeout);
+  
+  while (true) {
+    
+    if (timeout >= 0 && mBlocking) {
+      if (!WaitFD(mFD, false, Remaining(deadline))) {
+        return false;
+      }
+    }
+
+#ifdef _WIN32
+    WSABUF iov[2];
+    iov[0].buf = p0;
+    iov[0].len = (u_long) l0;
+    iov[1].buf = p1;
+    iov[1].len = (u_long) l1;
+    DWORD received = 0;
+    DWORD flags = 0;
+    long n = (WSARecv(mFD, iov, (l1 > 0 ? 2 : 1), &received, &flags, NULL, NULL) == 0 ? long(received) : -1);
+#else
+    struct iovec iov[2];
+    iov[0].iov_base = p0;
+    iov[0].iov_len = l0;
+    iov[1].iov_base = p1;
+    iov[1].iov_len = l1;
+    long n = long(::readv(mFD, iov, (l1 > 0 ? 2 : 1)));
 #endif
-        full = true;
+    
+    if (n >= 0) {
+      // empty datagrams are valid
+      mInput.commit(size_t(n));
+      return true;
+    }
+    
+    if (Interrupted()) {
+      continue;
+    }
+    
+    if (WouldBlock()) {
+      if (!WaitFD(mFD, false, Remaining(deadline))) {
+        return false;
       }
+      continue;
     }
     
-  } while (full);
-  
-  return true;
+    throw Exception("UDPConnection", "Could not receive datagram.", true);
+  }
+}
+
+bool UDPConnection::write(const char *bytes, size_t len, int timeout) GNET_THROWS(Exception) {
+  IOVec vec;
+  vec.bytes = bytes;
+  vec.len = len;
+  return writev(&vec, 1, timeout);
 }
 
-void TCPConnection::write(const char *bytes, size_t len) throw(Exception) {
+bool UDPConnection::writev(const IOVec *vec, size_t count, int timeout) GNET_THROWS(Exception) {
   if (!isValid()) {
-    throw Exception("TCPConnection", "Invalid connection.");
+    throw Exception("UDPConnection", "Invalid connection.");
+  }
+
+#ifdef _WIN32
+  std::vector<WSABUF> iov(count > 0 ? count : 1);
+  for (size_t i=0; i<count; ++i) {
+    iov[i].buf = (char*) vec[i].bytes;
+    iov[i].len = (u_long) vec[i].len;
+  }
+#else
+  std::vector<struct iovec> iov(count > 0 ? count : 1);
+  for (size_t i=0; i<count; ++i) {
+    iov[i].iov_base = (void*) vec[i].bytes;
+    iov[i].iov_len = vec[i].len;
   }
   
-  if (len == 0) {
-    return;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov[0];
+  msg.msg_iovlen = count;
+  
+  int flags = 0;
+# ifdef MSG_DONTWAIT
+  if (timeout >= 0) {
+    flags |= MSG_DONTWAIT;
   }
+# endif
+#endif
   
-  int offset = 0;
-  int remaining = int(len);
+  long long deadline = Deadline(timeout);
   
-  while (remaining > 0) {
-    
-    // flags ?
-    int n = send(mFD, bytes+offset, remaining, 0);
+  while (true) {
     
-    if (n == -1) {
-      if (errno != 0) {
-        // Should notify socket ?
-        throw Exception("TCPConnection", "Could not write to socket.", true);
-        
-      } else {
-        if (mSocket->fd() == mFD) {
-          mSocket->invalidate();
-        }
-        mFD = NULL_SOCKET;
-        throw Exception("TCPConnection", "Connection was remotely closed.");
+    if (timeout >= 0 && mBlocking) {
+      if (!WaitFD(mFD, true, Remaining(deadline))) {
+        return false;
       }
+    }
+
+#ifdef _WIN32
+    DWORD sent = 0;
+    long rv = (WSASend(mFD, &iov[0], (DWORD) count, &sent, 0, NULL, NULL) == 0 ? long(sent) : -1);
+#else
+    long rv = long(::sendmsg(mFD, &msg, flags));
+#endif
     
-    } else {
-      remaining -= n;
-      offset += n;
-#ifdef _DEBUG
-      if (remaining > 0) {
-        std::cout << "gnet::TCPConnection::write: " << remaining << " bytes of " << len << " remains to send..." << std::endl;
+    if (rv >= 0) {
+      // datagrams are sent whole
+      return true;
+    }
+    
+    if (Interrupted()) {
+      continue;
+    }
+    
+    if (WouldBlock()) {
+      if (!WaitFD(mFD, true, Remaining(deadline))) {
+        return false;
       }
-#endif
+      continue;
     }
+    
+    throw Exception("UDPConnection", "Could not send datagram.", true);
   }
 }
   
@@ -0,0 +1,217 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#include <gnet/histogram.h>
+#include <cmath>
+#include "internal.h"
+
+namespace gnet {
+
+Histogram::Histogram(long long highest, int digits)
+  : mHighest(highest < 2 ? 2 : highest)
+  , mDigits(digits < 1 ? 1 : (digits > 5 ? 5 : digits))
+  , mTotal(0)
+  , mMin(0)
+  , mMax(0)
+  , mSum(0.0)
+  , mSumSquares(0.0) {
+  
+  // a bucket needs 2 * 10^digits linear steps to keep the precision
+  long long largestSingleUnit = 2;
+  for (int i=0; i<mDigits; ++i) {
+    largestSingleUnit *= 10;
+  }
+  int subBucketBits = HighestBit((unsigned long long)(largestSingleUnit - 1)) + 1;
+  
+  mSubBucketHalfBits = subBucketBits - 1;
+  mSubBucketMask = (1LL << subBucketBits) - 1;
+  
+  // first bucket covers [0, 2^subBucketBits), each following one doubles
+  int buckets = 1;
+  long long top = (1LL << subBucketBits);
+  while (top <= mHighest) {
+    if (top > (0x7FFFFFFFFFFFFFFFLL >> 1)) {
+      ++buckets;
+      break;
+    }
+    top <<= 1;
+    ++buckets;
+  }
+  
+  mCounts.resize(size_t(buckets + 1) << mSubBucketHalfBits, 0);
+}
+
+size_t Histogram::index(long long value) const {
+  int bucket = HighestBit((unsigned long long)(value | mSubBucketMask)) - mSubBucketHalfBits;
+  long long subBucket = (value >> bucket);
+  return (size_t(bucket + 1) << mSubBucketHalfBits) + size_t(subBucket - (1LL << mSubBucketHalfBits));
+}
+
+long long Histogram::valueAt(size_t index) const {
+  long long half = (1LL << mSubBucketHalfBits);
+  int bucket = int(index >> mSubBucketHalfBits) - 1;
+  long long subBucket = (long long)(index & size_t(half - 1)) + half;
+  if (bucket < 0) {
+    subBucket -= half;
+    bucket = 0;
+  }
+  // highest value counted at that index
+  return ((subBucket + 1) << bucket) - 1;
+}
+
+void Histogram::record(long long value, unsigned long long count) {
+  if (count == 0) {
+    return;
+  }
+  if (value < 0) {
+    value = 0;
+  }
+  if (mTotal == 0 || value < mMin) {
+    mMin = value;
+  }
+  if (mTotal == 0 || value > mMax) {
+    mMax = value;
+  }
+  mTotal += count;
+  mSum += double(value) * double(count);
+  mSumSquares += double(value) * double(value) * double(count);
+  mCounts[index(value > mHighest ? mHighest : value)] += count;
+}
+
+void Histogram::recordCorrected(long long value, long long interval) {
+  record(value);
+  if (interval <= 0) {
+    return;
+  }
+  for (long long missing = value - interval; missing >= interval; missing -= interval) {
+    record(missing);
+  }
+}
+
+void Histogram::merge(const Histogram &other) {
+  if (other.mTotal == 0) {
+    return;
+  }
+  if (mTotal == 0 || other.mMin < mMin) {
+    mMin = other.mMin;
+  }
+  if (mTotal == 0 || other.mMax > mMax) {
+    mMax = other.mMax;
+  }
+  mTotal += other.mTotal;
+  mSum += other.mSum;
+  mSumSquares += other.mSumSquares;
+  
+  if (other.mSubBucketHalfBits == mSubBucketHalfBits) {
+    size_t n = (other.mCounts.size() < mCounts.size() ? other.mCounts.size() : mCounts.size());
+    for (size_t i=0; i<n; ++i) {
+      mCounts[i] += other.mCounts[i];
+    }
+    // other tracks higher values: fold them into our highest
+    for (size_t i=n; i<other.mCounts.size(); ++i) {
+      mCounts[index(mHighest)] += other.mCounts[i];
+    }
+  } else {
+    for (size_t i=0; i<other.mCounts.size(); ++i) {
+      if (other.mCounts[i] != 0) {
+        long long value = other.valueAt(i);
+        mCounts[index(value > mHighest ? mHighest : value)] += other.mCounts[i];
+      }
+    }
+  }
+}
+
+void Histogram::reset() {
+  for (size_t i=0; i<mCounts.size(); ++i) {
+    mCounts[i] = 0;
+  }
+  mTotal = 0;
+  mMin = 0;
+  mMax = 0;
+  mSum = 0.0;
+  mSumSquares = 0.0;
+}
+
+unsigned long long Histogram::count() const {
+  return mTotal;
+}
+
+long long Histogram::min() const {
+  return mMin;
+}
+
+long long Histogram::max() const {
+  return mMax;
+}
+
+double Histogram::mean() const {
+  return (mTotal == 0 ? 0.0 : mSum / double(mTotal));
+}
+
+double Histogram::stddev() const {
+  if (mTotal == 0) {
+    return 0.0;
+  }
+  double m = mSum / double(mTotal);
+  double v = mSumSquares / double(mTotal) - m * m;
+  return (v > 0.0 ? sqrt(v) : 0.0);
+}
+
+long long Histogram::percentile(double percent) const {
+  if (mTotal == 0) {
+    return 0;
+  }
+  if (percent <= 0.0) {
+    return mMin;
+  }
+  if (percent >= 100.0) {
+    return mMax;
+  }
+  
+  unsigned long long target = (unsigned long long) ceil(percent * 0.01 * double(mTotal));
+  if (target == 0) {
+    target = 1;
+  }
+  
+  unsigned long long seen = 0;
+  for (size_t i=0; i<mCounts.size(); ++i) {
+    seen += mCounts[i];
+    if (seen >= target) {
+      long long value = valueAt(i);
+      // never report outside of what was actually recorded
+      return (value > mMax ? mMax : (value < mMin ? mMin : value));
+    }
+  }
+  
+  return mMax;
+}
+
+long long Histogram::highest() const {
+  return mHighest;
+}
+
+int Histogram::digits() const {
+  return mDigits;
+}
+
+}
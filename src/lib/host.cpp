@@ -22,47 +22,138 @@ USA.
 */
 
 #include <gnet/host.h>
-#include <gcore/rex.h>
+#include <gnet/resolver.h>
 #include <sstream>
 
 namespace gnet {
 
-static gcore::Rex IPAddressRE(RAW("\d{1,3}\.\d{1,3}\.\d{1,3}\.\d{1,3}"));
-
-Host::Host() {
-  memset(&mAddr, 0, sizeof(struct sockaddr_in));
+static inline struct sockaddr_in* IPv4(struct sockaddr_storage &ss) {
+  return (struct sockaddr_in*) &ss;
 }
 
-Host::Host(const std::string &addr, unsigned short port) throw(Exception) {
+static inline const struct sockaddr_in* IPv4(const struct sockaddr_storage &ss) {
+  return (const struct sockaddr_in*) &ss;
+}
 
-  memset(&mAddr, 0, sizeof(struct sockaddr_in));
-  mAddr.sin_family = AF_INET;
-  mAddr.sin_addr.s_addr = INADDR_ANY;
-  mAddr.sin_port = htons((u_short)port);
+static inline struct sockaddr_in6* IPv6(struct sockaddr_storage &ss) {
+  return (struct sockaddr_in6*) &ss;
+}
 
-  if (IPAddressRE.match(addr) == true) {
-    
-#ifdef _WIN32
-    mAddr.sin_addr.s_addr = inet_addr(addr.c_str());
-#else
-    inet_aton(addr.c_str(), &(mAddr.sin_addr));
-#endif
+static inline const struct sockaddr_in6* IPv6(const struct sockaddr_storage &ss) {
+  return (const struct sockaddr_in6*) &ss;
+}
 
+static void SetPort(struct sockaddr_storage &ss, unsigned short port) {
+  if (ss.ss_family == AF_INET6) {
+    IPv6(ss)->sin6_port = htons((u_short)port);
   } else {
+    IPv4(ss)->sin_port = htons((u_short)port);
+  }
+}
+
+// ---
+
+Host::Host() {
+  memset(&mAddr, 0, sizeof(struct sockaddr_storage));
+}
+
+Host::Host(const std::string &addr, unsigned short port, int family) GNET_THROWS(Exception) {
+  
+  memset(&mAddr, 0, sizeof(struct sockaddr_storage));
+  
+  std::string literal = addr;
+  
+  if (literal.length() >= 2 && literal[0] == '[' && literal[literal.length()-1] == ']') {
+    literal = literal.substr(1, literal.length() - 2);
+  }
+  
+  if (inet_pton(AF_INET, literal.c_str(), &(IPv4(mAddr)->sin_addr)) == 1) {
+    // dotted quad literal, nothing to resolve
+    mAddr.ss_family = AF_INET;
+    SetPort(mAddr, port);
+    return;
+  }
+  
+  if (literal.find(':') != std::string::npos) {
+    // names never contain colons
+    if (inet_pton(AF_INET6, literal.c_str(), &(IPv6(mAddr)->sin6_addr)) == 1) {
+      mAddr.ss_family = AF_INET6;
+      SetPort(mAddr, port);
+      return;
+    }
+    
+    // scoped addresses (fe80::1%eth0)
+    struct addrinfo hints;
+    struct addrinfo *res = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET6;
+    hints.ai_flags = AI_NUMERICHOST;
     
-    struct hostent *he = gethostbyname(addr.c_str());
-    if (he == NULL) {
-      std::ostringstream oss;
-      oss << "Could not find host: \"" << addr << "\"";
-      throw Exception("Host", oss.str());
+    if (literal.find('%') != std::string::npos &&
+        getaddrinfo(literal.c_str(), NULL, &hints, &res) == 0) {
+      memcpy(&mAddr, res->ai_addr, res->ai_addrlen);
+      freeaddrinfo(res);
+      SetPort(mAddr, port);
+      return;
     }
-    memcpy(&(mAddr.sin_addr.s_addr), he->h_addr, he->h_length);
+    
+    std::ostringstream oss;
+    oss << "Invalid address: \"" << addr << "\"";
+    throw Exception("Host", oss.str());
+  }
+  
+  std::vector<Host> hosts;
+  
+  try {
+    Resolver::Default().resolve(addr, port, hosts);
+  } catch (Exception &) {
+    hosts.clear();
   }
   
+  // IPv4 first unless asked otherwise: resolvers usually list ::1 before
+  // 127.0.0.1 for localhost, which IPv4 only peers don't listen on
+  const Host *found = 0;
+  
+  for (size_t i=0; i<hosts.size() && !found; ++i) {
+    if (hosts[i].family() == (family == AF_UNSPEC ? AF_INET : family)) {
+      found = &(hosts[i]);
+    }
+  }
+  
+  if (!found && family == AF_UNSPEC && !hosts.empty()) {
+    found = &(hosts[0]);
+  }
+  
+  if (!found) {
+    std::ostringstream oss;
+    oss << "Could not find host: \"" << addr << "\"";
+    throw Exception("Host", oss.str());
+  }
+  
+  memcpy(&mAddr, &(found->mAddr), sizeof(struct sockaddr_storage));
+}
+
+Host::Host(const Host &addr, unsigned short port) {
+  memcpy(&mAddr, &(addr.mAddr), sizeof(struct sockaddr_storage));
+  SetPort(mAddr, port);
+}
+
+Host::Host(const struct sockaddr *addr, socklen_t len) GNET_THROWS(Exception) {
+  memset(&mAddr, 0, sizeof(struct sockaddr_storage));
+  
+  if (addr->sa_family == AF_INET && len >= (socklen_t)sizeof(struct sockaddr_in)) {
+    memcpy(&mAddr, addr, sizeof(struct sockaddr_in));
+    
+  } else if (addr->sa_family == AF_INET6 && len >= (socklen_t)sizeof(struct sockaddr_in6)) {
+    memcpy(&mAddr, addr, sizeof(struct sockaddr_in6));
+    
+  } else {
+    throw Exception("Host", "Unsupported address family.");
+  }
 }
 
 Host::Host(const Host &rhs) {
-  memcpy(&mAddr, &(rhs.mAddr), sizeof(struct sockaddr_in));
+  memcpy(&mAddr, &(rhs.mAddr), sizeof(struct sockaddr_storage));
 }
 
 Host::~Host() {
@@ -70,17 +161,82 @@ Host::~Host() {
 
 Host& Host::operator=(const Host &rhs) {
   if (this != &rhs) {
-    memcpy(&mAddr, &(rhs.mAddr), sizeof(struct sockaddr_in));
+    memcpy(&mAddr, &(rhs.mAddr), sizeof(struct sockaddr_storage));
   }
   return *this;
 }
 
+int Host::compare(const Host &rhs) const {
+  if (mAddr.ss_family != rhs.mAddr.ss_family) {
+    return (mAddr.ss_family < rhs.mAddr.ss_family ? -1 : 1);
+  }
+  
+  int rv = 0;
+  
+  if (mAddr.ss_family == AF_INET6) {
+    const struct sockaddr_in6 *a = IPv6(mAddr);
+    const struct sockaddr_in6 *b = IPv6(rhs.mAddr);
+    rv = memcmp(&(a->sin6_addr), &(b->sin6_addr), sizeof(struct in6_addr));
+    if (rv == 0 && a->sin6_scope_id != b->sin6_scope_id) {
+      rv = (a->sin6_scope_id < b->sin6_scope_id ? -1 : 1);
+    }
+  } else {
+    rv = memcmp(&(IPv4(mAddr)->sin_addr), &(IPv4(rhs.mAddr)->sin_addr), sizeof(struct in_addr));
+  }
+  
+  if (rv == 0 && port() != rhs.port()) {
+    rv = (port() < rhs.port() ? -1 : 1);
+  }
+  
+  return rv;
+}
+
+bool Host::operator==(const Host &rhs) const {
+  return (compare(rhs) == 0);
+}
+
+bool Host::operator!=(const Host &rhs) const {
+  return (compare(rhs) != 0);
+}
+
+bool Host::operator<(const Host &rhs) const {
+  return (compare(rhs) < 0);
+}
+
 unsigned short Host::port() const {
-  return ntohs(mAddr.sin_port);
+  if (mAddr.ss_family == AF_INET6) {
+    return ntohs(IPv6(mAddr)->sin6_port);
+  } else {
+    return ntohs(IPv4(mAddr)->sin_port);
+  }
 }
 
 std::string Host::address() const {
-  return inet_ntoa(mAddr.sin_addr);
+  char buffer[INET6_ADDRSTRLEN];
+  const char *rv = 0;
+  
+  if (mAddr.ss_family == AF_INET6) {
+    rv = inet_ntop(AF_INET6, (void*) &(IPv6(mAddr)->sin6_addr), buffer, sizeof(buffer));
+  } else {
+    rv = inet_ntop(AF_INET, (void*) &(IPv4(mAddr)->sin_addr), buffer, sizeof(buffer));
+  }
+  
+  return (rv ? rv : "");
+}
+
+int Host::family() const {
+  return mAddr.ss_family;
+}
+
+socklen_t Host::length() const {
+  switch (mAddr.ss_family) {
+  case AF_INET:
+    return sizeof(struct sockaddr_in);
+  case AF_INET6:
+    return sizeof(struct sockaddr_in6);
+  default:
+    return sizeof(struct sockaddr_storage);
+  }
 }
 
 Host::operator struct sockaddr* () {
@@ -90,7 +246,5 @@ Host::operator struct sockaddr* () {
 Host::operator const struct sockaddr* () const {
   return (const struct sockaddr*) &mAddr;
 }
-  
-}
-
 
+}
@@ -0,0 +1,104 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#ifndef __gnet_internal_h_
+#define __gnet_internal_h_
+
+// Private helpers shared by the library sources, not installed
+
+#include <gnet/config.h>
+#include <gnet/metrics.h>
+#include <vector>
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+namespace gnet {
+  
+  // Monotonic clock in milliseconds
+  long long MonotonicTime();
+  
+  // Monotonic clock in microseconds
+  long long MonotonicMicroseconds();
+  
+  // Absolute deadline for a timeout in milliseconds (-1 for none)
+  long long Deadline(int timeout);
+  
+  // Milliseconds left before deadline (-1 for none, 0 when expired)
+  int Remaining(long long deadline);
+  
+  // Wait for descriptor to become readable (or writable)
+  // Returns false if timeout expired. timeout is in milliseconds, -1 waits forever
+  bool WaitFD(sock_t fd, bool write, int timeout) GNET_THROWS(Exception);
+  
+  // Same for several descriptors, ready is set for each descriptor
+  // Returns false if timeout expired
+  bool WaitFDs(const std::vector<sock_t> &fds, bool write, int timeout, std::vector<bool> &ready) GNET_THROWS(Exception);
+  
+  bool SetBlocking(sock_t fd, bool blocking);
+  
+  void CloseFD(sock_t fd);
+  
+  // Last socket operation failed because it would have blocked
+  bool WouldBlock();
+  
+  // Last socket operation was interrupted by a signal
+  bool Interrupted();
+  
+  // Last socket operation failed because the peer is gone
+  bool ConnectionLost();
+  
+  // Called by Uninitialize
+  void ReleaseDefaultResolver();
+  
+  // Index of the highest bit set (v > 0)
+  inline int HighestBit(unsigned long long v) {
+#ifdef _MSC_VER
+    unsigned long idx;
+# ifdef _WIN64
+    _BitScanReverse64(&idx, v);
+# else
+    if (v >> 32) {
+      _BitScanReverse(&idx, (unsigned long)(v >> 32));
+      idx += 32;
+    } else {
+      _BitScanReverse(&idx, (unsigned long) v);
+    }
+# endif
+    return int(idx);
+#else
+    return 63 - __builtin_clzll(v);
+#endif
+  }
+}
+
+// Metrics hooks, compiled out with GNET_METRICS=0 (see metrics.h)
+#if GNET_METRICS
+# define GNET_METRIC_ADD(counter, n) gnet::Metrics::Add(gnet::Metrics::counter, n)
+# define GNET_METRIC_RECORD(distribution, v) gnet::Metrics::Record(gnet::Metrics::distribution, v)
+#else
+# define GNET_METRIC_ADD(counter, n)
+# define GNET_METRIC_RECORD(distribution, v)
+#endif
+
+#endif
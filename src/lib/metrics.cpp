@@ -0,0 +1,323 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#include <gnet/metrics.h>
+#include "internal.h"
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace gnet {
+
+#if GNET_METRICS
+
+// Counters of one thread, padded so that no other block shares its cache lines
+struct MetricsBlock {
+  
+  MetricsBlock() : used(true) {
+    for (size_t i=0; i<Metrics::NumCounters; ++i) {
+      counters[i].store(0, std::memory_order_relaxed);
+    }
+    for (size_t i=0; i<Metrics::NumDistributions; ++i) {
+      distributions[i].count.store(0, std::memory_order_relaxed);
+      distributions[i].sum.store(0, std::memory_order_relaxed);
+      for (size_t j=0; j<Metrics::NumBuckets; ++j) {
+        distributions[i].buckets[j].store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+  
+  struct Distribution {
+    std::atomic<unsigned long long> count;
+    std::atomic<unsigned long long> sum;
+    std::atomic<unsigned long long> buckets[Metrics::NumBuckets];
+  };
+  
+  char before[64];
+  std::atomic<unsigned long long> counters[Metrics::NumCounters];
+  Distribution distributions[Metrics::NumDistributions];
+  // released by an exited thread, its counts are kept
+  std::atomic<bool> used;
+  char after[64];
+};
+
+// Only the owning thread writes, readers load
+static inline void Bump(std::atomic<unsigned long long> &v, unsigned long long n) {
+  v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// Blocks live as long as the process (threads may update metrics during
+// static destruction): a block released by an exited thread goes to the next
+// thread that starts updating metrics
+static std::mutex& BlocksLock() {
+  static std::mutex *lock = new std::mutex();
+  return *lock;
+}
+
+static std::vector<MetricsBlock*>& Blocks() {
+  static std::vector<MetricsBlock*> *blocks = new std::vector<MetricsBlock*>();
+  return *blocks;
+}
+
+static thread_local MetricsBlock *tBlock = 0;
+
+struct MetricsRelease {
+  
+  MetricsRelease() : block(0) {
+  }
+  
+  ~MetricsRelease() {
+    if (block) {
+      block->used.store(false, std::memory_order_release);
+      tBlock = 0;
+    }
+  }
+  
+  MetricsBlock *block;
+};
+
+static thread_local MetricsRelease tRelease;
+
+static MetricsBlock* AcquireBlock() {
+  std::lock_guard<std::mutex> guard(BlocksLock());
+  
+  std::vector<MetricsBlock*> &blocks = Blocks();
+  MetricsBlock *block = 0;
+  
+  for (size_t i=0; i<blocks.size(); ++i) {
+    if (!blocks[i]->used.load(std::memory_order_acquire)) {
+      block = blocks[i];
+      block->used.store(true, std::memory_order_relaxed);
+      break;
+    }
+  }
+  
+  if (!block) {
+    block = new MetricsBlock();
+    blocks.push_back(block);
+  }
+  
+  tRelease.block = block;
+  tBlock = block;
+  
+  return block;
+}
+
+static inline MetricsBlock* LocalBlock() {
+  MetricsBlock *block = tBlock;
+  return (block ? block : AcquireBlock());
+}
+
+#endif
+
+// ---
+
+static const char *CounterNames[Metrics::NumCounters] = {
+  "bytes_received_total",
+  "bytes_sent_total",
+  "recv_calls_total",
+  "send_calls_total",
+  "partial_writes_total",
+  "would_block_total",
+  "until_rescans_total",
+  "accepts_total",
+  "connections_opened_total",
+  "connections_closed_total"
+};
+
+static const char *CounterHelp[Metrics::NumCounters] = {
+  "Bytes received by connections.",
+  "Bytes sent by connections.",
+  "Receive system calls that returned data.",
+  "Send system calls that sent data.",
+  "Sends that took less than what was asked.",
+  "Receives and sends that would have blocked.",
+  "Read-until scans that did not find the delimiter.",
+  "Connections accepted.",
+  "TCP connections opened (accepted or connected).",
+  "TCP connections closed."
+};
+
+static const char *DistributionNames[Metrics::NumDistributions] = {
+  "recv_size_bytes",
+  "send_size_bytes",
+  "read_wait_seconds",
+  "write_wait_seconds",
+  "connection_lifetime_seconds"
+};
+
+static const char *DistributionHelp[Metrics::NumDistributions] = {
+  "Bytes per receive.",
+  "Bytes per send.",
+  "Time spent waiting for connections to become readable.",
+  "Time spent waiting for connections to become writable.",
+  "Time from connect or accept to close."
+};
+
+// Recorded unit per exposed unit
+static const double DistributionScale[Metrics::NumDistributions] = {
+  1.0, 1.0, 1.0e-6, 1.0e-6, 1.0e-6
+};
+
+Metrics::Snapshot::Snapshot()
+  : time(0) {
+  memset(counters, 0, sizeof(counters));
+  memset(distributions, 0, sizeof(distributions));
+}
+
+unsigned long long Metrics::Snapshot::counter(Counter c) const {
+  return counters[c];
+}
+
+const Metrics::Buckets& Metrics::Snapshot::distribution(Distribution d) const {
+  return distributions[d];
+}
+
+double Metrics::Snapshot::average(Distribution d) const {
+  const Buckets &b = distributions[d];
+  return (b.count == 0 ? 0.0 : double(b.sum) / double(b.count));
+}
+
+double Metrics::Snapshot::rate(Counter c, const Snapshot &since) const {
+  if (time <= since.time || counters[c] < since.counters[c]) {
+    return 0.0;
+  }
+  return double(counters[c] - since.counters[c]) * 1.0e6 / double(time - since.time);
+}
+
+std::string Metrics::Snapshot::prometheus(const char *prefix) const {
+  std::string out;
+  char line[256];
+  
+  for (size_t i=0; i<NumCounters; ++i) {
+    snprintf(line, sizeof(line), "# HELP %s_%s %s\n# TYPE %s_%s counter\n%s_%s %llu\n",
+             prefix, CounterNames[i], CounterHelp[i], prefix, CounterNames[i],
+             prefix, CounterNames[i], counters[i]);
+    out += line;
+  }
+  
+  unsigned long long opened = counters[ConnectionsOpened];
+  unsigned long long closed = counters[ConnectionsClosed];
+  snprintf(line, sizeof(line), "# HELP %s_connections_open TCP connections currently open.\n# TYPE %s_connections_open gauge\n%s_connections_open %llu\n",
+           prefix, prefix, prefix, (opened > closed ? opened - closed : 0ULL));
+  out += line;
+  
+  for (size_t i=0; i<NumDistributions; ++i) {
+    const Buckets &b = distributions[i];
+    const char *name = DistributionNames[i];
+    double scale = DistributionScale[i];
+    
+    snprintf(line, sizeof(line), "# HELP %s_%s %s\n# TYPE %s_%s histogram\n",
+             prefix, name, DistributionHelp[i], prefix, name);
+    out += line;
+    
+    // cumulative, up to bucket j values are at most 2^j
+    unsigned long long cumulative = 0;
+    for (size_t j=0; j+1<NumBuckets; ++j) {
+      cumulative += b.buckets[j];
+      snprintf(line, sizeof(line), "%s_%s_bucket{le=\"%.9g\"} %llu\n",
+               prefix, name, double(1ULL << j) * scale, cumulative);
+      out += line;
+    }
+    snprintf(line, sizeof(line), "%s_%s_bucket{le=\"+Inf\"} %llu\n%s_%s_sum %.9g\n%s_%s_count %llu\n",
+             prefix, name, b.count, prefix, name, double(b.sum) * scale, prefix, name, b.count);
+    out += line;
+  }
+  
+  return out;
+}
+
+// ---
+
+bool Metrics::Enabled() {
+#if GNET_METRICS
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Metrics::Collect(Snapshot &snapshot) {
+  snapshot = Snapshot();
+  snapshot.time = MonotonicMicroseconds();
+
+#if GNET_METRICS
+  std::lock_guard<std::mutex> guard(BlocksLock());
+  
+  std::vector<MetricsBlock*> &blocks = Blocks();
+  
+  for (size_t i=0; i<blocks.size(); ++i) {
+    const MetricsBlock *block = blocks[i];
+    for (size_t j=0; j<NumCounters; ++j) {
+      snapshot.counters[j] += block->counters[j].load(std::memory_order_relaxed);
+    }
+    for (size_t j=0; j<NumDistributions; ++j) {
+      Buckets &b = snapshot.distributions[j];
+      const MetricsBlock::Distribution &d = block->distributions[j];
+      b.count += d.count.load(std::memory_order_relaxed);
+      b.sum += d.sum.load(std::memory_order_relaxed);
+      for (size_t k=0; k<NumBuckets; ++k) {
+        b.buckets[k] += d.buckets[k].load(std::memory_order_relaxed);
+      }
+    }
+  }
+#endif
+}
+
+void Metrics::Add(Counter c, unsigned long long n) {
+#if GNET_METRICS
+  Bump(LocalBlock()->counters[c], n);
+#else
+  (void) c;
+  (void) n;
+#endif
+}
+
+void Metrics::Record(Distribution d, unsigned long long value) {
+#if GNET_METRICS
+  MetricsBlock::Distribution &dist = LocalBlock()->distributions[d];
+  // upper bounds are inclusive, as Prometheus le: 512 lands in (256, 512]
+  size_t bucket = (value <= 1 ? 0 : size_t(HighestBit(value - 1)) + 1);
+  if (bucket >= NumBuckets) {
+    bucket = NumBuckets - 1;
+  }
+  Bump(dist.buckets[bucket], 1);
+  Bump(dist.sum, value);
+  Bump(dist.count, 1);
+#else
+  (void) d;
+  (void) value;
+#endif
+}
+
+const char* Metrics::Name(Counter c) {
+  return (c < NumCounters ? CounterNames[c] : "");
+}
+
+const char* Metrics::Name(Distribution d) {
+  return (d < NumDistributions ? DistributionNames[d] : "");
+}
+
+}
@@ -0,0 +1,903 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#include <gnet/poller.h>
+#include "uring.h"
+#include "internal.h"
+#include <cerrno>
+#ifdef __linux__
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <poll.h>
+#elif !defined(_WIN32)
+# include <fcntl.h>
+#endif
+
+namespace gnet {
+
+#ifdef __linux__
+static const int MaxEvents = 256;
+#endif
+
+#ifdef GNET_URING
+// submission queue depth, provided receive buffers
+static const unsigned RingEntries = 256;
+static const unsigned RingBuffers = 256;
+static const unsigned RingBufferSize = 8192;
+
+static inline struct io_uring_sqe* Prepare(Uring *ring, int opcode, int fd, unsigned long long data) GNET_THROWS(Exception) {
+  struct io_uring_sqe *sqe = ring->sqe();
+  sqe->opcode = (unsigned char) opcode;
+  sqe->fd = fd;
+  sqe->user_data = data;
+  return sqe;
+}
+#endif
+
+Poller::Handler::Handler() {
+}
+
+Poller::Handler::~Handler() {
+}
+
+void Poller::Handler::onAccept(Poller &, TCPSocket *) {
+}
+
+void Poller::Handler::onRead(Poller &, Connection *) {
+}
+
+void Poller::Handler::onWrite(Poller &, Connection *) {
+}
+
+void Poller::Handler::onClose(Poller &poller, Connection *conn) {
+  poller.remove(conn);
+}
+
+// ---
+
+Poller::Poller(Backend backend) GNET_THROWS(Exception)
+  : mFD(-1), mRing(0), mStop(false) {
+  
+  mWakeFD[0] = NULL_SOCKET;
+  mWakeFD[1] = NULL_SOCKET;
+
+#ifdef __linux__
+  mWakeFD[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (mWakeFD[0] == -1) {
+    throw Exception("Poller", "Could not create wakeup descriptor.", true);
+  }
+  mWakeFD[1] = mWakeFD[0];
+
+# ifdef GNET_URING
+  if (backend == IOUring) {
+    mRing = Uring::Create(RingEntries, RingBuffers, RingBufferSize);
+  }
+  if (mRing) {
+    struct io_uring_sqe *sqe = Prepare(mRing, IORING_OP_POLL_ADD, mWakeFD[0], OpWake);
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    return;
+  }
+# else
+  (void) backend;
+# endif
+  
+  mFD = epoll_create1(EPOLL_CLOEXEC);
+  if (mFD == -1) {
+    ::close(mWakeFD[0]);
+    throw Exception("Poller", "Could not create epoll instance.", true);
+  }
+  
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = 0;
+  epoll_ctl(mFD, EPOLL_CTL_ADD, mWakeFD[0], &ev);
+
+#elif !defined(_WIN32)
+  int fds[2];
+  if (::pipe(fds) == -1) {
+    throw Exception("Poller", "Could not create wakeup descriptor.", true);
+  }
+  for (int i=0; i<2; ++i) {
+    fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+  }
+  mWakeFD[0] = fds[0];
+  mWakeFD[1] = fds[1];
+  (void) backend;
+#else
+  (void) backend;
+#endif
+}
+
+Poller::~Poller() {
+#ifdef GNET_URING
+  if (mRing) {
+    // connections still registered don't get what is in flight, but
+    // descriptors accepted in the meantime go to their socket
+    for (EntryMap::iterator it=mEntries.begin(); it!=mEntries.end(); ++it) {
+      if (it->second->socket) {
+        try {
+          mRing->cancel((unsigned long long) it->second | OpAccept);
+        } catch (Exception &) {
+        }
+      }
+    }
+    struct io_uring_cqe *cqe;
+    while ((cqe = mRing->peek()) != 0) {
+      if ((cqe->user_data & 7) == OpAccept && cqe->res >= 0) {
+        ((Entry*) (cqe->user_data & ~7ULL))->socket->mAccepted.push_back(cqe->res);
+      }
+      mRing->advance();
+    }
+    delete mRing;
+  }
+#endif
+  
+  for (EntryMap::iterator it=mEntries.begin(); it!=mEntries.end(); ++it) {
+    delete it->second;
+  }
+  mEntries.clear();
+  mOwners.clear();
+  purge();
+
+#ifndef _WIN32
+  if (mWakeFD[0] != NULL_SOCKET) {
+    ::close(mWakeFD[0]);
+  }
+  if (mWakeFD[1] != NULL_SOCKET && mWakeFD[1] != mWakeFD[0]) {
+    ::close(mWakeFD[1]);
+  }
+  if (mFD != -1) {
+    ::close(mFD);
+  }
+#endif
+}
+
+Poller::Entry* Poller::entry(sock_t fd, Handler *handler, int events) {
+  Entry *e = new Entry;
+  e->fd = fd;
+  e->events = events;
+  e->dead = false;
+  e->flushing = false;
+  e->handler = handler;
+  e->socket = 0;
+  e->conn = 0;
+  e->armed = 0;
+  e->ready = 0;
+  e->queued = false;
+  e->arming = false;
+  e->stream = false;
+  return e;
+}
+
+void Poller::add(TCPSocket *socket, Handler *handler) GNET_THROWS(Exception) {
+  if (!socket || !socket->isValid()) {
+    throw Exception("Poller", "Invalid socket.");
+  }
+  Entry *e = entry(socket->fd(), handler, Read);
+  e->socket = socket;
+  add(e);
+}
+
+void Poller::add(Connection *conn, Handler *handler, int events) GNET_THROWS(Exception) {
+  if (!conn || !conn->isValid()) {
+    throw Exception("Poller", "Invalid connection.");
+  }
+  Entry *e = entry(conn->fd(), handler, events);
+  e->conn = conn;
+  e->stream = (dynamic_cast<StreamConnection*>(conn) != 0);
+  add(e);
+}
+
+void Poller::add(Entry *e) GNET_THROWS(Exception) {
+  
+  if (mEntries.find(e->fd) != mEntries.end()) {
+    delete e;
+    throw Exception("Poller", "Descriptor already registered.");
+  }
+
+#ifdef __linux__
+  if (mRing) {
+    try {
+      arm(e);
+    } catch (Exception &) {
+      if (e->conn) {
+        e->conn->mFed = false;
+      }
+      delete e;
+      throw;
+    }
+    mEntries[e->fd] = e;
+    mOwners[e->socket ? (const void*)e->socket : (const void*)e->conn] = e;
+    return;
+  }
+  
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLRDHUP;
+  if (e->events & Read) {
+    ev.events |= EPOLLIN;
+  }
+  if (e->events & Write) {
+    ev.events |= EPOLLOUT;
+  }
+  if (e->events & EdgeTriggered) {
+    ev.events |= EPOLLET;
+  }
+  ev.data.ptr = e;
+  if (epoll_ctl(mFD, EPOLL_CTL_ADD, e->fd, &ev) == -1) {
+    delete e;
+    throw Exception("Poller", "Could not register descriptor.", true);
+  }
+#else
+  if (mEntries.size() + 1 >= FD_SETSIZE) {
+    delete e;
+    throw Exception("Poller", "Too many descriptors for select().");
+  }
+#ifndef _WIN32
+  // fd_set is a bitmask indexed by descriptor value outside of windows
+  if (e->fd >= FD_SETSIZE) {
+    delete e;
+    throw Exception("Poller", "Descriptor value too large for select().");
+  }
+#endif
+#endif
+  
+  mEntries[e->fd] = e;
+  mOwners[e->socket ? (const void*)e->socket : (const void*)e->conn] = e;
+}
+
+void Poller::modify(Connection *conn, int events) GNET_THROWS(Exception) {
+  if (!conn) {
+    return;
+  }
+  
+  OwnerMap::iterator it = mOwners.find(conn);
+  
+  if (it == mOwners.end()) {
+    throw Exception("Poller", "Connection not registered.");
+  }
+  
+  Entry *e = it->second;
+  
+  if (e->events == events) {
+    return;
+  }
+  
+  int previous = e->events;
+  
+  e->events = events;
+  
+  try {
+    update(e);
+  } catch (Exception &) {
+    e->events = previous;
+    throw;
+  }
+}
+
+void Poller::update(Entry *e) GNET_THROWS(Exception) {
+#ifdef __linux__
+  if (mRing) {
+    if ((e->events & Read) == 0 && (e->armed & ((1 << OpRecv) | (1 << OpPollIn))) != 0) {
+      disarm(e, false);
+    }
+    arm(e);
+    return;
+  }
+  
+  int events = e->events | (e->flushing ? Write : 0);
+  
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLRDHUP;
+  if (events & Read) {
+    ev.events |= EPOLLIN;
+  }
+  if (events & Write) {
+    ev.events |= EPOLLOUT;
+  }
+  if (events & EdgeTriggered) {
+    ev.events |= EPOLLET;
+  }
+  ev.data.ptr = e;
+  if (epoll_ctl(mFD, EPOLL_CTL_MOD, e->fd, &ev) == -1) {
+    throw Exception("Poller", "Could not modify descriptor.", true);
+  }
+#else
+  (void) e;
+#endif
+}
+
+void Poller::flush(Entry *e) {
+  try {
+    e->conn->flush(0);
+  } catch (Exception &) {
+    if (e->handler) {
+      e->handler->onClose(*this, e->conn);
+    }
+    return;
+  }
+  
+  if (e->dead) {
+    return;
+  }
+  
+  bool pending = (e->conn->unflushed() > 0);
+  
+  if (pending != e->flushing) {
+    e->flushing = pending;
+    try {
+      update(e);
+    } catch (Exception &) {
+      // descriptor closed behind our back, nothing to watch
+    }
+  }
+}
+
+void Poller::remove(TCPSocket *socket) {
+  remove((const void*)socket);
+}
+
+void Poller::remove(Connection *conn) {
+  remove((const void*)conn);
+}
+
+void Poller::remove(const void *owner) {
+  OwnerMap::iterator it = mOwners.find(owner);
+  
+  if (it == mOwners.end()) {
+    return;
+  }
+  
+  Entry *e = it->second;
+
+#ifdef __linux__
+  if (mRing) {
+    // bytes received up to now are left in the connection input buffer
+    try {
+      disarm(e, true);
+    } catch (Exception &) {
+    }
+  } else {
+    // closed descriptors are automatically removed from the epoll set
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    epoll_ctl(mFD, EPOLL_CTL_DEL, e->fd, &ev);
+  }
+#endif
+  
+  // entry may still be referenced by pending events, free it after dispatch
+  e->dead = true;
+  mDead.push_back(e);
+  mEntries.erase(e->fd);
+  mOwners.erase(it);
+}
+
+bool Poller::has(sock_t fd) const {
+  return (mEntries.find(fd) != mEntries.end());
+}
+
+size_t Poller::count() const {
+  return mEntries.size();
+}
+
+void Poller::purge() {
+  for (size_t i=0; i<mDead.size(); ++i) {
+    delete mDead[i];
+  }
+  mDead.clear();
+}
+
+void Poller::dispatch(Entry *e, bool readable, bool writable, bool closed) {
+  
+  if (e->socket) {
+    if (readable && e->handler) {
+      e->handler->onAccept(*this, e->socket);
+    }
+    return;
+  }
+  
+  mTouched.push_back(e);
+  
+  if (writable && e->flushing) {
+    flush(e);
+    // Write only watched on behalf of the connection
+    writable = ((e->events & Write) != 0);
+  }
+  
+  if (readable && !e->dead && e->handler) {
+    e->handler->onRead(*this, e->conn);
+  }
+  if (writable && !e->dead && e->handler) {
+    e->handler->onWrite(*this, e->conn);
+  }
+  if (closed && !e->dead && e->handler) {
+    e->handler->onClose(*this, e->conn);
+  }
+}
+
+int Poller::poll(int timeout) GNET_THROWS(Exception) {
+  
+  int count = 0;
+
+#ifdef __linux__
+  
+  struct epoll_event events[MaxEvents];
+  
+  int n = 0;
+  
+  if (mRing) {
+    count = pollRing(timeout);
+  } else {
+    n = epoll_wait(mFD, events, MaxEvents, timeout);
+  }
+  
+  if (n == -1) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    throw Exception("Poller", "Could not wait for events.", true);
+  }
+  
+  for (int i=0; i<n; ++i) {
+    
+    Entry *e = (Entry*) events[i].data.ptr;
+    
+    if (e == 0) {
+      uint64_t v;
+      while (::read(mWakeFD[0], &v, sizeof(v)) > 0);
+      continue;
+    }
+    
+    if (e->dead) {
+      continue;
+    }
+    
+    uint32_t flags = events[i].events;
+    
+    bool readable = ((flags & EPOLLIN) != 0);
+    bool writable = ((flags & EPOLLOUT) != 0);
+    bool closed = ((flags & (EPOLLHUP | EPOLLERR)) != 0 ||
+                   ((flags & EPOLLRDHUP) != 0 && !readable));
+    
+    dispatch(e, readable, writable, closed);
+    ++count;
+  }
+
+#else
+  
+  // exceptfds only reports out-of-band data (or failed connects on windows),
+  // hang ups and errors make descriptors readable: the handler's read sees
+  // them, as it does with the epoll backend when the peer shuts down
+  fd_set rfds, wfds;
+  sock_t maxfd = 0;
+  
+  FD_ZERO(&rfds);
+  FD_ZERO(&wfds);
+  
+  if (mWakeFD[0] != NULL_SOCKET) {
+    FD_SET(mWakeFD[0], &rfds);
+    maxfd = mWakeFD[0];
+  }
+  
+  for (EntryMap::iterator it=mEntries.begin(); it!=mEntries.end(); ++it) {
+    Entry *e = it->second;
+    if (e->events & Read) {
+      FD_SET(e->fd, &rfds);
+    }
+    if ((e->events & Write) || e->flushing) {
+      FD_SET(e->fd, &wfds);
+    }
+    if (e->fd > maxfd) {
+      maxfd = e->fd;
+    }
+  }
+  
+  struct timeval tv;
+  struct timeval *ptv = 0;
+  
+  if (timeout >= 0) {
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    ptv = &tv;
+  }
+  
+  int n = ::select(int(maxfd + 1), &rfds, &wfds, 0, ptv);
+  
+  if (n == -1) {
+#ifndef _WIN32
+    if (errno == EINTR) {
+      return 0;
+    }
+#endif
+    throw Exception("Poller", "Could not wait for events.", true);
+  }
+
+#ifndef _WIN32
+  if (mWakeFD[0] != NULL_SOCKET && FD_ISSET(mWakeFD[0], &rfds)) {
+    char tmp[64];
+    while (::read(mWakeFD[0], tmp, sizeof(tmp)) > 0);
+  }
+#endif
+  
+  // handlers may add or remove entries, work on a snapshot
+  std::vector<Entry*> ready;
+  
+  for (EntryMap::iterator it=mEntries.begin(); it!=mEntries.end() && n>0; ++it) {
+    Entry *e = it->second;
+    if (FD_ISSET(e->fd, &rfds) || FD_ISSET(e->fd, &wfds)) {
+      ready.push_back(e);
+    }
+  }
+  
+  for (size_t i=0; i<ready.size(); ++i) {
+    Entry *e = ready[i];
+    if (e->dead) {
+      continue;
+    }
+    dispatch(e, FD_ISSET(e->fd, &rfds) != 0, FD_ISSET(e->fd, &wfds) != 0, false);
+    ++count;
+  }
+
+#endif
+  
+  // end of tick, send what handlers buffered
+  for (size_t i=0; i<mTouched.size(); ++i) {
+    Entry *e = mTouched[i];
+    if (!e->dead && e->conn->unflushed() > 0) {
+      flush(e);
+    }
+  }
+  mTouched.clear();
+  
+  if (mRing) {
+    rearm();
+  }
+  
+  purge();
+  
+  return count;
+}
+
+void Poller::run() GNET_THROWS(Exception) {
+  // stop() may be called before run() from another thread
+  while (!mStop) {
+#ifdef _WIN32
+    // no wakeup descriptor, check for stop request regularly
+    poll(100);
+#else
+    poll(-1);
+#endif
+  }
+  mStop = false;
+}
+
+void Poller::stop() {
+  mStop = true;
+  wakeup();
+}
+
+void Poller::wakeup() {
+#ifdef __linux__
+  uint64_t v = 1;
+  ssize_t rv = ::write(mWakeFD[1], &v, sizeof(v));
+  (void) rv;
+#elif !defined(_WIN32)
+  char c = 0;
+  ssize_t rv = ::write(mWakeFD[1], &c, 1);
+  (void) rv;
+#endif
+}
+
+// ---
+
+#ifdef GNET_URING
+
+void Poller::arm(Entry *e) GNET_THROWS(Exception) {
+  
+  if (e->dead) {
+    return;
+  }
+  
+  unsigned long long data = (unsigned long long) e;
+  struct io_uring_sqe *sqe;
+  
+  if (e->socket) {
+    if ((e->armed & (1 << OpAccept)) == 0) {
+      sqe = Prepare(mRing, IORING_OP_ACCEPT, e->fd, data | OpAccept);
+      sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+      sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+      e->armed |= (1 << OpAccept);
+    }
+    return;
+  }
+  
+  // descriptor released after the peer closed
+  if (!e->conn->isValid()) {
+    return;
+  }
+  
+  if ((e->events & Read) != 0 && !e->conn->mFedEnd) {
+    if (e->stream) {
+      if ((e->armed & (1 << OpRecv)) == 0) {
+        sqe = Prepare(mRing, IORING_OP_RECV, e->fd, data | OpRecv);
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        e->armed |= (1 << OpRecv);
+        e->conn->mFed = true;
+      }
+    } else if ((e->armed & (1 << OpPollIn)) == 0) {
+      // single shot, checks readiness when armed: level triggered
+      sqe = Prepare(mRing, IORING_OP_POLL_ADD, e->fd, data | OpPollIn);
+      sqe->poll32_events = POLLIN | POLLRDHUP;
+      e->armed |= (1 << OpPollIn);
+    }
+  }
+  
+  if (((e->events & Write) != 0 || e->flushing) && (e->armed & (1 << OpPollOut)) == 0) {
+    sqe = Prepare(mRing, IORING_OP_POLL_ADD, e->fd, data | OpPollOut);
+    sqe->poll32_events = POLLOUT;
+    e->armed |= (1 << OpPollOut);
+  }
+}
+
+void Poller::disarm(Entry *e, bool all) {
+  
+  int ops = (1 << OpAccept) | (1 << OpRecv) | (1 << OpPollIn);
+  if (all) {
+    ops |= (1 << OpPollOut);
+  }
+  
+  unsigned long long data = (unsigned long long) e;
+  
+  for (int op=OpAccept; op<=OpPollOut; ++op) {
+    if ((e->armed & ops & (1 << op)) != 0) {
+      mRing->cancel(data | op);
+    }
+  }
+  
+  // completions of cancelled requests, and what they received before
+  reap();
+  
+  if (e->conn && (all || (e->events & Read) == 0)) {
+    e->conn->mFed = false;
+  }
+}
+
+void Poller::reap() {
+  struct io_uring_cqe *cqe;
+  
+  while ((cqe = mRing->peek()) != 0) {
+    
+    unsigned long long data = cqe->user_data;
+    int res = cqe->res;
+    unsigned flags = cqe->flags;
+    
+    mRing->advance();
+    
+    int op = int(data & 7);
+    
+    if (op == OpWake) {
+      uint64_t v;
+      while (::read(mWakeFD[0], &v, sizeof(v)) > 0);
+      if ((flags & IORING_CQE_F_MORE) == 0) {
+        struct io_uring_sqe *sqe = Prepare(mRing, IORING_OP_POLL_ADD, mWakeFD[0], OpWake);
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+      }
+      continue;
+    }
+    
+    complete((Entry*) (data & ~7ULL), op, res, flags);
+  }
+}
+
+void Poller::complete(Entry *e, int op, int res, unsigned flags) {
+  
+  if ((flags & IORING_CQE_F_MORE) == 0) {
+    e->armed &= ~(1 << op);
+    if (!e->arming) {
+      e->arming = true;
+      mArm.push_back(e);
+    }
+  }
+  
+  switch (op) {
+  
+  case OpAccept:
+    if (res >= 0) {
+      e->socket->mAccepted.push_back(res);
+      e->ready |= Read;
+    }
+    // failures (aborted connection, out of descriptors) are left to re-arming
+    break;
+  
+  case OpRecv:
+    if ((flags & IORING_CQE_F_BUFFER) != 0) {
+      unsigned id = (flags >> IORING_CQE_BUFFER_SHIFT);
+      if (res > 0) {
+        e->conn->mInput.append(mRing->buffer(id), size_t(res));
+#if GNET_METRICS
+        e->conn->mStats.bytesIn += (unsigned long long) res;
+#endif
+        GNET_METRIC_ADD(BytesIn, (unsigned long long) res);
+        GNET_METRIC_RECORD(RecvSize, (unsigned long long) res);
+      }
+      mRing->recycle(id);
+    }
+    if (res >= 0) {
+      // 0 is the end of stream, reads will report it
+      e->conn->mFedEnd = (res == 0);
+      e->ready |= Read;
+    } else if (res != -ECANCELED && res != -ENOBUFS) {
+      e->conn->mFedEnd = true;
+      e->ready |= Closed;
+    }
+    break;
+  
+  case OpPollIn:
+    if (res > 0) {
+      if ((res & POLLIN) != 0) {
+        e->ready |= Read;
+      }
+      if ((res & (POLLHUP | POLLERR)) != 0 || ((res & POLLRDHUP) != 0 && (res & POLLIN) == 0)) {
+        e->ready |= Closed;
+      }
+    } else if (res < 0 && res != -ECANCELED) {
+      e->ready |= Closed;
+    }
+    break;
+  
+  case OpPollOut:
+    if (res > 0) {
+      if ((res & POLLOUT) != 0) {
+        e->ready |= Write;
+      }
+      if ((res & (POLLHUP | POLLERR)) != 0) {
+        e->ready |= Closed;
+      }
+    } else if (res < 0 && res != -ECANCELED) {
+      e->ready |= Closed;
+    }
+    break;
+  
+  default:
+    break;
+  }
+  
+  if (e->ready != 0) {
+    schedule(e);
+  }
+}
+
+void Poller::schedule(Entry *e) {
+  if (!e->queued) {
+    e->queued = true;
+    mReady.push_back(e);
+  }
+}
+
+int Poller::pollRing(int timeout) GNET_THROWS(Exception) {
+  
+  // don't wait if what handlers left behind must be dispatched again
+  mRing->enter(mReady.empty() ? timeout : 0);
+  
+  reap();
+  
+  int count = 0;
+  
+  // handlers may remove entries, completions then go to the next poll
+  std::vector<Entry*> ready;
+  ready.swap(mReady);
+  
+  for (size_t i=0; i<ready.size(); ++i) {
+    
+    Entry *e = ready[i];
+    int flags = e->ready;
+    
+    e->queued = false;
+    e->ready = 0;
+    
+    if (e->dead) {
+      continue;
+    }
+    
+    // Write may still be watched after it was dropped
+    bool writable = ((flags & Write) != 0 && ((e->events & Write) != 0 || e->flushing));
+    
+    if ((flags & Read) == 0 && (flags & Closed) == 0 && !writable) {
+      continue;
+    }
+    
+    size_t before = (e->socket ? e->socket->mAccepted.size() : e->conn->pending());
+    
+    dispatch(e, (flags & Read) != 0, writable, (flags & Closed) != 0);
+    ++count;
+    
+    if (e->dead || (e->conn && (!e->stream || (e->events & Read) == 0))) {
+      continue;
+    }
+    
+    // epoll would report the socket readable again for bytes or connections
+    // still in the system, ours are already received: handlers that made
+    // progress are called again
+    size_t after = (e->socket ? e->socket->mAccepted.size() : e->conn->pending());
+    
+    if (after > 0 && after < before) {
+      e->ready |= Read;
+      schedule(e);
+    }
+  }
+  
+  return count;
+}
+
+void Poller::rearm() GNET_THROWS(Exception) {
+  
+  for (size_t i=0; i<mArm.size(); ++i) {
+    mArm[i]->arming = false;
+    arm(mArm[i]);
+  }
+  mArm.clear();
+  
+  // about to be freed
+  size_t j = 0;
+  for (size_t i=0; i<mReady.size(); ++i) {
+    if (!mReady[i]->dead) {
+      mReady[j++] = mReady[i];
+    }
+  }
+  mReady.resize(j);
+}
+
+#else
+
+void Poller::arm(Entry *) GNET_THROWS(Exception) {
+}
+
+void Poller::disarm(Entry *, bool) {
+}
+
+void Poller::reap() {
+}
+
+void Poller::complete(Entry *, int, int, unsigned) {
+}
+
+void Poller::schedule(Entry *) {
+}
+
+int Poller::pollRing(int) GNET_THROWS(Exception) {
+  return 0;
+}
+
+void Poller::rearm() GNET_THROWS(Exception) {
+}
+
+#endif
+
+}
@@ -0,0 +1,226 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#include <gnet/pool.h>
+#include "internal.h"
+
+namespace gnet {
+
+ConnectionPool::ConnectionPool(size_t maxPerHost, int idleTimeout)
+  : mMaxPerHost(maxPerHost), mIdleTimeout(idleTimeout) {
+  memset(&mStats, 0, sizeof(Stats));
+}
+
+ConnectionPool::~ConnectionPool() {
+  clear();
+  // connections still acquired are closed along with their socket
+  for (ActiveMap::iterator it=mActive.begin(); it!=mActive.end(); ++it) {
+    delete it->second;
+  }
+  mActive.clear();
+}
+
+size_t ConnectionPool::evict(Entry &e, long long now) {
+  if (mIdleTimeout < 0) {
+    return 0;
+  }
+  
+  // oldest connections come first
+  size_t count = 0;
+  while (count < e.idle.size() && now - e.idle[count].since > mIdleTimeout) {
+    delete e.idle[count].socket;
+    ++count;
+  }
+  
+  if (count > 0) {
+    e.idle.erase(e.idle.begin(), e.idle.begin() + count);
+    mStats.evicted += count;
+    mStats.idle -= count;
+  }
+  
+  return count;
+}
+
+TCPConnection* ConnectionPool::checkout(Entry &e) {
+  while (!e.idle.empty()) {
+    Idle idle = e.idle.back();
+    e.idle.pop_back();
+    mStats.idle -= 1;
+    
+    // reject connections closed by peer, or with unsolicited data
+    if (idle.conn->pending() == 0 && idle.conn->isAlive() && !WaitFD(idle.conn->fd(), false, 0)) {
+      e.active += 1;
+      mActive[idle.conn] = idle.socket;
+      mStats.reused += 1;
+      mStats.active += 1;
+      return idle.conn;
+    }
+    
+    delete idle.socket;
+    mStats.stale += 1;
+  }
+  return 0;
+}
+
+TCPConnection* ConnectionPool::acquire(const Host &host, int timeout) GNET_THROWS(Exception) {
+  
+  long long deadline = Deadline(timeout);
+  
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+    
+    Entry &e = mEntries[host];
+    
+    evict(e, MonotonicTime());
+    
+    TCPConnection *conn = checkout(e);
+    if (conn) {
+      return conn;
+    }
+    
+    while (mMaxPerHost > 0 && e.active >= mMaxPerHost) {
+      if (deadline < 0) {
+        mReleased.wait(lock);
+      } else {
+        int remaining = Remaining(deadline);
+        if (remaining <= 0 ||
+            mReleased.wait_for(lock, std::chrono::milliseconds(remaining)) == std::cv_status::timeout) {
+          if (e.active >= mMaxPerHost) {
+            return NULL;
+          }
+        }
+      }
+      
+      // a connection may have been released in the meantime
+      conn = checkout(e);
+      if (conn) {
+        return conn;
+      }
+    }
+    
+    // reserve slot while connecting
+    e.active += 1;
+  }
+  
+  TCPSocket *socket = 0;
+  TCPConnection *conn = 0;
+  
+  try {
+    socket = new TCPSocket(host);
+    socket->setOptions(mOptions);
+    conn = socket->connect(Remaining(deadline));
+  } catch (Exception &) {
+    delete socket;
+    std::lock_guard<std::mutex> lock(mMutex);
+    mEntries[host].active -= 1;
+    mReleased.notify_all();
+    throw;
+  }
+  
+  std::lock_guard<std::mutex> lock(mMutex);
+  
+  if (conn == NULL) {
+    delete socket;
+    mEntries[host].active -= 1;
+    mReleased.notify_all();
+    return NULL;
+  }
+  
+  mActive[conn] = socket;
+  mStats.created += 1;
+  mStats.active += 1;
+  
+  return conn;
+}
+
+void ConnectionPool::release(TCPConnection *conn, bool reusable) {
+  if (!conn) {
+    return;
+  }
+  
+  std::lock_guard<std::mutex> lock(mMutex);
+  
+  ActiveMap::iterator it = mActive.find(conn);
+  
+  if (it == mActive.end()) {
+    return;
+  }
+  
+  TCPSocket *socket = it->second;
+  mActive.erase(it);
+  mStats.active -= 1;
+  
+  Entry &e = mEntries[conn->host()];
+  e.active -= 1;
+  
+  if (reusable && conn->isValid() && conn->pending() == 0) {
+    Idle idle;
+    idle.socket = socket;
+    idle.conn = conn;
+    idle.since = MonotonicTime();
+    e.idle.push_back(idle);
+    mStats.idle += 1;
+  } else {
+    delete socket;
+    mStats.discarded += 1;
+  }
+  
+  mReleased.notify_all();
+}
+
+size_t ConnectionPool::evict() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  
+  size_t count = 0;
+  long long now = MonotonicTime();
+  
+  for (EntryMap::iterator it=mEntries.begin(); it!=mEntries.end(); ++it) {
+    count += evict(it->second, now);
+  }
+  
+  return count;
+}
+
+void ConnectionPool::clear() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  
+  for (EntryMap::iterator it=mEntries.begin(); it!=mEntries.end(); ++it) {
+    std::vector<Idle> &idle = it->second.idle;
+    for (size_t i=0; i<idle.size(); ++i) {
+      delete idle[i].socket;
+    }
+    mStats.idle -= idle.size();
+    idle.clear();
+  }
+}
+
+ConnectionPool::Stats ConnectionPool::stats() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mStats;
+}
+
+void ConnectionPool::setOptions(const SocketOptions &options) {
+  mOptions = options;
+}
+
+}
@@ -0,0 +1,348 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#include <gnet/resolver.h>
+#include "internal.h"
+#include <sstream>
+#include <algorithm>
+
+namespace gnet {
+
+// lookups completed while cache holds more names than this clean it up
+static const size_t MaxCacheSize = 1024;
+
+static std::mutex gDefaultMutex;
+static Resolver *gDefault = 0;
+
+// ---
+
+namespace {
+  
+  class SyncHandler : public Resolver::Handler {
+    public:
+      
+      SyncHandler()
+        : done(false) {
+      }
+      
+      virtual void onResolved(Resolver &, const std::string &, const std::vector<Host> &h) {
+        std::lock_guard<std::mutex> lock(mutex);
+        hosts = h;
+        done = true;
+        cond.notify_one();
+      }
+      
+      virtual void onFailed(Resolver &, const std::string &, const std::string &reason) {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = reason;
+        done = true;
+        cond.notify_one();
+      }
+      
+      std::mutex mutex;
+      std::condition_variable cond;
+      bool done;
+      std::vector<Host> hosts;
+      std::string error;
+  };
+  
+}
+
+// ---
+
+Resolver::Handler::Handler() {
+}
+
+Resolver::Handler::~Handler() {
+}
+
+// ---
+
+Resolver::Resolver(size_t threads, int ttl, int negativeTTL)
+  : mNumThreads(threads > 0 ? threads : 1), mTTL(ttl), mNegativeTTL(negativeTTL), mStop(false) {
+}
+
+Resolver::~Resolver() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mWork.notify_all();
+  
+  // lookups in progress complete and notify their waiters
+  for (size_t i=0; i<mThreads.size(); ++i) {
+    mThreads[i].join();
+  }
+  
+  // names still queued are never looked up
+  PendingMap pending;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    pending.swap(mPending);
+    mQueue.clear();
+  }
+  
+  Entry e;
+  e.error = "Resolver shut down";
+  
+  for (PendingMap::iterator pit=pending.begin(); pit!=pending.end(); ++pit) {
+    for (size_t i=0; i<pit->second.size(); ++i) {
+      notify(pit->second[i], pit->first, e);
+    }
+  }
+}
+
+Resolver& Resolver::Default() {
+  std::lock_guard<std::mutex> lock(gDefaultMutex);
+  if (!gDefault) {
+    gDefault = new Resolver();
+  }
+  return *gDefault;
+}
+
+void ReleaseDefaultResolver() {
+  Resolver *r = 0;
+  {
+    std::lock_guard<std::mutex> lock(gDefaultMutex);
+    r = gDefault;
+    gDefault = 0;
+  }
+  // not locked: handlers failed by the destructor may call Default()
+  delete r;
+}
+
+bool Resolver::resolve(const std::string &name, unsigned short port, std::vector<Host> &hosts, int timeout) GNET_THROWS(Exception) {
+  
+  SyncHandler h;
+  
+  resolve(name, port, &h);
+  
+  std::unique_lock<std::mutex> lock(h.mutex);
+  
+  if (timeout < 0) {
+    while (!h.done) {
+      h.cond.wait(lock);
+    }
+    
+  } else if (!h.cond.wait_for(lock, std::chrono::milliseconds(timeout), [&h] { return h.done; })) {
+    lock.unlock();
+    if (cancel(name, &h)) {
+      return false;
+    }
+    // being notified, h must outlive the call
+    lock.lock();
+    while (!h.done) {
+      h.cond.wait(lock);
+    }
+  }
+  
+  if (h.hosts.empty()) {
+    throw Exception("Resolver", h.error);
+  }
+  
+  hosts.swap(h.hosts);
+  
+  return true;
+}
+
+void Resolver::resolve(const std::string &name, unsigned short port, Handler *handler) {
+  
+  Waiter w;
+  w.handler = handler;
+  w.port = port;
+  
+  std::unique_lock<std::mutex> lock(mMutex);
+  
+  if (mStop) {
+    lock.unlock();
+    Entry e;
+    e.error = "Resolver shut down";
+    notify(w, name, e);
+    return;
+  }
+  
+  Cache::iterator it = mCache.find(name);
+  
+  if (it != mCache.end()) {
+    if (it->second.expires > MonotonicTime()) {
+      Entry e = it->second;
+      lock.unlock();
+      notify(w, name, e);
+      return;
+    }
+    mCache.erase(it);
+  }
+  
+  PendingMap::iterator pit = mPending.find(name);
+  
+  if (pit != mPending.end()) {
+    // lookup already in progress
+    pit->second.push_back(w);
+    return;
+  }
+  
+  mPending[name].push_back(w);
+  mQueue.push_back(name);
+  
+  if (mThreads.empty()) {
+    for (size_t i=0; i<mNumThreads; ++i) {
+      mThreads.push_back(std::thread(&Resolver::run, this));
+    }
+  }
+  
+  mWork.notify_one();
+}
+
+bool Resolver::cancel(const std::string &name, Handler *handler) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  
+  PendingMap::iterator pit = mPending.find(name);
+  
+  if (pit != mPending.end()) {
+    std::vector<Waiter> &waiters = pit->second;
+    for (size_t i=0; i<waiters.size(); ++i) {
+      if (waiters[i].handler == handler) {
+        waiters.erase(waiters.begin() + i);
+        return true;
+      }
+    }
+  }
+  
+  return false;
+}
+
+void Resolver::clear() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mCache.clear();
+}
+
+void Resolver::run() {
+  
+  while (true) {
+    
+    std::string name;
+    
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      while (mQueue.empty() && !mStop) {
+        mWork.wait(lock);
+      }
+      if (mStop) {
+        return;
+      }
+      name = mQueue.front();
+      mQueue.pop_front();
+    }
+    
+    Entry e;
+    
+    lookup(name, e);
+    
+    std::vector<Waiter> waiters;
+    
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      
+      long long now = MonotonicTime();
+      int ttl = (e.hosts.empty() ? mNegativeTTL : mTTL);
+      
+      if (ttl > 0) {
+        if (mCache.size() >= MaxCacheSize) {
+          Cache::iterator it = mCache.begin();
+          while (it != mCache.end()) {
+            if (it->second.expires <= now) {
+              mCache.erase(it++);
+            } else {
+              ++it;
+            }
+          }
+        }
+        e.expires = now + ttl;
+        mCache[name] = e;
+      }
+      
+      PendingMap::iterator pit = mPending.find(name);
+      if (pit != mPending.end()) {
+        waiters.swap(pit->second);
+        mPending.erase(pit);
+      }
+    }
+    
+    for (size_t i=0; i<waiters.size(); ++i) {
+      notify(waiters[i], name, e);
+    }
+  }
+}
+
+void Resolver::lookup(const std::string &name, Entry &e) {
+  
+  struct addrinfo hints;
+  struct addrinfo *res = 0;
+  
+  memset(&hints, 0, sizeof(hints));
+  // all families, in system preference order (RFC 6724)
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  
+  int rv = getaddrinfo(name.c_str(), NULL, &hints, &res);
+  
+  if (rv != 0) {
+    std::ostringstream oss;
+    oss << "Could not resolve \"" << name << "\": " << gai_strerror(rv);
+    e.error = oss.str();
+    return;
+  }
+  
+  for (struct addrinfo *ai=res; ai!=NULL; ai=ai->ai_next) {
+    try {
+      Host h(ai->ai_addr, (socklen_t)ai->ai_addrlen);
+      if (std::find(e.hosts.begin(), e.hosts.end(), h) == e.hosts.end()) {
+        e.hosts.push_back(h);
+      }
+    } catch (Exception &) {
+      // unsupported address family
+    }
+  }
+  
+  freeaddrinfo(res);
+  
+  if (e.hosts.empty()) {
+    e.error = "Could not resolve \"" + name + "\": no usable address";
+  }
+}
+
+void Resolver::notify(const Waiter &w, const std::string &name, const Entry &e) {
+  if (e.hosts.empty()) {
+    w.handler->onFailed(*this, name, e.error);
+    
+  } else {
+    std::vector<Host> hosts;
+    hosts.reserve(e.hosts.size());
+    for (size_t i=0; i<e.hosts.size(); ++i) {
+      hosts.push_back(Host(e.hosts[i], w.port));
+    }
+    w.handler->onResolved(*this, name, hosts);
+  }
+}
+
+}
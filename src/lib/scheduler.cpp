@@ -0,0 +1,396 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+#include <gnet/scheduler.h>
+#include "internal.h"
+#include <cerrno>
+#ifdef __linux__
+# include <sys/epoll.h>
+#endif
+
+namespace gnet {
+
+#ifdef __linux__
+static const int MaxEvents = 256;
+#endif
+
+Scheduler::Scheduler() GNET_THROWS(Exception)
+  : mFD(-1), mNextId(0), mCalled(0), mStop(false) {
+#ifdef __linux__
+  mFD = epoll_create1(EPOLL_CLOEXEC);
+  if (mFD == -1) {
+    throw Exception("Scheduler", "Could not create epoll instance.", true);
+  }
+#endif
+}
+
+Scheduler::~Scheduler() {
+  for (WaitMap::iterator it=mWaits.begin(); it!=mWaits.end(); ++it) {
+    delete it->second;
+  }
+  for (size_t i=0; i<mDone.size(); ++i) {
+    delete mDone[i].wait;
+  }
+#ifdef __linux__
+  if (mFD != -1) {
+    ::close(mFD);
+  }
+#endif
+}
+
+long long Scheduler::Deadline(int timeout) {
+  return gnet::Deadline(timeout);
+}
+
+unsigned long Scheduler::wait(sock_t fd, bool write, long long deadline, Callback cb, void *data) GNET_THROWS(Exception) {
+  
+  Watch &watch = mWatches[fd];
+  Wait *&slot = (write ? watch.writer : watch.reader);
+  
+  if (slot) {
+    throw Exception("Scheduler", "Descriptor already waited on.");
+  }
+  
+  Wait *w = new Wait;
+  w->id = ++mNextId;
+  w->fd = fd;
+  w->write = write;
+  w->cb = cb;
+  w->data = data;
+  w->timed = (deadline >= 0);
+  
+  slot = w;
+  
+  try {
+    arm(fd, watch);
+  } catch (Exception &) {
+    slot = 0;
+    if (!watch.reader && !watch.writer) {
+      mWatches.erase(fd);
+    }
+    delete w;
+    throw;
+  }
+  
+  if (w->timed) {
+    w->timer = mTimers.insert(TimerMap::value_type(deadline, w));
+  }
+  
+  mWaits[w->id] = w;
+  
+  return w->id;
+}
+
+unsigned long Scheduler::at(long long deadline, Callback cb, void *data) {
+  Wait *w = new Wait;
+  w->id = ++mNextId;
+  w->fd = NULL_SOCKET;
+  w->write = false;
+  w->cb = cb;
+  w->data = data;
+  w->timed = true;
+  w->timer = mTimers.insert(TimerMap::value_type(deadline < 0 ? 0 : deadline, w));
+  
+  mWaits[w->id] = w;
+  
+  return w->id;
+}
+
+bool Scheduler::cancel(unsigned long id) {
+  WaitMap::iterator it = mWaits.find(id);
+  
+  if (it == mWaits.end()) {
+    return false;
+  }
+  
+  // a one shot registration left armed fires once, for nothing
+  complete(it->second, Cancelled);
+  
+  return true;
+}
+
+size_t Scheduler::count() const {
+  return mWaits.size();
+}
+
+void Scheduler::arm(sock_t fd, const Watch &watch) GNET_THROWS(Exception) {
+#ifdef __linux__
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  // one shot: nothing to undo once the wait completes, and a closed
+  // descriptor (automatically removed) reused by a new one is re-added
+  ev.events = EPOLLONESHOT;
+  if (watch.reader) {
+    ev.events |= EPOLLIN | EPOLLRDHUP;
+  }
+  if (watch.writer) {
+    ev.events |= EPOLLOUT;
+  }
+  ev.data.fd = fd;
+  
+  if (epoll_ctl(mFD, EPOLL_CTL_MOD, fd, &ev) == -1) {
+    if (errno != ENOENT || epoll_ctl(mFD, EPOLL_CTL_ADD, fd, &ev) == -1) {
+      throw Exception("Scheduler", "Could not register descriptor.", true);
+    }
+  }
+#else
+  (void) fd;
+  (void) watch;
+#endif
+}
+
+bool Scheduler::remove(unsigned long id) {
+  WaitMap::iterator it = mWaits.find(id);
+  
+  if (it != mWaits.end()) {
+    Wait *w = it->second;
+    detach(w);
+    delete w;
+    return true;
+  }
+  
+  // completed, not called back yet
+  for (size_t i=0; i<mDone.size(); ++i) {
+    if (mDone[i].wait->id == id) {
+      delete mDone[i].wait;
+      mDone.erase(mDone.begin() + i);
+      return true;
+    }
+  }
+  
+  // due later in the poll running the current callback
+  for (size_t i=mCalled+1; i<mCalling.size(); ++i) {
+    if (mCalling[i].wait && mCalling[i].wait->id == id) {
+      delete mCalling[i].wait;
+      mCalling[i].wait = 0;
+      return true;
+    }
+  }
+  
+  return false;
+}
+
+void Scheduler::detach(Wait *w) {
+  
+  mWaits.erase(w->id);
+  
+  if (w->timed) {
+    mTimers.erase(w->timer);
+  }
+  
+  if (w->fd != NULL_SOCKET) {
+    WatchMap::iterator it = mWatches.find(w->fd);
+    if (it != mWatches.end()) {
+      if (it->second.reader == w) {
+        it->second.reader = 0;
+      } else if (it->second.writer == w) {
+        it->second.writer = 0;
+      }
+      if (!it->second.reader && !it->second.writer) {
+        mWatches.erase(it);
+      }
+    }
+  }
+}
+
+void Scheduler::complete(Wait *w, Status status) {
+  
+  detach(w);
+  
+  Done d;
+  d.wait = w;
+  d.status = status;
+  mDone.push_back(d);
+}
+
+void Scheduler::ready(sock_t fd, bool readable, bool writable) GNET_THROWS(Exception) {
+  
+  WatchMap::iterator it = mWatches.find(fd);
+  
+  if (it == mWatches.end()) {
+    return;
+  }
+  
+  Wait *reader = it->second.reader;
+  Wait *writer = it->second.writer;
+  
+  if (readable && reader) {
+    complete(reader, Ready);
+    reader = 0;
+  }
+  if (writable && writer) {
+    complete(writer, Ready);
+    writer = 0;
+  }
+  
+  if (reader || writer) {
+    // one shot disabled the descriptor, the other direction still waits
+    Watch watch = {reader, writer};
+    arm(fd, watch);
+  }
+}
+
+size_t Scheduler::poll(int timeout) GNET_THROWS(Exception) {
+  
+  // callbacks are due (cancelled waits), don't block
+  if (!mDone.empty()) {
+    timeout = 0;
+  }
+  
+  if (!mTimers.empty()) {
+    int next = Remaining(mTimers.begin()->first);
+    if (timeout < 0 || next < timeout) {
+      timeout = next;
+    }
+  }
+
+#ifdef __linux__
+  
+  struct epoll_event events[MaxEvents];
+  
+  int n = epoll_wait(mFD, events, MaxEvents, (mWatches.empty() && timeout < 0 ? 0 : timeout));
+  
+  if (n == -1) {
+    if (errno != EINTR) {
+      throw Exception("Scheduler", "Could not wait for events.", true);
+    }
+    n = 0;
+  }
+  
+  for (int i=0; i<n; ++i) {
+    uint32_t flags = events[i].events;
+    // errors and hang ups complete both directions, the operation reports them
+    bool failed = ((flags & (EPOLLERR | EPOLLHUP)) != 0);
+    ready(events[i].data.fd,
+          failed || (flags & (EPOLLIN | EPOLLRDHUP)) != 0,
+          failed || (flags & EPOLLOUT) != 0);
+  }
+
+#else
+  
+  fd_set rfds, wfds, efds;
+  sock_t maxfd = 0;
+  
+  FD_ZERO(&rfds);
+  FD_ZERO(&wfds);
+  FD_ZERO(&efds);
+  
+  for (WatchMap::iterator it=mWatches.begin(); it!=mWatches.end(); ++it) {
+    if (it->second.reader) {
+      FD_SET(it->first, &rfds);
+    }
+    if (it->second.writer) {
+      FD_SET(it->first, &wfds);
+    }
+    FD_SET(it->first, &efds);
+    if (it->first > maxfd) {
+      maxfd = it->first;
+    }
+  }
+  
+  if (!mWatches.empty() || timeout >= 0) {
+    
+    struct timeval tv;
+    struct timeval *ptv = 0;
+    
+    if (timeout >= 0) {
+      tv.tv_sec = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+      ptv = &tv;
+    }
+    
+    int n = ::select(int(maxfd + 1), &rfds, &wfds, &efds, ptv);
+    
+    if (n == -1 && !Interrupted()) {
+      throw Exception("Scheduler", "Could not wait for events.", true);
+    }
+    
+    if (n > 0) {
+      // ready() changes the watches
+      std::vector<sock_t> fds;
+      for (WatchMap::iterator it=mWatches.begin(); it!=mWatches.end(); ++it) {
+        fds.push_back(it->first);
+      }
+      for (size_t i=0; i<fds.size(); ++i) {
+        bool failed = (FD_ISSET(fds[i], &efds) != 0);
+        ready(fds[i], failed || FD_ISSET(fds[i], &rfds), failed || FD_ISSET(fds[i], &wfds));
+      }
+    }
+  }
+
+#endif
+  
+  long long now = MonotonicTime();
+  
+  while (!mTimers.empty() && mTimers.begin()->first <= now) {
+    Wait *w = mTimers.begin()->second;
+    complete(w, (w->fd == NULL_SOCKET ? Ready : TimedOut));
+  }
+  
+  // callbacks may wait again, cancel or remove
+  mCalling.swap(mDone);
+  
+  size_t count = 0;
+  
+  for (mCalled=0; mCalled<mCalling.size(); ++mCalled) {
+    Wait *w = mCalling[mCalled].wait;
+    if (!w) {
+      // removed by an earlier callback
+      continue;
+    }
+    Callback cb = w->cb;
+    void *data = w->data;
+    Status status = mCalling[mCalled].status;
+    delete w;
+    mCalling[mCalled].wait = 0;
+    ++count;
+    try {
+      cb(data, status);
+    } catch (...) {
+      // hand the remaining ones to the next poll
+      for (size_t j=mCalled+1; j<mCalling.size(); ++j) {
+        if (mCalling[j].wait) {
+          mDone.push_back(mCalling[j]);
+        }
+      }
+      mCalling.clear();
+      throw;
+    }
+  }
+  
+  mCalling.clear();
+  
+  return count;
+}
+
+void Scheduler::run() GNET_THROWS(Exception) {
+  while (!mStop && (!mWaits.empty() || !mDone.empty())) {
+    poll(-1);
+  }
+  mStop = false;
+}
+
+void Scheduler::stop() {
+  mStop = true;
+}
+
+}
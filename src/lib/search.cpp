@@ -0,0 +1,200 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#include <gnet/search.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define GNET_SEARCH_SSE2
+# include <emmintrin.h>
+#endif
+
+#if defined(GNET_SEARCH_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define GNET_SEARCH_AVX2
+# include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+namespace gnet {
+
+// Candidate positions are the ones where both the first and the last byte
+// of the pattern match, the remaining bytes are then verified with memcmp.
+// This rejects most false positives a first byte only scan would report.
+
+static inline unsigned int FirstBit(unsigned int mask) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward(&idx, mask);
+  return (unsigned int) idx;
+#else
+  return (unsigned int) __builtin_ctz(mask);
+#endif
+}
+
+static size_t FindScalar(const char *data, size_t len, size_t from, const char *pattern, size_t plen) {
+  const char *cur = data + from;
+  const char *last = data + len - plen;
+  
+  while (cur <= last) {
+    if (last - cur >= 64) {
+      cur = (const char*) memchr(cur, pattern[0], last - cur + 1);
+      if (cur == 0) {
+        break;
+      }
+    } else if (cur[0] != pattern[0]) {
+      // not worth a memchr call for short tails
+      ++cur;
+      continue;
+    }
+    if (cur[plen-1] == pattern[plen-1] && memcmp(cur + 1, pattern + 1, plen - 2) == 0) {
+      return cur - data;
+    }
+    ++cur;
+  }
+  
+  return len;
+}
+
+#ifdef GNET_SEARCH_SSE2
+
+static size_t FindSSE2(const char *data, size_t len, size_t from, const char *pattern, size_t plen) {
+  const __m128i first = _mm_set1_epi8(pattern[0]);
+  const __m128i last = _mm_set1_epi8(pattern[plen-1]);
+  
+  size_t i = from;
+  
+  for (; i + plen - 1 + 16 <= len; i += 16) {
+    __m128i bf = _mm_loadu_si128((const __m128i*)(data + i));
+    __m128i bl = _mm_loadu_si128((const __m128i*)(data + i + plen - 1));
+    
+    unsigned int mask = (unsigned int) _mm_movemask_epi8(
+      _mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+    
+    while (mask != 0) {
+      unsigned int bit = FirstBit(mask);
+      if (memcmp(data + i + bit + 1, pattern + 1, plen - 2) == 0) {
+        return i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  
+  return FindScalar(data, len, i, pattern, plen);
+}
+
+#endif
+
+#ifdef GNET_SEARCH_AVX2
+
+__attribute__((target("avx2")))
+static size_t FindAVX2(const char *data, size_t len, const char *pattern, size_t plen) {
+  const __m256i first = _mm256_set1_epi8(pattern[0]);
+  const __m256i last = _mm256_set1_epi8(pattern[plen-1]);
+  
+  size_t i = 0;
+  
+  // skip 64 bytes at a time while there are no candidates
+  for (; i + plen - 1 + 64 <= len; i += 64) {
+    __m256i e0 = _mm256_and_si256(
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i)), first),
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i + plen - 1)), last));
+    __m256i e1 = _mm256_and_si256(
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i + 32)), first),
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i + 32 + plen - 1)), last));
+    
+    if (_mm256_testz_si256(_mm256_or_si256(e0, e1), _mm256_or_si256(e0, e1))) {
+      continue;
+    }
+    
+    for (int half=0; half<2; ++half) {
+      unsigned int mask = (unsigned int) _mm256_movemask_epi8(half == 0 ? e0 : e1);
+      size_t base = i + 32 * half;
+      while (mask != 0) {
+        unsigned int bit = FirstBit(mask);
+        if (memcmp(data + base + bit + 1, pattern + 1, plen - 2) == 0) {
+          return base + bit;
+        }
+        mask &= mask - 1;
+      }
+    }
+  }
+  
+  for (; i + plen - 1 + 32 <= len; i += 32) {
+    __m256i bf = _mm256_loadu_si256((const __m256i*)(data + i));
+    __m256i bl = _mm256_loadu_si256((const __m256i*)(data + i + plen - 1));
+    
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+      _mm256_and_si256(_mm256_cmpeq_epi8(bf, first), _mm256_cmpeq_epi8(bl, last)));
+    
+    while (mask != 0) {
+      unsigned int bit = FirstBit(mask);
+      if (memcmp(data + i + bit + 1, pattern + 1, plen - 2) == 0) {
+        return i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  
+  // finish with 16 bytes blocks
+  return FindSSE2(data, len, i, pattern, plen);
+}
+
+static bool HasAVX2() {
+  static bool avx2 = (__builtin_cpu_supports("avx2") != 0);
+  return avx2;
+}
+
+#endif
+
+size_t FindBytes(const char *data, size_t len, const char *pattern, size_t plen) {
+  
+  if (plen == 0) {
+    return 0;
+  }
+  
+  if (plen > len) {
+    return len;
+  }
+  
+  if (plen == 1) {
+    // memchr is already vectorized by the C library
+    const char *found = (const char*) memchr(data, pattern[0], len);
+    return (found ? size_t(found - data) : len);
+  }
+  
+#if defined(GNET_SEARCH_AVX2)
+  if (HasAVX2()) {
+    return FindAVX2(data, len, pattern, plen);
+  }
+#endif
+  
+#if defined(GNET_SEARCH_SSE2)
+  return FindSSE2(data, len, 0, pattern, plen);
+#else
+  return FindScalar(data, len, 0, pattern, plen);
+#endif
+}
+
+}
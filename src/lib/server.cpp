@@ -0,0 +1,713 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+
+#include <gnet/server.h>
+#include "internal.h"
+#include <algorithm>
+#include <chrono>
+
+namespace gnet {
+
+ShardedServer::ShardedServer(const Host &host, Poller::Handler *handler, size_t shards, int backlog)
+  : mHost(host), mHandler(handler), mNumShards(shards), mBacklog(backlog)
+  , mBackend(Poller::Default) {
+  
+#ifdef SO_REUSEPORT
+  if (mNumShards == 0) {
+    mNumShards = std::thread::hardware_concurrency();
+  }
+  if (mNumShards == 0) {
+    mNumShards = 1;
+  }
+#else
+  mNumShards = 1;
+#endif
+}
+
+ShardedServer::~ShardedServer() {
+  stop();
+}
+
+void ShardedServer::runShard(Shard *shard) {
+  try {
+    shard->poller->run();
+  } catch (Exception &) {
+    // shard goes down, others keep serving
+  }
+}
+
+void ShardedServer::setOptions(const SocketOptions &options) {
+  mOptions = options;
+}
+
+void ShardedServer::setBackend(Poller::Backend backend) {
+  mBackend = backend;
+}
+
+void ShardedServer::start() GNET_THROWS(Exception) {
+  
+  if (isRunning()) {
+    return;
+  }
+  
+  try {
+    
+    // bind all sockets first so that a failure leaves nothing running
+    for (size_t i=0; i<mNumShards; ++i) {
+      Shard *shard = new Shard();
+      shard->socket = 0;
+      shard->poller = 0;
+      mShards.push_back(shard);
+      
+      shard->socket = new TCPSocket(mHost);
+      shard->socket->setReuseAddress(true);
+      if (mNumShards > 1) {
+        shard->socket->setReusePort(true);
+      }
+      shard->socket->setOptions(mOptions);
+      shard->socket->bindAndListen(mBacklog);
+      // let handlers drain the accept queue with acceptBatch
+      shard->socket->setBlocking(false);
+      
+      shard->poller = new Poller(mBackend);
+      shard->poller->add(shard->socket, mHandler);
+    }
+    
+  } catch (Exception &) {
+    stop();
+    throw;
+  }
+  
+  for (size_t i=0; i<mShards.size(); ++i) {
+    mShards[i]->thread = std::thread(runShard, mShards[i]);
+  }
+}
+
+void ShardedServer::stop() {
+  
+  for (size_t i=0; i<mShards.size(); ++i) {
+    if (mShards[i]->poller) {
+      mShards[i]->poller->stop();
+    }
+  }
+  
+  for (size_t i=0; i<mShards.size(); ++i) {
+    Shard *shard = mShards[i];
+    if (shard->thread.joinable()) {
+      shard->thread.join();
+    }
+    // poller first, it references the socket connections
+    delete shard->poller;
+    delete shard->socket;
+    delete shard;
+  }
+  
+  mShards.clear();
+}
+
+bool ShardedServer::isRunning() const {
+  return (mShards.size() > 0);
+}
+
+size_t ShardedServer::shards() const {
+  return mNumShards;
+}
+
+TCPSocket* ShardedServer::socket(size_t shard) const {
+  return (shard < mShards.size() ? mShards[shard]->socket : 0);
+}
+
+Poller* ShardedServer::poller(size_t shard) const {
+  return (shard < mShards.size() ? mShards[shard]->poller : 0);
+}
+
+// ---
+
+TCPServer::Handler::Handler() {
+}
+
+TCPServer::Handler::~Handler() {
+}
+
+// ---
+
+TCPServer::TCPServer(const Host &host, Handler *handler, size_t workers, int backlog)
+  : mHost(host), mHandler(handler), mNumWorkers(workers), mBacklog(backlog)
+  , mIdleTimeout(-1), mBackend(Poller::Default), mSocket(0), mPoller(0), mAcceptor(0), mRunning(0)
+  , mDraining(false), mAcceptDone(false), mConnections(0) {
+  
+  if (mNumWorkers == 0) {
+    mNumWorkers = std::thread::hardware_concurrency();
+  }
+  if (mNumWorkers == 0) {
+    mNumWorkers = 1;
+  }
+}
+
+TCPServer::~TCPServer() {
+  stop();
+}
+
+void TCPServer::setIdleTimeout(int timeout) {
+  mIdleTimeout = timeout;
+}
+
+void TCPServer::setOptions(const SocketOptions &options) {
+  mOptions = options;
+}
+
+void TCPServer::setBackend(Poller::Backend backend) {
+  mBackend = backend;
+}
+
+bool TCPServer::isRunning() const {
+  return (mSocket != 0);
+}
+
+size_t TCPServer::workers() const {
+  return mNumWorkers;
+}
+
+size_t TCPServer::connections() const {
+  return mConnections;
+}
+
+void TCPServer::start() GNET_THROWS(Exception) {
+  
+  if (isRunning()) {
+    return;
+  }
+  
+  try {
+    mSocket = new TCPSocket(mHost);
+    mSocket->setReuseAddress(true);
+    mSocket->setOptions(mOptions);
+    mSocket->bindAndListen(mBacklog);
+    mSocket->setBlocking(false);
+    
+    mAcceptor = new Acceptor(this);
+    mPoller = new Poller(mBackend);
+    mPoller->add(mSocket, mAcceptor);
+    
+    for (size_t i=0; i<mNumWorkers; ++i) {
+      mWorkers.push_back(new Worker(this, i));
+      mWorkers[i]->poller = new Poller(mBackend);
+    }
+    
+  } catch (Exception &) {
+    for (size_t i=0; i<mWorkers.size(); ++i) {
+      delete mWorkers[i];
+    }
+    mWorkers.clear();
+    delete mPoller;
+    delete mAcceptor;
+    delete mSocket;
+    mPoller = 0;
+    mAcceptor = 0;
+    mSocket = 0;
+    throw;
+  }
+  
+  mDraining = false;
+  mAcceptDone = false;
+  mConnections = 0;
+  mRunning = mNumWorkers;
+  
+  for (size_t i=0; i<mNumWorkers; ++i) {
+    mWorkers[i]->thread = std::thread(&Worker::run, mWorkers[i]);
+  }
+  
+  mAcceptThread = std::thread(&TCPServer::acceptLoop, this);
+}
+
+void TCPServer::stop(int timeout) {
+  
+  if (!isRunning()) {
+    return;
+  }
+  
+  long long deadline = Deadline(timeout);
+  
+  mDraining = true;
+  mPoller->wakeup();
+  
+  if (mAcceptThread.joinable()) {
+    mAcceptThread.join();
+  }
+  
+  {
+    std::unique_lock<std::mutex> lock(mStopMutex);
+    
+    while (mRunning > 0) {
+      if (deadline < 0) {
+        mStopped.wait(lock);
+        continue;
+      }
+      
+      mStopped.wait_for(lock, std::chrono::milliseconds(Remaining(deadline)));
+      
+      if (mRunning > 0 && Remaining(deadline) == 0) {
+        lock.unlock();
+        // interrupt handlers still blocked on their connection, queued
+        // requests then fail right away
+        {
+          std::lock_guard<std::mutex> slock(mSocketMutex);
+          for (size_t i=0; i<mSocket->connectionCount(); ++i) {
+            TCPConnection *conn = mSocket->connectionAt(i);
+            if (conn->isValid()) {
+#ifdef _WIN32
+              ::shutdown(conn->fd(), SD_BOTH);
+#else
+              ::shutdown(conn->fd(), SHUT_RDWR);
+#endif
+            }
+          }
+        }
+        lock.lock();
+        deadline = -1;
+      }
+    }
+  }
+  
+  for (size_t i=0; i<mWorkers.size(); ++i) {
+    mWorkers[i]->thread.join();
+  }
+  for (size_t i=0; i<mWorkers.size(); ++i) {
+    delete mWorkers[i];
+  }
+  mWorkers.clear();
+  
+  // remaining connections are closed by the socket
+  delete mPoller;
+  delete mAcceptor;
+  delete mSocket;
+  mPoller = 0;
+  mAcceptor = 0;
+  mSocket = 0;
+  
+  mConnections = 0;
+}
+
+void TCPServer::close(TCPConnection *conn) {
+  std::lock_guard<std::mutex> lock(mSocketMutex);
+  mSocket->closeConnection(conn);
+  mConnections -= 1;
+}
+
+void TCPServer::balance(Worker *busy) {
+  for (size_t i=1; i<mWorkers.size(); ++i) {
+    Worker *w = mWorkers[(busy->index + i) % mWorkers.size()];
+    if (w->idle) {
+      w->poller->wakeup();
+      return;
+    }
+  }
+}
+
+// --- accept thread
+
+TCPServer::Acceptor::Acceptor(TCPServer *server)
+  : mServer(server) {
+}
+
+void TCPServer::Acceptor::onAccept(Poller &, TCPSocket *socket) {
+  std::vector<TCPConnection*> conns;
+  
+  try {
+    std::lock_guard<std::mutex> lock(mServer->mSocketMutex);
+    // bounded so that a connection storm doesn't delay the workers for long
+    socket->acceptBatch(conns, 64);
+  } catch (Exception &) {
+    // out of descriptors..., try again on next wakeup
+    return;
+  }
+  
+  std::vector<Worker*> &workers = mServer->mWorkers;
+  std::vector<bool> woken(workers.size(), false);
+  
+  for (size_t i=0; i<conns.size(); ++i) {
+    mServer->mConnections += 1;
+    
+    // least loaded worker
+    Worker *w = workers[0];
+    for (size_t j=1; j<workers.size(); ++j) {
+      if (workers[j]->count < w->count) {
+        w = workers[j];
+      }
+    }
+    
+    w->count += 1;
+    {
+      std::lock_guard<std::mutex> lock(w->mutex);
+      w->incoming.push_back(conns[i]);
+    }
+    woken[w->index] = true;
+  }
+  
+  for (size_t i=0; i<workers.size(); ++i) {
+    if (woken[i]) {
+      workers[i]->poller->wakeup();
+    }
+  }
+}
+
+void TCPServer::acceptLoop() {
+  
+  while (!mDraining) {
+    try {
+#ifdef _WIN32
+      // no wakeup descriptor, check for stop request regularly
+      mPoller->poll(100);
+#else
+      mPoller->poll(-1);
+#endif
+    } catch (Exception &) {
+      // keep accepting
+    }
+  }
+  
+  mPoller->remove(mSocket);
+  
+  // workers exit once the connections handed to them are closed
+  mAcceptDone = true;
+  for (size_t i=0; i<mWorkers.size(); ++i) {
+    mWorkers[i]->poller->wakeup();
+  }
+}
+
+// --- worker threads
+
+TCPServer::Worker::Worker(TCPServer *s, size_t i)
+  : server(s), index(i), poller(0), count(0), idle(false) {
+}
+
+TCPServer::Worker::~Worker() {
+  delete poller;
+}
+
+void TCPServer::Worker::onRead(Poller &p, Connection *conn) {
+  std::map<Connection*, Client*>::iterator it = clients.find(conn);
+  if (it == clients.end()) {
+    return;
+  }
+  
+  Client *c = it->second;
+  
+  std::lock_guard<std::mutex> lock(mutex);
+  
+  if (c->state == Client::Stolen) {
+    // the thief serves it, stop watching until it comes back
+    p.remove(conn);
+    c->detached = true;
+    return;
+  }
+  
+  // queued once the poll returns, stealing must wait for the end of the tick
+  c->state = Client::Queued;
+  ready.push_back(c);
+}
+
+void TCPServer::Worker::onClose(Poller &p, Connection *conn) {
+  std::map<Connection*, Client*>::iterator it = clients.find(conn);
+  if (it == clients.end()) {
+    return;
+  }
+  
+  Client *c = it->second;
+  
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (c->state == Client::Stolen) {
+      p.remove(conn);
+      c->detached = true;
+      return;
+    }
+    if (c->state != Client::Idle) {
+      // readable in the same tick, the handler sees the error
+      return;
+    }
+  }
+  
+  close(c);
+}
+
+void TCPServer::Worker::receive() {
+  std::vector<TCPConnection*> conns;
+  std::vector<Served> back;
+  
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    conns.swap(incoming);
+    back.swap(returned);
+  }
+  
+  long long now = MonotonicTime();
+  
+  for (size_t i=0; i<conns.size(); ++i) {
+    TCPConnection *conn = conns[i];
+    
+    if (server->mDraining) {
+      server->close(conn);
+      count -= 1;
+      continue;
+    }
+    
+    Client *c = new Client();
+    c->conn = conn;
+    c->owner = this;
+    c->state = Client::Idle;
+    c->last = now;
+    c->detached = false;
+    
+    try {
+      poller->add(conn, this);
+      clients[conn] = c;
+    } catch (Exception &) {
+      delete c;
+      server->close(conn);
+      count -= 1;
+    }
+  }
+  
+  for (size_t i=0; i<back.size(); ++i) {
+    served(back[i].client, back[i].keep);
+  }
+}
+
+TCPServer::Client* TCPServer::Worker::take() {
+  std::lock_guard<std::mutex> lock(mutex);
+  
+  if (queue.empty()) {
+    return 0;
+  }
+  
+  // oldest first
+  Client *c = queue.front();
+  queue.pop_front();
+  c->state = Client::Busy;
+  
+  return c;
+}
+
+TCPServer::Client* TCPServer::Worker::steal() {
+  std::vector<Worker*> &workers = server->mWorkers;
+  
+  for (size_t i=1; i<workers.size(); ++i) {
+    Worker *w = workers[(index + i) % workers.size()];
+    
+    // the ring receives on behalf of its own thread only
+    if (w->poller->backend() == Poller::IOUring) {
+      continue;
+    }
+    
+    std::lock_guard<std::mutex> lock(w->mutex);
+    
+    if (!w->queue.empty()) {
+      // newest first, the owner is about to serve the oldest ones
+      Client *c = w->queue.back();
+      w->queue.pop_back();
+      c->state = Client::Stolen;
+      return c;
+    }
+  }
+  
+  return 0;
+}
+
+void TCPServer::Worker::serve(Client *c) {
+  bool keep = false;
+  
+  try {
+    keep = server->mHandler->onRequest(*server, c->conn);
+    // buffered output goes out before the connection is handed back
+    if (!c->conn->flush()) {
+      keep = false;
+    }
+  } catch (Exception &) {
+    keep = false;
+  } catch (std::exception &) {
+    keep = false;
+  } catch (...) {
+    keep = false;
+  }
+  
+  if (c->owner == this) {
+    served(c, keep);
+    return;
+  }
+  
+  Worker *owner = c->owner;
+  Served s = {c, keep};
+  
+  {
+    std::lock_guard<std::mutex> lock(owner->mutex);
+    owner->returned.push_back(s);
+  }
+  
+  owner->poller->wakeup();
+}
+
+void TCPServer::Worker::served(Client *c, bool keep) {
+  c->last = MonotonicTime();
+  
+  if (!keep || server->mDraining || !c->conn->isValid()) {
+    close(c);
+    return;
+  }
+  
+  if (c->detached) {
+    try {
+      poller->add(c->conn, this);
+      c->detached = false;
+    } catch (Exception &) {
+      close(c);
+      return;
+    }
+  }
+  
+  std::lock_guard<std::mutex> lock(mutex);
+  
+  if (c->conn->pending() > 0) {
+    // next request already buffered, the poller won't report it
+    c->state = Client::Queued;
+    queue.push_back(c);
+  } else {
+    c->state = Client::Idle;
+  }
+}
+
+void TCPServer::Worker::close(Client *c) {
+  if (!c->detached) {
+    poller->remove(c->conn);
+  }
+  clients.erase(c->conn);
+  server->close(c->conn);
+  count -= 1;
+  delete c;
+}
+
+void TCPServer::Worker::sweep(long long now) {
+  std::vector<Client*> expired;
+  
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (std::map<Connection*, Client*>::iterator it=clients.begin(); it!=clients.end(); ++it) {
+      Client *c = it->second;
+      if (c->state == Client::Idle && (now < 0 || now - c->last > server->mIdleTimeout)) {
+        expired.push_back(c);
+      }
+    }
+  }
+  
+  for (size_t i=0; i<expired.size(); ++i) {
+    close(expired[i]);
+  }
+}
+
+void TCPServer::Worker::run() {
+  
+  bool draining = false;
+  long long nextSweep = 0;
+  int timeout = server->mIdleTimeout;
+  
+  // how often idle connections are checked for expiration
+  int interval = std::min(std::max(timeout / 4, 10), 1000);
+  
+  while (true) {
+    
+    // read before picking connections up: none can follow once it is set
+    bool acceptDone = server->mAcceptDone;
+    
+    receive();
+    
+    if (server->mDraining && !draining) {
+      sweep(-1);
+      draining = true;
+    }
+    
+    if (draining && acceptDone && clients.empty()) {
+      break;
+    }
+    
+    Client *c = take();
+    
+    if (!c) {
+      // balance() only wakes up idle workers, check other queues once idle
+      idle = true;
+      c = steal();
+    }
+    
+    if (c) {
+      idle = false;
+      serve(c);
+      continue;
+    }
+    
+    int wait = -1;
+    
+    if (!draining && timeout >= 0) {
+      long long now = MonotonicTime();
+      if (now >= nextSweep) {
+        sweep(now);
+        nextSweep = now + interval;
+      }
+      wait = interval;
+    }
+    
+#ifdef _WIN32
+    // no wakeup descriptor, check for work regularly
+    if (wait < 0 || wait > 100) {
+      wait = 100;
+    }
+#endif
+    
+    try {
+      poller->poll(wait);
+    } catch (Exception &) {
+      // keep serving
+    }
+    
+    idle = false;
+    
+    if (!ready.empty()) {
+      bool backlog = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i=0; i<ready.size(); ++i) {
+          queue.push_back(ready[i]);
+        }
+        backlog = (queue.size() > 1);
+      }
+      ready.clear();
+      if (backlog) {
+        server->balance(this);
+      }
+    }
+  }
+  
+  std::lock_guard<std::mutex> lock(server->mStopMutex);
+  server->mRunning -= 1;
+  server->mStopped.notify_all();
+}
+
+}
@@ -0,0 +1,508 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+#include <gnet/shm.h>
+#include <gnet/socket.h>
+#include "internal.h"
+
+#ifdef __linux__
+
+#include <atomic>
+#include <thread>
+#include <new>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+namespace gnet {
+
+static const uint32_t Magic = 0x676E6574; // 'gnet'
+static const uint32_t Version = 1;
+
+// polls of the ring before going to sleep (a few microseconds)
+static const int SpinCount = 256;
+
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// Producer and consumer positions are on separate cache lines so that each
+// side only writes its own
+
+struct ShmConnection::Ring {
+  // bytes written, updated by producer
+  std::atomic<uint64_t> head;
+  char pad0[64 - sizeof(std::atomic<uint64_t>)];
+  // bytes read, updated by consumer
+  std::atomic<uint64_t> tail;
+  char pad1[64 - sizeof(std::atomic<uint64_t>)];
+  // set by a side before sleeping on its eventfd
+  std::atomic<uint32_t> readerWaiting;
+  std::atomic<uint32_t> writerWaiting;
+  char pad2[64 - 2 * sizeof(std::atomic<uint32_t>)];
+};
+
+struct ShmConnection::Region {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+  std::atomic<uint32_t> closed[2];
+  char pad[64 - 2 * sizeof(uint32_t) - sizeof(uint64_t) - 2 * sizeof(std::atomic<uint32_t>)];
+  // ring i is written by side i, followed by ring data
+  Ring rings[2];
+};
+
+static void CloseAll(int *fds, size_t count) {
+  for (size_t i=0; i<count; ++i) {
+    if (fds[i] != -1) {
+      ::close(fds[i]);
+    }
+  }
+}
+
+ShmConnection* ShmConnection::Connect(UnixConnection *channel, size_t capacity, int timeout) GNET_THROWS(Exception) {
+  
+  size_t cap = 4096;
+  while (cap < capacity) {
+    cap <<= 1;
+  }
+  
+  size_t size = sizeof(Region) + 2 * cap;
+  
+  // memfd, wake up fd of side 0, wake up fd of side 1
+  int fds[3] = {-1, -1, -1};
+
+#ifdef SYS_memfd_create
+  fds[0] = int(::syscall(SYS_memfd_create, "gnet-shm", 1u)); // MFD_CLOEXEC
+#else
+  // older systems: anonymous file in the shared memory file system
+  char path[] = "/dev/shm/gnet-shm-XXXXXX";
+  fds[0] = ::mkstemp(path);
+  if (fds[0] != -1) {
+    ::unlink(path);
+  }
+#endif
+  fds[1] = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  fds[2] = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  
+  if (fds[0] == -1 || fds[1] == -1 || fds[2] == -1) {
+    CloseAll(fds, 3);
+    throw Exception("ShmConnection", "Could not create shared memory.", true);
+  }
+  
+  if (::ftruncate(fds[0], off_t(size)) != 0) {
+    CloseAll(fds, 3);
+    throw Exception("ShmConnection", "Could not size shared memory.", true);
+  }
+  
+  void *mapping = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+  
+  if (mapping == MAP_FAILED) {
+    CloseAll(fds, 3);
+    throw Exception("ShmConnection", "Could not map shared memory.", true);
+  }
+  
+  Region *region = new (mapping) Region();
+  region->magic = Magic;
+  region->version = Version;
+  region->capacity = cap;
+  
+  for (int i=0; i<2; ++i) {
+    region->closed[i].store(0);
+    region->rings[i].head.store(0);
+    region->rings[i].tail.store(0);
+    region->rings[i].readerWaiting.store(0);
+    region->rings[i].writerWaiting.store(0);
+  }
+  
+  long long deadline = Deadline(timeout);
+  
+  try {
+    for (int i=0; i<3; ++i) {
+      if (!channel->sendFD(fds[i], Remaining(deadline))) {
+        if (i > 0) {
+          // peer is left with a partial handshake
+          throw Exception("ShmConnection", "Handshake timed out.");
+        }
+        ::munmap(mapping, size);
+        CloseAll(fds, 3);
+        return NULL;
+      }
+    }
+  } catch (Exception &) {
+    ::munmap(mapping, size);
+    CloseAll(fds, 3);
+    throw;
+  }
+  
+  // the mapping keeps the memory alive
+  ::close(fds[0]);
+  
+  return new ShmConnection(0, mapping, size, fds[1], fds[2]);
+}
+
+ShmConnection* ShmConnection::Accept(UnixConnection *channel, int timeout) GNET_THROWS(Exception) {
+  
+  int fds[3] = {-1, -1, -1};
+  
+  long long deadline = Deadline(timeout);
+  
+  try {
+    for (int i=0; i<3; ++i) {
+      if (!channel->receiveFD(fds[i], Remaining(deadline))) {
+        if (i > 0) {
+          throw Exception("ShmConnection", "Handshake timed out.");
+        }
+        return NULL;
+      }
+    }
+  } catch (Exception &) {
+    CloseAll(fds, 3);
+    throw;
+  }
+  
+  struct stat st;
+  
+  if (::fstat(fds[0], &st) != 0 || size_t(st.st_size) < sizeof(Region)) {
+    CloseAll(fds, 3);
+    throw Exception("ShmConnection", "Invalid shared memory.");
+  }
+  
+  size_t size = size_t(st.st_size);
+  
+  void *mapping = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+  
+  ::close(fds[0]);
+  
+  if (mapping == MAP_FAILED) {
+    CloseAll(fds+1, 2);
+    throw Exception("ShmConnection", "Could not map shared memory.", true);
+  }
+  
+  Region *region = (Region*) mapping;
+  
+  if (region->magic != Magic || region->version != Version || sizeof(Region) + 2 * size_t(region->capacity) != size) {
+    ::munmap(mapping, size);
+    CloseAll(fds+1, 2);
+    throw Exception("ShmConnection", "Invalid shared memory.");
+  }
+  
+  return new ShmConnection(1, mapping, size, fds[2], fds[1]);
+}
+
+ShmConnection::ShmConnection()
+  : mSide(0), mRegion(0), mSize(0), mCapacity(0), mTx(0), mRx(0), mTxData(0), mRxData(0), mPeerFD(NULL_SOCKET) {
+}
+
+ShmConnection::ShmConnection(int side, void *mapping, size_t size, sock_t wakeFD, sock_t peerFD)
+  : Connection(wakeFD), mSide(side), mRegion((Region*) mapping), mSize(size), mPeerFD(peerFD) {
+  
+  char *data = (char*) mapping + sizeof(Region);
+  
+  mCapacity = size_t(mRegion->capacity);
+  mTx = &(mRegion->rings[side]);
+  mRx = &(mRegion->rings[1 - side]);
+  mTxData = data + side * mCapacity;
+  mRxData = data + (1 - side) * mCapacity;
+}
+
+ShmConnection::~ShmConnection() {
+  if (mRegion) {
+    mRegion->closed[mSide].store(1);
+    notify(0);
+    ::munmap(mRegion, mSize);
+  }
+  if (mFD != NULL_SOCKET) {
+    ::close(mFD);
+  }
+  if (mPeerFD != NULL_SOCKET) {
+    ::close(mPeerFD);
+  }
+}
+
+bool ShmConnection::isAlive() const {
+  return (isValid() && mRegion->closed[1 - mSide].load() == 0);
+}
+
+void ShmConnection::notify(const void *flag) {
+  // flag is NULL to wake peer up unconditionally
+  if (flag == 0 || ((const std::atomic<uint32_t>*) flag)->load() != 0) {
+    uint64_t one = 1;
+    ssize_t rv = ::write(mPeerFD, &one, sizeof(one));
+    (void) rv;
+  }
+}
+
+size_t ShmConnection::pull(char *p0, size_t l0, char *p1, size_t l1) {
+  uint64_t tail = mRx->tail.load(std::memory_order_relaxed);
+  uint64_t head = mRx->head.load(std::memory_order_acquire);
+  
+  size_t avail = size_t(head - tail);
+  size_t n = 0;
+  size_t mask = mCapacity - 1;
+  
+  char *dst[2] = {p0, p1};
+  size_t len[2] = {l0, l1};
+  
+  for (int i=0; i<2 && avail > 0; ++i) {
+    size_t count = (len[i] < avail ? len[i] : avail);
+    size_t offset = size_t(tail + n) & mask;
+    size_t first = (count < mCapacity - offset ? count : mCapacity - offset);
+    
+    memcpy(dst[i], mRxData + offset, first);
+    memcpy(dst[i] + first, mRxData, count - first);
+    
+    n += count;
+    avail -= count;
+  }
+  
+  if (n > 0) {
+    // sequentially consistent so that it is ordered with the load of writerWaiting
+    mRx->tail.store(tail + n);
+    notify(&(mRx->writerWaiting));
+  }
+  
+  return n;
+}
+
+size_t ShmConnection::push(const char *bytes, size_t len) {
+  uint64_t head = mTx->head.load(std::memory_order_relaxed);
+  uint64_t tail = mTx->tail.load(std::memory_order_acquire);
+  
+  size_t space = mCapacity - size_t(head - tail);
+  size_t n = (len < space ? len : space);
+  
+  if (n > 0) {
+    size_t offset = size_t(head) & (mCapacity - 1);
+    size_t first = (n < mCapacity - offset ? n : mCapacity - offset);
+    
+    memcpy(mTxData + offset, bytes, first);
+    memcpy(mTxData, bytes + first, n - first);
+    
+    mTx->head.store(head + n);
+    notify(&(mTx->readerWaiting));
+  }
+  
+  return n;
+}
+
+bool ShmConnection::wait(bool space, long long deadline) GNET_THROWS(Exception) {
+  Ring *ring = (space ? mTx : mRx);
+  
+  // spinning on a single processor only delays the peer
+  static const int spins = (std::thread::hardware_concurrency() > 1 ? SpinCount : 0);
+  
+  for (int i=0; i<spins; ++i) {
+    if (space ? (ring->head.load(std::memory_order_relaxed) - ring->tail.load() < mCapacity)
+              : (ring->head.load() != ring->tail.load(std::memory_order_relaxed))) {
+      return true;
+    }
+    if (mRegion->closed[1 - mSide].load() != 0) {
+      break;
+    }
+    CpuRelax();
+  }
+  
+  std::atomic<uint32_t> &flag = (space ? ring->writerWaiting : ring->readerWaiting);
+  
+  bool ready = false;
+  
+  flag.store(1);
+  
+  while (true) {
+    // checked after flag is set: either the peer sees the flag, or we see its update
+    if (space ? (ring->head.load(std::memory_order_relaxed) - ring->tail.load() < mCapacity)
+              : (ring->head.load() != ring->tail.load(std::memory_order_relaxed))) {
+      ready = true;
+      break;
+    }
+    
+    if (mRegion->closed[1 - mSide].load() != 0) {
+      // only once all bytes it sent have been read
+      flag.store(0);
+      throw Exception("ShmConnection", "Connection was remotely closed.");
+    }
+    
+    if (!WaitFD(mFD, false, Remaining(deadline))) {
+      break;
+    }
+    
+    uint64_t count;
+    ssize_t rv = ::read(mFD, &count, sizeof(count));
+    (void) rv;
+  }
+  
+  flag.store(0);
+  
+  return ready;
+}
+
+size_t ShmConnection::receiveBytes(char *p0, size_t l0, char *p1, size_t l1, int timeout) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("ShmConnection", "Invalid connection.");
+  }
+  
+  long long deadline = Deadline(timeout);
+  
+  while (true) {
+    size_t n = pull(p0, l0, p1, l1);
+    if (n > 0) {
+      return n;
+    }
+    if (timeout == 0 || !wait(false, deadline)) {
+      return 0;
+    }
+  }
+}
+
+bool ShmConnection::fill(int timeout) GNET_THROWS(Exception) {
+  if (mInput.full()) {
+    mInput.reserve(mInput.capacity() + mBufferSize);
+  }
+  
+  char *p0, *p1;
+  size_t l0, l1;
+  
+  mInput.writable(p0, l0, p1, l1);
+  
+  size_t n = receiveBytes(p0, l0, p1, l1, timeout);
+  
+  mInput.commit(n);
+  
+  return (n > 0);
+}
+
+size_t ShmConnection::fill(char *bytes, size_t len, bool waitAll, int timeout) GNET_THROWS(Exception) {
+  long long deadline = Deadline(timeout);
+  
+  size_t n = receiveBytes(bytes, len, 0, 0, timeout);
+  
+  while (waitAll && n > 0 && n < len) {
+    size_t rv = receiveBytes(bytes + n, len - n, 0, 0, Remaining(deadline));
+    if (rv == 0) {
+      break;
+    }
+    n += rv;
+  }
+  
+  return n;
+}
+
+bool ShmConnection::write(const char *bytes, size_t len, int timeout) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("ShmConnection", "Invalid connection.");
+  }
+  
+  if (mRegion->closed[1 - mSide].load() != 0) {
+    throw Exception("ShmConnection", "Connection was remotely closed.");
+  }
+  
+  long long deadline = Deadline(timeout);
+  
+  if (!drain(timeout != 0, deadline)) {
+    mOutput.append(bytes, len);
+    return false;
+  }
+  
+  size_t offset = 0;
+  
+  while (offset < len) {
+    size_t n = push(bytes + offset, len - offset);
+    
+    if (n > 0) {
+      offset += n;
+      continue;
+    }
+    
+    if (timeout == 0 || !wait(true, deadline)) {
+      // keep the rest for the next write or flush, the stream stays consistent
+      mOutput.append(bytes + offset, len - offset);
+      return false;
+    }
+  }
+  
+  return true;
+}
+
+size_t ShmConnection::writeSome(const char *bytes, size_t len) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("ShmConnection", "Invalid connection.");
+  }
+  
+  if (mRegion->closed[1 - mSide].load() != 0) {
+    throw Exception("ShmConnection", "Connection was remotely closed.");
+  }
+  
+  if (!drain(false, 0)) {
+    return 0;
+  }
+  
+  return push(bytes, len);
+}
+
+bool ShmConnection::flush(int timeout) GNET_THROWS(Exception) {
+  if (mOutput.empty()) {
+    return true;
+  }
+  
+  if (!isValid()) {
+    throw Exception("ShmConnection", "Invalid connection.");
+  }
+  
+  return drain(timeout != 0, Deadline(timeout));
+}
+
+size_t ShmConnection::unflushed() const {
+  return mOutput.size();
+}
+
+bool ShmConnection::drain(bool block, long long deadline) GNET_THROWS(Exception) {
+  while (!mOutput.empty()) {
+    size_t len = 0;
+    const char *bytes = mOutput.front(len);
+    size_t n = push(bytes, len);
+    
+    if (n > 0) {
+      mOutput.consume(n);
+      continue;
+    }
+    
+    if (!block || !wait(true, deadline)) {
+      return false;
+    }
+  }
+  
+  return true;
+}
+}
+
+#endif
@@ -22,22 +22,212 @@ USA.
 */
 
 #include <gnet/socket.h>
+#include "internal.h"
 #include <exception>
 #include <sstream>
 #include <algorithm>
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/uio.h>
+# include <sys/un.h>
+# include <stddef.h>
+# include <netinet/tcp.h>
+#endif
+#ifdef __linux__
+# include <netinet/udp.h>
+# ifndef TCP_FASTOPEN_CONNECT
+#   define TCP_FASTOPEN_CONNECT 30
+# endif
+# ifndef SO_BUSY_POLL
+#   define SO_BUSY_POLL 46
+# endif
+# ifndef SOL_UDP
+#   define SOL_UDP 17
+# endif
+# ifndef UDP_SEGMENT
+#   define UDP_SEGMENT 103
+# endif
+# ifndef UDP_GRO
+#   define UDP_GRO 104
+# endif
+#endif
 
 namespace gnet {
+
+static void SetOption(sock_t fd, int level, int name, int value, const char *label) GNET_THROWS(Exception) {
+  if (::setsockopt(fd, level, name, (const char*)&value, sizeof(value)) != 0) {
+    throw Exception("SocketOptions", std::string("Could not set ") + label + ".", true);
+  }
+}
+
+static int GetOption(sock_t fd, int level, int name) {
+  int value = 0;
+  socklen_t len = sizeof(value);
+  if (::getsockopt(fd, level, name, (char*)&value, &len) != 0) {
+    return SocketOptions::Default;
+  }
+  return value;
+}
+
+static inline void Unsupported(const char *label) GNET_THROWS(Exception) {
+  throw Exception("SocketOptions", std::string(label) + " not supported.");
+}
+
+SocketOptions::SocketOptions()
+  : noDelay(Default), receiveBuffer(Default), sendBuffer(Default)
+  , keepAlive(Default), keepAliveIdle(Default), keepAliveInterval(Default), keepAliveCount(Default)
+  , fastOpen(Default), deferAccept(Default), quickAck(Default), busyPoll(Default) {
+}
+
+void SocketOptions::apply(sock_t fd, Stage stage) const GNET_THROWS(Exception) {
+  
+  if (stage == Listening) {
+    if (fastOpen != Default) {
+#ifdef TCP_FASTOPEN
+      SetOption(fd, IPPROTO_TCP, TCP_FASTOPEN, fastOpen, "TCP_FASTOPEN");
+#else
+      Unsupported("TCP_FASTOPEN");
+#endif
+    }
+    if (deferAccept != Default) {
+#ifdef TCP_DEFER_ACCEPT
+      SetOption(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, deferAccept, "TCP_DEFER_ACCEPT");
+#else
+      Unsupported("TCP_DEFER_ACCEPT");
+#endif
+    }
+    return;
+  }
+  
+  if (stage == Connecting) {
+    if (fastOpen != Default) {
+#ifdef __linux__
+      int on = (fastOpen > 0 ? 1 : 0);
+      // can only be changed before the first connect call, which may be resumed
+      if (GetOption(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT) != on) {
+        SetOption(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, on, "TCP_FASTOPEN_CONNECT");
+      }
+#else
+      Unsupported("TCP_FASTOPEN_CONNECT");
+#endif
+    }
+    return;
+  }
+
+#ifdef __linux__
+  if (stage == Accepted) {
+    // everything else is inherited from the listening socket
+    if (quickAck != Default) {
+      SetOption(fd, IPPROTO_TCP, TCP_QUICKACK, quickAck, "TCP_QUICKACK");
+    }
+    return;
+  }
+#endif
+  
+  if (noDelay != Default) {
+    SetOption(fd, IPPROTO_TCP, TCP_NODELAY, noDelay, "TCP_NODELAY");
+  }
+  if (receiveBuffer != Default) {
+    SetOption(fd, SOL_SOCKET, SO_RCVBUF, receiveBuffer, "SO_RCVBUF");
+  }
+  if (sendBuffer != Default) {
+    SetOption(fd, SOL_SOCKET, SO_SNDBUF, sendBuffer, "SO_SNDBUF");
+  }
+  if (keepAlive != Default) {
+    SetOption(fd, SOL_SOCKET, SO_KEEPALIVE, keepAlive, "SO_KEEPALIVE");
+  }
+  if (keepAliveIdle != Default) {
+#if defined(TCP_KEEPIDLE)
+    SetOption(fd, IPPROTO_TCP, TCP_KEEPIDLE, keepAliveIdle, "TCP_KEEPIDLE");
+#elif defined(TCP_KEEPALIVE)
+    // darwin name
+    SetOption(fd, IPPROTO_TCP, TCP_KEEPALIVE, keepAliveIdle, "TCP_KEEPALIVE");
+#else
+    Unsupported("TCP_KEEPIDLE");
+#endif
+  }
+  if (keepAliveInterval != Default) {
+#ifdef TCP_KEEPINTVL
+    SetOption(fd, IPPROTO_TCP, TCP_KEEPINTVL, keepAliveInterval, "TCP_KEEPINTVL");
+#else
+    Unsupported("TCP_KEEPINTVL");
+#endif
+  }
+  if (keepAliveCount != Default) {
+#ifdef TCP_KEEPCNT
+    SetOption(fd, IPPROTO_TCP, TCP_KEEPCNT, keepAliveCount, "TCP_KEEPCNT");
+#else
+    Unsupported("TCP_KEEPCNT");
+#endif
+  }
+  if (quickAck != Default) {
+#ifdef TCP_QUICKACK
+    SetOption(fd, IPPROTO_TCP, TCP_QUICKACK, quickAck, "TCP_QUICKACK");
+#else
+    Unsupported("TCP_QUICKACK");
+#endif
+  }
+  if (busyPoll != Default) {
+#ifdef __linux__
+    SetOption(fd, SOL_SOCKET, SO_BUSY_POLL, busyPoll, "SO_BUSY_POLL");
+#else
+    Unsupported("SO_BUSY_POLL");
+#endif
+  }
+}
+
+SocketOptions SocketOptions::Read(sock_t fd) {
+  SocketOptions o;
+  
+  o.noDelay = GetOption(fd, IPPROTO_TCP, TCP_NODELAY);
+  o.receiveBuffer = GetOption(fd, SOL_SOCKET, SO_RCVBUF);
+  o.sendBuffer = GetOption(fd, SOL_SOCKET, SO_SNDBUF);
+  o.keepAlive = GetOption(fd, SOL_SOCKET, SO_KEEPALIVE);
+#if defined(TCP_KEEPIDLE)
+  o.keepAliveIdle = GetOption(fd, IPPROTO_TCP, TCP_KEEPIDLE);
+#elif defined(TCP_KEEPALIVE)
+  o.keepAliveIdle = GetOption(fd, IPPROTO_TCP, TCP_KEEPALIVE);
+#endif
+#ifdef TCP_KEEPINTVL
+  o.keepAliveInterval = GetOption(fd, IPPROTO_TCP, TCP_KEEPINTVL);
+#endif
+#ifdef TCP_KEEPCNT
+  o.keepAliveCount = GetOption(fd, IPPROTO_TCP, TCP_KEEPCNT);
+#endif
+#ifdef TCP_FASTOPEN
+  o.fastOpen = GetOption(fd, IPPROTO_TCP, TCP_FASTOPEN);
+#endif
+#ifdef __linux__
+  if (o.fastOpen == 0 || o.fastOpen == Default) {
+    int client = GetOption(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT);
+    if (client != Default) {
+      o.fastOpen = client;
+    }
+  }
+  o.busyPoll = GetOption(fd, SOL_SOCKET, SO_BUSY_POLL);
+#endif
+#ifdef TCP_DEFER_ACCEPT
+  o.deferAccept = GetOption(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT);
+#endif
+#ifdef TCP_QUICKACK
+  o.quickAck = GetOption(fd, IPPROTO_TCP, TCP_QUICKACK);
+#endif
   
-Socket::Socket(unsigned short port) throw(Exception)
-  : mFD(NULL_SOCKET), mHost("localhost", port) {
+  return o;
+}
+
+// ---
+
+Socket::Socket(unsigned short port) GNET_THROWS(Exception)
+  : mFD(NULL_SOCKET), mHost("127.0.0.1", port), mBlocking(true) {
 }
 
-Socket::Socket(const Host &host) throw(Exception)
-  : mFD(NULL_SOCKET), mHost(host) {
+Socket::Socket(const Host &host) GNET_THROWS(Exception)
+  : mFD(NULL_SOCKET), mHost(host), mBlocking(true) {
 }
 
 Socket::Socket(sock_t fd, const Host &host)
-  : mFD(fd), mHost(host) {
+  : mFD(fd), mHost(host), mBlocking(true) {
 }
 
 Socket::~Socket() {
@@ -47,11 +237,31 @@ bool Socket::isValid() const {
   return (mFD != NULL_SOCKET);
 }
 
+void Socket::setBlocking(bool blocking) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("Socket", "Invalid socket.");
+  }
+  if (blocking != mBlocking) {
+    if (!SetBlocking(mFD, blocking)) {
+      throw Exception("Socket", "Could not change blocking mode.", true);
+    }
+    mBlocking = blocking;
+  }
+}
+
+void Socket::setOptions(const SocketOptions &options) GNET_THROWS(Exception) {
+  mOptions = options;
+  if (isValid()) {
+    mOptions.apply(mFD, SocketOptions::Created);
+  }
+}
+
 void Socket::invalidate() {
   mFD = NULL_SOCKET;
 }
 
-Socket::Socket() {
+Socket::Socket()
+  : mFD(NULL_SOCKET), mBlocking(true) {
 }
 
 Socket::Socket(const Socket&) {
@@ -63,115 +273,1236 @@ Socket& Socket::operator=(const Socket&) {
 
 // ---
 
-TCPSocket::TCPSocket(unsigned short port) throw(Exception)
-  : Socket(port) {
-  mFD = ::socket(AF_INET, SOCK_STREAM, 0);
+// no free slot
+static const unsigned int NoSlot = ~0u;
+
+TCPSocket::TCPSocket(unsigned short port) GNET_THROWS(Exception)
+  : Socket(port), mFreeSlot(NoSlot) {
+  mFD = ::socket(mHost.family(), SOCK_STREAM, 0);
 }
 
-TCPSocket::TCPSocket(const Host &host) throw(Exception)
-  : Socket(host) {
-  mFD = ::socket(AF_INET, SOCK_STREAM, 0);
+TCPSocket::TCPSocket(const Host &host) GNET_THROWS(Exception)
+  : Socket(host), mFreeSlot(NoSlot) {
+  mFD = ::socket(mHost.family(), SOCK_STREAM, 0);
 }
 
 TCPSocket::~TCPSocket() {
   
-  for (size_t i=0; i<mConnections.size(); ++i) {
-    delete mConnections[i];
+  for (size_t i=0; i<mLive.size(); ++i) {
+    delete mSlots[mLive[i]].conn;
   }
-  mConnections.clear();
+  mLive.clear();
+  mSlots.clear();
+  mFDSlots.clear();
+  mConnSlots.clear();
+  
+  for (size_t i=0; i<mAccepted.size(); ++i) {
+    CloseFD(mAccepted[i]);
+  }
+  mAccepted.clear();
   
   if (isValid()) {
-#ifdef _WIN32
-    closesocket(mFD);
+    CloseFD(mFD);
+  }
+}
+
+void TCPSocket::setReuseAddress(bool on) GNET_THROWS(Exception) {
+  int val = (on ? 1 : 0);
+  if (::setsockopt(mFD, SOL_SOCKET, SO_REUSEADDR, (const char*)&val, sizeof(val)) != 0) {
+    throw Exception("TCPSocket", "Could not set SO_REUSEADDR.", true);
+  }
+}
+
+void TCPSocket::setReusePort(bool on) GNET_THROWS(Exception) {
+#ifdef SO_REUSEPORT
+  int val = (on ? 1 : 0);
+  if (::setsockopt(mFD, SOL_SOCKET, SO_REUSEPORT, (const char*)&val, sizeof(val)) != 0) {
+    throw Exception("TCPSocket", "Could not set SO_REUSEPORT.", true);
+  }
 #else
-    ::close(mFD);
-#endif
+  if (on) {
+    throw Exception("TCPSocket", "SO_REUSEPORT not supported.");
   }
+#endif
 }
 
-void TCPSocket::bind() throw(Exception) {
-  if (::bind(mFD, mHost, sizeof(struct sockaddr)) < 0) {
+void TCPSocket::bind() GNET_THROWS(Exception) {
+  if (::bind(mFD, mHost, mHost.length()) < 0) {
     throw Exception("TCPSocket", "Could not bind socket.", true);
   }
 }
 
-void TCPSocket::listen(int maxConnections) throw(Exception) {
+void TCPSocket::listen(int maxConnections) GNET_THROWS(Exception) {
+  mOptions.apply(mFD, SocketOptions::Listening);
   if (::listen(mFD, maxConnections) == -1) {
     throw Exception("TCPSocket", "Cannot listen on socket.", true);
   }
   mMaxConnections = maxConnections;
 }
 
-void TCPSocket::bindAndListen(int maxConnections) throw(Exception) {
+void TCPSocket::bindAndListen(int maxConnections) GNET_THROWS(Exception) {
   this->bind();
   this->listen(maxConnections);
 }
 
 void TCPSocket::closeConnection(TCPConnection *conn) {
+  std::unordered_map<const TCPConnection*, unsigned int>::const_iterator it = mConnSlots.find(conn);
+  if (it != mConnSlots.end()) {
+    ConnectionHandle handle;
+    handle.index = it->second;
+    handle.generation = mSlots[it->second].generation;
+    closeConnection(handle);
+  }
+}
+
+void TCPSocket::closeConnection(const ConnectionHandle &handle) {
+  TCPConnection *conn = connection(handle);
+  
   if (conn) {
     
-    std::vector<TCPConnection*>::iterator it =
-      std::find(mConnections.begin(), mConnections.end(), conn);
+    untrack(conn);
     
-    if (it != mConnections.end()) {
-      
-      // do not close connection that have same id
-      if (conn->fd() != NULL_SOCKET && conn->fd() != fd()) {
+    // do not close connection that have same id
+    if (conn->fd() != NULL_SOCKET && conn->fd() != fd()) {
+      CloseFD(conn->fd());
+    }
+    
+    // destroy it
+    delete conn;
+  }
+}
+
+TCPConnection* TCPSocket::track(TCPConnection *conn) {
+  unsigned int index;
+  
+  if (mFreeSlot != NoSlot) {
+    index = mFreeSlot;
+    mFreeSlot = mSlots[index].next;
+  } else {
+    Slot slot;
+    slot.conn = 0;
+    slot.fd = NULL_SOCKET;
+    slot.generation = 1;
+    slot.next = NoSlot;
+    index = (unsigned int) mSlots.size();
+    mSlots.push_back(slot);
+  }
+  
+  Slot &slot = mSlots[index];
+  slot.conn = conn;
+  slot.fd = conn->fd();
+  slot.next = (unsigned int) mLive.size();
+  mLive.push_back(index);
+  
+  conn->mHandle.index = index;
+  conn->mHandle.generation = slot.generation;
+  mConnSlots[conn] = index;
+  
+  if (slot.fd != NULL_SOCKET) {
+#ifdef _WIN32
+    mFDSlots[slot.fd] = index;
+#else
+    size_t i = size_t(slot.fd);
+    if (i >= mFDSlots.size()) {
+      mFDSlots.resize(i < 1024 ? 1024 : 2 * i, 0);
+    }
+    mFDSlots[i] = index + 1;
+#endif
+  }
+  
+  return conn;
+}
+
+void TCPSocket::untrack(TCPConnection *conn) {
+  unsigned int index = conn->mHandle.index;
+  Slot &slot = mSlots[index];
+  
+  // the descriptor may already index a newer connection when this one was
+  // remotely closed
+  if (slot.fd != NULL_SOCKET) {
+#ifdef _WIN32
+    std::unordered_map<sock_t, unsigned int>::iterator it = mFDSlots.find(slot.fd);
+    if (it != mFDSlots.end() && it->second == index) {
+      mFDSlots.erase(it);
+    }
+#else
+    size_t i = size_t(slot.fd);
+    if (i < mFDSlots.size() && mFDSlots[i] == index + 1) {
+      mFDSlots[i] = 0;
+    }
+#endif
+  }
+  
+  // fill the hole with the last live slot
+  unsigned int pos = slot.next;
+  unsigned int last = mLive.back();
+  mLive[pos] = last;
+  mSlots[last].next = pos;
+  mLive.pop_back();
+  
+  mConnSlots.erase(conn);
+  
+  slot.conn = 0;
+  slot.fd = NULL_SOCKET;
+  if (++slot.generation == 0) {
+    slot.generation = 1;
+  }
+  slot.next = mFreeSlot;
+  mFreeSlot = index;
+  
+  conn->mHandle = ConnectionHandle();
+}
+
+TCPConnection* TCPSocket::connection(const ConnectionHandle &handle) const {
+  if (handle.index >= mSlots.size()) {
+    return NULL;
+  }
+  const Slot &slot = mSlots[handle.index];
+  return (slot.generation == handle.generation ? slot.conn : NULL);
+}
+
+TCPConnection* TCPSocket::connectionByFD(sock_t fd) const {
+  if (fd == NULL_SOCKET) {
+    return NULL;
+  }
+#ifdef _WIN32
+  std::unordered_map<sock_t, unsigned int>::const_iterator it = mFDSlots.find(fd);
+  if (it == mFDSlots.end()) {
+    return NULL;
+  }
+  const Slot &slot = mSlots[it->second];
+#else
+  size_t i = size_t(fd);
+  if (i >= mFDSlots.size() || mFDSlots[i] == 0) {
+    return NULL;
+  }
+  const Slot &slot = mSlots[mFDSlots[i] - 1];
+#endif
+  // a remotely closed connection no longer owns its former descriptor
+  return (slot.conn && slot.conn->fd() == fd ? slot.conn : NULL);
+}
+
+TCPConnection* TCPSocket::connect(int timeout) GNET_THROWS(Exception) {
+  
+  socklen_t len = mHost.length();
+  
+  mOptions.apply(mFD, SocketOptions::Connecting);
+  
+  if (timeout < 0 && mBlocking) {
+    if (::connect(mFD, mHost, len) < 0) {
+      throw Exception("TCPSocket", "Could not connect.", true);
+    }
+  
+  } else {
+    
+    if (mBlocking) {
+      SetBlocking(mFD, false);
+    }
+    
+    int rv = ::connect(mFD, mHost, len);
+
 #ifdef _WIN32
-        closesocket(conn->fd());
+    bool inProgress = (rv < 0 && (WouldBlock() || WSAGetLastError() == WSAEALREADY));
+    bool connected = (rv == 0 || WSAGetLastError() == WSAEISCONN);
 #else
-        ::close(conn->fd());
+    // EALREADY/EISCONN when resuming a previously timed out attempt
+    bool inProgress = (rv < 0 && (errno == EINPROGRESS || errno == EALREADY));
+    bool connected = (rv == 0 || errno == EISCONN);
 #endif
+    
+    if (!connected && !inProgress) {
+      if (mBlocking) {
+        SetBlocking(mFD, true);
       }
+      throw Exception("TCPSocket", "Could not connect.", true);
+    }
+    
+    if (!connected) {
       
-      // destroy it
-      delete conn;
+      if (!WaitFD(mFD, true, timeout)) {
+        // leave the connection attempt pending for non-blocking sockets
+        if (mBlocking) {
+          SetBlocking(mFD, true);
+        }
+        return NULL;
+      }
       
-      mConnections.erase(it);
+      int err = 0;
+      socklen_t errlen = sizeof(err);
+      
+      getsockopt(mFD, SOL_SOCKET, SO_ERROR, (char*)&err, &errlen);
+      
+      if (err != 0) {
+        if (mBlocking) {
+          SetBlocking(mFD, true);
+        }
+        errno = err;
+        throw Exception("TCPSocket", "Could not connect.", true);
+      }
+    }
+    
+    if (mBlocking) {
+      SetBlocking(mFD, true);
     }
   }
+  
+  TCPConnection *conn = new TCPConnection(this, mFD, mHost);
+  conn->mBlocking = mBlocking;
+  
+  return track(conn);
 }
 
-TCPConnection* TCPSocket::connect() throw(Exception) {
+TCPConnection* TCPSocket::connect(const std::vector<Host> &hosts, int timeout, int delay) GNET_THROWS(Exception) {
+  
+  if (hosts.empty()) {
+    throw Exception("TCPSocket", "No address to connect to.");
+  }
+  if (!mLive.empty()) {
+    throw Exception("TCPSocket", "Socket already connected.");
+  }
   
-  socklen_t len = sizeof(struct sockaddr);
+  // interleave families, starting with the preferred one
+  std::vector<Host> order;
+  std::vector<Host> other;
+  int preferred = hosts[0].family();
   
-  if (::connect(mFD, mHost, len) < 0) {
-    throw Exception("TCPSocket", "Could not connect.", true);
+  for (size_t i=0; i<hosts.size(); ++i) {
+    if (hosts[i].family() == preferred) {
+      order.push_back(hosts[i]);
+    } else {
+      other.push_back(hosts[i]);
+    }
   }
   
-  mConnections.push_back(new TCPConnection(this, mFD, mHost));
-  return mConnections.back();
-}
+  for (size_t i=0; i<other.size(); ++i) {
+    size_t pos = 2 * i + 1;
+    order.insert(order.begin() + std::min(pos, order.size()), other[i]);
+  }
+  
+  long long deadline = Deadline(timeout);
+  long long nextAttempt = MonotonicTime();
+  
+  std::vector<sock_t> fds;
+  std::vector<size_t> indices;
+  std::vector<bool> ready;
+  size_t next = 0;
+  int lastError = 0;
+  
+  sock_t winner = NULL_SOCKET;
+  size_t winnerIndex = 0;
+  
+  while (winner == NULL_SOCKET) {
+    
+    long long now = MonotonicTime();
+    
+    if (next < order.size() && (fds.empty() || now >= nextAttempt)) {
+      
+      const Host &h = order[next];
+      
+      sock_t fd = ::socket(h.family(), SOCK_STREAM, 0);
+      
+      if (fd != NULL_SOCKET) {
+        try {
+          mOptions.apply(fd, SocketOptions::Created);
+          mOptions.apply(fd, SocketOptions::Connecting);
+        } catch (Exception &) {
+          CloseFD(fd);
+          for (size_t i=0; i<fds.size(); ++i) {
+            CloseFD(fds[i]);
+          }
+          throw;
+        }
+        
+        SetBlocking(fd, false);
+        
+        int rv = ::connect(fd, h, h.length());
+        
+        if (rv == 0) {
+          winner = fd;
+          winnerIndex = next;
 
-TCPConnection* TCPSocket::acceptConnection() throw(Exception) {
+#ifdef _WIN32
+        } else if (WouldBlock()) {
+#else
+        } else if (errno == EINPROGRESS) {
+#endif
+          fds.push_back(fd);
+          indices.push_back(next);
+          // only an attempt left in progress delays the next one
+          nextAttempt = now + delay;
+          
+        } else {
+          lastError = errno;
+          CloseFD(fd);
+        }
+      } else {
+        lastError = errno;
+      }
+      
+      ++next;
+      continue;
+    }
+    
+    if (fds.empty()) {
+      // all attempts failed
+      break;
+    }
+    
+    int wait = Remaining(deadline);
+    
+    if (wait == 0) {
+      break;
+    }
+    
+    if (next < order.size()) {
+      int untilNext = int(nextAttempt > now ? nextAttempt - now : 0);
+      if (wait < 0 || untilNext < wait) {
+        wait = untilNext;
+      }
+    }
+    
+    if (!WaitFDs(fds, true, wait, ready)) {
+      continue;
+    }
+    
+    size_t i = 0;
+    
+    while (i < fds.size()) {
+      if (!ready[i]) {
+        ++i;
+        continue;
+      }
+      
+      int err = 0;
+      socklen_t errlen = sizeof(err);
+      
+      getsockopt(fds[i], SOL_SOCKET, SO_ERROR, (char*)&err, &errlen);
+      
+      if (err == 0 && winner == NULL_SOCKET) {
+        winner = fds[i];
+        winnerIndex = indices[i];
+        ++i;
+        
+      } else if (err != 0) {
+        lastError = err;
+        CloseFD(fds[i]);
+        fds.erase(fds.begin() + i);
+        indices.erase(indices.begin() + i);
+        ready.erase(ready.begin() + i);
+        // failure starts next attempt right away
+        nextAttempt = MonotonicTime();
+        
+      } else {
+        ++i;
+      }
+    }
+  }
   
-  Host h;
+  // cancel losers
+  for (size_t i=0; i<fds.size(); ++i) {
+    if (fds[i] != winner) {
+      CloseFD(fds[i]);
+    }
+  }
   
-  socklen_t len = sizeof(struct sockaddr_in);
+  if (winner == NULL_SOCKET) {
+    if (next >= order.size() && fds.empty()) {
+      errno = lastError;
+      throw Exception("TCPSocket", "Could not connect.", true);
+    }
+    return NULL;
+  }
   
-  sock_t fd = ::accept(mFD, h, &len);
+  if (mBlocking) {
+    SetBlocking(winner, true);
+  }
   
-  if (fd == NULL_SOCKET) {
-    throw Exception("TCPSocket", "Could not accept connetion.", true);
+  if (isValid()) {
+    CloseFD(mFD);
   }
   
-  mConnections.push_back(new TCPConnection(this, fd, h));
-  return mConnections.back();
+  mFD = winner;
+  mHost = order[winnerIndex];
+  
+  TCPConnection *conn = new TCPConnection(this, mFD, mHost);
+  conn->mBlocking = mBlocking;
+  
+  return track(conn);
 }
 
-//void TCPSocket::select() throw(Exception) {
-//}
-
-TCPSocket::TCPSocket() {
+TCPConnection* TCPSocket::acceptConnection(int timeout) GNET_THROWS(Exception) {
+  
+  Host h;
+  
+  if (!mAccepted.empty()) {
+    // already accepted by a Poller
+    sock_t fd = mAccepted.front();
+    mAccepted.pop_front();
+    
+    socklen_t len = sizeof(struct sockaddr_storage);
+    getpeername(fd, h, &len);
+    
+    try {
+      SetBlocking(fd, true);
+      mOptions.apply(fd, SocketOptions::Accepted);
+    } catch (Exception &) {
+      CloseFD(fd);
+      throw;
+    }
+    GNET_METRIC_ADD(Accepts, 1);
+    return track(new TCPConnection(this, fd, h));
+  }
+  
+  long long deadline = Deadline(timeout);
+  
+  while (true) {
+    
+    if (timeout >= 0 && mBlocking) {
+      if (!WaitFD(mFD, false, Remaining(deadline))) {
+        return NULL;
+      }
+    }
+    
+    socklen_t len = sizeof(struct sockaddr_storage);
+    
+    sock_t fd = ::accept(mFD, h, &len);
+    
+    if (fd != NULL_SOCKET) {
+      try {
+        mOptions.apply(fd, SocketOptions::Accepted);
+      } catch (Exception &) {
+        CloseFD(fd);
+        throw;
+      }
+      GNET_METRIC_ADD(Accepts, 1);
+      return track(new TCPConnection(this, fd, h));
+    }
+    
+    if (Interrupted()) {
+      continue;
+    }
+    
+    if (WouldBlock()) {
+      // woken up but connection was reset before we could accept it
+      if (timeout == 0 || !WaitFD(mFD, false, Remaining(deadline))) {
+        return NULL;
+      }
+      continue;
+    }
+    
+    throw Exception("TCPSocket", "Could not accept connetion.", true);
+  }
 }
 
-TCPSocket::TCPSocket(const TCPSocket &rhs)
-  : Socket(rhs) {
-}
+size_t TCPSocket::acceptBatch(std::vector<TCPConnection*> &conns, size_t max) GNET_THROWS(Exception) {
+  
+  size_t count = 0;
+  
+  while (max == 0 || count < max) {
+    
+    Host h;
+    socklen_t len = sizeof(struct sockaddr_storage);
+    sock_t fd;
+    
+    if (!mAccepted.empty()) {
+      // already accepted by a Poller, non-blocking and close-on-exec
+      fd = mAccepted.front();
+      mAccepted.pop_front();
+      getpeername(fd, h, &len);
+      
+    } else {
+      // don't let accept block once the queue is drained
+      if (mBlocking && !WaitFD(mFD, false, 0)) {
+        break;
+      }
 
-TCPSocket& TCPSocket::operator=(const TCPSocket&) {
-  return *this;
+#ifdef __linux__
+      fd = ::accept4(mFD, h, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+      fd = ::accept(mFD, h, &len);
+#endif
+    }
+    
+    if (fd == NULL_SOCKET) {
+      if (Interrupted()) {
+        continue;
+      }
+      if (WouldBlock()) {
+        break;
+      }
+#ifndef _WIN32
+      if (errno == ECONNABORTED) {
+        // connection reset before we could accept it
+        continue;
+      }
+#endif
+      if (count > 0) {
+        // report error on next call, keep what was accepted
+        break;
+      }
+      throw Exception("TCPSocket", "Could not accept connetion.", true);
+    }
+
+#ifndef __linux__
+    SetBlocking(fd, false);
+# ifndef _WIN32
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+# endif
+#endif
+    
+    try {
+      mOptions.apply(fd, SocketOptions::Accepted);
+    } catch (Exception &) {
+      CloseFD(fd);
+      if (count > 0) {
+        break;
+      }
+      throw;
+    }
+    
+    TCPConnection *conn = new TCPConnection(this, fd, h);
+    conn->mBlocking = false;
+    track(conn);
+    conns.push_back(conn);
+    ++count;
+  }
+  
+  if (count > 0) {
+    GNET_METRIC_ADD(Accepts, count);
+  }
+  
+  return count;
+}
+
+TCPSocket::TCPSocket()
+  : mFreeSlot(NoSlot) {
+}
+
+TCPSocket::TCPSocket(const TCPSocket &rhs)
+  : Socket(rhs), mFreeSlot(NoSlot) {
+}
+
+TCPSocket& TCPSocket::operator=(const TCPSocket&) {
+  return *this;
+}
+
+// ---
+
+#ifndef _WIN32
+
+// Fill a unix socket address, '@' prefix maps to the abstract namespace
+static socklen_t UnixAddress(const std::string &path, struct sockaddr_un &addr) GNET_THROWS(Exception) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  
+  if (path.empty()) {
+    throw Exception("UnixSocket", "Empty path.");
+  }
+  if (path.length() >= sizeof(addr.sun_path)) {
+    throw Exception("UnixSocket", "Path too long.");
+  }
+  
+  memcpy(addr.sun_path, path.c_str(), path.length());
+  
+  if (path[0] == '@') {
+#ifdef __linux__
+    addr.sun_path[0] = '\0';
+    // abstract names are not null terminated
+    return socklen_t(offsetof(struct sockaddr_un, sun_path) + path.length());
+#else
+    throw Exception("UnixSocket", "Abstract namespace not supported.");
+#endif
+  }
+  
+  return socklen_t(sizeof(addr));
+}
+
+UnixSocket::UnixSocket(const std::string &path) GNET_THROWS(Exception)
+  : Socket(), mPath(path), mBound(false) {
+  mFD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+UnixSocket::~UnixSocket() {
+  
+  for (size_t i=0; i<mConnections.size(); ++i) {
+    delete mConnections[i];
+  }
+  mConnections.clear();
+  
+  if (isValid()) {
+    CloseFD(mFD);
+  }
+  
+  if (mBound && mPath[0] != '@') {
+    ::unlink(mPath.c_str());
+  }
+}
+
+void UnixSocket::bind() GNET_THROWS(Exception) {
+  struct sockaddr_un addr;
+  socklen_t len = UnixAddress(mPath, addr);
+  
+  if (::bind(mFD, (struct sockaddr*) &addr, len) < 0) {
+    throw Exception("UnixSocket", "Could not bind socket.", true);
+  }
+  
+  mBound = true;
+}
+
+void UnixSocket::listen(int maxConnections) GNET_THROWS(Exception) {
+  if (::listen(mFD, maxConnections) == -1) {
+    throw Exception("UnixSocket", "Cannot listen on socket.", true);
+  }
+}
+
+void UnixSocket::bindAndListen(int maxConnections) GNET_THROWS(Exception) {
+  this->bind();
+  this->listen(maxConnections);
+}
+
+void UnixSocket::closeConnection(UnixConnection *conn) {
+  if (conn) {
+    
+    std::vector<UnixConnection*>::iterator it =
+      std::find(mConnections.begin(), mConnections.end(), conn);
+    
+    if (it != mConnections.end()) {
+      
+      // do not close connection that have same id
+      if (conn->fd() != NULL_SOCKET && conn->fd() != fd()) {
+        CloseFD(conn->fd());
+      }
+      
+      delete conn;
+      
+      mConnections.erase(it);
+    }
+  }
+}
+
+UnixConnection* UnixSocket::connect() GNET_THROWS(Exception) {
+  struct sockaddr_un addr;
+  socklen_t len = UnixAddress(mPath, addr);
+  
+  while (::connect(mFD, (struct sockaddr*) &addr, len) < 0) {
+    if (!Interrupted()) {
+      throw Exception("UnixSocket", "Could not connect.", true);
+    }
+  }
+  
+  UnixConnection *conn = new UnixConnection(this, mFD, mPath);
+  conn->mBlocking = mBlocking;
+  
+  mConnections.push_back(conn);
+  return conn;
+}
+
+UnixConnection* UnixSocket::acceptConnection(int timeout) GNET_THROWS(Exception) {
+  
+  long long deadline = Deadline(timeout);
+  
+  while (true) {
+    
+    if (timeout >= 0 && mBlocking) {
+      if (!WaitFD(mFD, false, Remaining(deadline))) {
+        return NULL;
+      }
+    }
+    
+    sock_t fd = ::accept(mFD, NULL, NULL);
+    
+    if (fd != NULL_SOCKET) {
+      mConnections.push_back(new UnixConnection(this, fd, mPath));
+      return mConnections.back();
+    }
+    
+    if (Interrupted()) {
+      continue;
+    }
+    
+    if (WouldBlock()) {
+      if (timeout == 0 || !WaitFD(mFD, false, Remaining(deadline))) {
+        return NULL;
+      }
+      continue;
+    }
+    
+    throw Exception("UnixSocket", "Could not accept connection.", true);
+  }
+}
+
+UnixSocket::UnixSocket()
+  : mBound(false) {
+}
+
+UnixSocket::UnixSocket(const UnixSocket &rhs)
+  : Socket(rhs), mBound(false) {
+}
+
+UnixSocket& UnixSocket::operator=(const UnixSocket&) {
+  return *this;
+}
+
+#endif
+
+// ---
+
+#ifdef __linux__
+
+namespace {
+  
+  struct RecvHeaders {
+    std::vector<struct mmsghdr> msgs;
+    std::vector<struct iovec> iovs;
+    std::vector<struct sockaddr_storage> addrs;
+    std::vector<char> control;
+  };
+  
+}
+
+static const size_t ControlSize = CMSG_SPACE(sizeof(int));
+
+#endif
+
+static Host SourceHost(const struct sockaddr_storage &addr, socklen_t len) {
+  try {
+    return Host((const struct sockaddr*) &addr, len);
+  } catch (Exception &) {
+    return Host();
+  }
+}
+
+Datagram::Datagram()
+  : bytes(0), len(0), segment(0) {
+}
+
+DatagramBatch::DatagramBatch(size_t count, size_t maxSize)
+  : mStorage(0), mMaxSize(maxSize), mHeaders(0) {
+  
+  mDatagrams.resize(count);
+  mStorage = (char*) malloc(count * maxSize);
+  
+  for (size_t i=0; i<count; ++i) {
+    mDatagrams[i].bytes = mStorage + i * maxSize;
+  }
+
+#ifdef __linux__
+  RecvHeaders *h = new RecvHeaders();
+  
+  h->msgs.resize(count);
+  h->iovs.resize(count);
+  h->addrs.resize(count);
+  h->control.resize(count * ControlSize);
+  
+  for (size_t i=0; i<count; ++i) {
+    memset(&(h->msgs[i]), 0, sizeof(struct mmsghdr));
+    h->iovs[i].iov_base = mDatagrams[i].bytes;
+    h->iovs[i].iov_len = maxSize;
+    h->msgs[i].msg_hdr.msg_iov = &(h->iovs[i]);
+    h->msgs[i].msg_hdr.msg_iovlen = 1;
+    h->msgs[i].msg_hdr.msg_name = &(h->addrs[i]);
+    h->msgs[i].msg_hdr.msg_control = &(h->control[i * ControlSize]);
+  }
+  
+  mHeaders = h;
+#endif
+}
+
+DatagramBatch::~DatagramBatch() {
+#ifdef __linux__
+  delete (RecvHeaders*) mHeaders;
+#endif
+  free(mStorage);
+}
+
+// ---
+
+UDPSocket::UDPSocket(unsigned short port) GNET_THROWS(Exception)
+  : Socket(port), mConnection(0) {
+  mFD = ::socket(mHost.family(), SOCK_DGRAM, 0);
+}
+
+UDPSocket::UDPSocket(const Host &host) GNET_THROWS(Exception)
+  : Socket(host), mConnection(0) {
+  mFD = ::socket(mHost.family(), SOCK_DGRAM, 0);
+}
+
+UDPSocket::UDPSocket()
+  : mConnection(0) {
+}
+
+UDPSocket::UDPSocket(const UDPSocket &rhs)
+  : Socket(rhs), mConnection(0) {
+}
+
+UDPSocket& UDPSocket::operator=(const UDPSocket&) {
+  return *this;
+}
+
+UDPSocket::~UDPSocket() {
+  if (mConnection) {
+    delete mConnection;
+  }
+  if (isValid()) {
+    CloseFD(mFD);
+  }
+}
+
+void UDPSocket::setReuseAddress(bool on) GNET_THROWS(Exception) {
+  int val = (on ? 1 : 0);
+  if (::setsockopt(mFD, SOL_SOCKET, SO_REUSEADDR, (const char*)&val, sizeof(val)) != 0) {
+    throw Exception("UDPSocket", "Could not set SO_REUSEADDR.", true);
+  }
+}
+
+void UDPSocket::bind() GNET_THROWS(Exception) {
+  if (::bind(mFD, mHost, mHost.length()) < 0) {
+    throw Exception("UDPSocket", "Could not bind socket.", true);
+  }
+}
+
+UDPConnection* UDPSocket::connect() GNET_THROWS(Exception) {
+  if (mConnection) {
+    return mConnection;
+  }
+  
+  if (::connect(mFD, mHost, mHost.length()) < 0) {
+    throw Exception("UDPSocket", "Could not connect.", true);
+  }
+  
+  mConnection = new UDPConnection(this, mFD, mHost);
+  mConnection->mBlocking = mBlocking;
+  
+  return mConnection;
+}
+
+void UDPSocket::setGRO(bool on) GNET_THROWS(Exception) {
+#ifdef __linux__
+  int val = (on ? 1 : 0);
+  if (::setsockopt(mFD, SOL_UDP, UDP_GRO, &val, sizeof(val)) != 0) {
+    throw Exception("UDPSocket", "Could not set UDP_GRO.", true);
+  }
+#else
+  if (on) {
+    throw Exception("UDPSocket", "UDP_GRO not supported.");
+  }
+#endif
+}
+
+#ifdef __linux__
+static bool ProbeGSO() {
+  int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+  int val = 0;
+  bool supported = (fd != -1 && ::setsockopt(fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) == 0);
+  if (fd != -1) {
+    ::close(fd);
+  }
+  return supported;
+}
+#endif
+
+bool UDPSocket::SupportsGSO() {
+#ifdef __linux__
+  // requires linux 4.18, checked once (thread safe initialization)
+  static const bool supported = ProbeGSO();
+  return supported;
+#else
+  return false;
+#endif
+}
+
+bool UDPSocket::sendFailed(long long deadline) GNET_THROWS(Exception) {
+  if (Interrupted()) {
+    return true;
+  }
+  if (WouldBlock()) {
+    return WaitFD(mFD, true, Remaining(deadline));
+  }
+  throw Exception("UDPSocket", "Could not send datagram.", true);
+}
+
+bool UDPSocket::sendTo(const Host &host, const char *bytes, size_t len, int timeout) GNET_THROWS(Exception) {
+  Datagram d;
+  d.bytes = (char*) bytes;
+  d.len = len;
+  d.host = host;
+  return (send(&d, 1, timeout) == 1);
+}
+
+bool UDPSocket::receiveFrom(Host &host, char *bytes, size_t &len, int timeout) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("UDPSocket", "Invalid socket.");
+  }
+  
+  long long deadline = Deadline(timeout);
+  
+  while (true) {
+    
+    if (timeout >= 0 && mBlocking) {
+      if (!WaitFD(mFD, false, Remaining(deadline))) {
+        return false;
+      }
+    }
+    
+    struct sockaddr_storage addr;
+    socklen_t alen = sizeof(addr);
+    
+    long n = long(::recvfrom(mFD, bytes, int(len), 0, (struct sockaddr*) &addr, &alen));
+    
+    if (n >= 0) {
+      len = size_t(n);
+      host = SourceHost(addr, alen);
+      return true;
+    }
+    
+    if (Interrupted()) {
+      continue;
+    }
+    
+    if (WouldBlock()) {
+      if (!WaitFD(mFD, false, Remaining(deadline))) {
+        return false;
+      }
+      continue;
+    }
+    
+    throw Exception("UDPSocket", "Could not receive datagram.", true);
+  }
+}
+
+size_t UDPSocket::receive(DatagramBatch &batch, int timeout) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("UDPSocket", "Invalid socket.");
+  }
+  
+  size_t count = batch.count();
+  
+  if (count == 0) {
+    return 0;
+  }
+  
+  long long deadline = Deadline(timeout);
+  
+  while (true) {
+    
+    if (timeout >= 0 && mBlocking) {
+      if (!WaitFD(mFD, false, Remaining(deadline))) {
+        return 0;
+      }
+    }
+
+#ifdef __linux__
+    RecvHeaders *h = (RecvHeaders*) batch.mHeaders;
+    
+    for (size_t i=0; i<count; ++i) {
+      struct msghdr &m = h->msgs[i].msg_hdr;
+      m.msg_namelen = sizeof(struct sockaddr_storage);
+      m.msg_controllen = ControlSize;
+      m.msg_flags = 0;
+      h->msgs[i].msg_len = 0;
+    }
+    
+    // only the first datagram is waited for
+    int n = ::recvmmsg(mFD, &(h->msgs[0]), (unsigned int) count, MSG_WAITFORONE, NULL);
+    
+    if (n > 0) {
+      for (int i=0; i<n; ++i) {
+        struct msghdr &m = h->msgs[i].msg_hdr;
+        Datagram &d = batch.mDatagrams[i];
+        
+        d.len = h->msgs[i].msg_len;
+        d.host = SourceHost(h->addrs[i], m.msg_namelen);
+        d.segment = 0;
+        
+        for (struct cmsghdr *c=CMSG_FIRSTHDR(&m); c!=NULL; c=CMSG_NXTHDR(&m, c)) {
+          if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+            int segment = 0;
+            memcpy(&segment, CMSG_DATA(c), sizeof(int));
+            d.segment = size_t(segment);
+          }
+        }
+      }
+      return size_t(n);
+    }
+#else
+    size_t n = 0;
+    
+    while (n < count) {
+      int flags = 0;
+      
+      if (n > 0) {
+# ifdef MSG_DONTWAIT
+        // only the first datagram is waited for
+        flags = MSG_DONTWAIT;
+# else
+        break;
+# endif
+      }
+      
+      Datagram &d = batch.mDatagrams[n];
+      struct sockaddr_storage addr;
+      socklen_t alen = sizeof(addr);
+      
+      long rv = long(::recvfrom(mFD, d.bytes, int(batch.mMaxSize), flags, (struct sockaddr*) &addr, &alen));
+      
+      if (rv < 0) {
+        break;
+      }
+      
+      d.len = size_t(rv);
+      d.host = SourceHost(addr, alen);
+      d.segment = 0;
+      ++n;
+    }
+    
+    if (n > 0) {
+      return n;
+    }
+#endif
+    
+    if (Interrupted()) {
+      continue;
+    }
+    
+    if (WouldBlock()) {
+      if (!WaitFD(mFD, false, Remaining(deadline))) {
+        return 0;
+      }
+      continue;
+    }
+    
+    throw Exception("UDPSocket", "Could not receive datagrams.", true);
+  }
+}
+
+size_t UDPSocket::send(const Datagram *datagrams, size_t count, int timeout, size_t *partial) GNET_THROWS(Exception) {
+  if (!isValid()) {
+    throw Exception("UDPSocket", "Invalid socket.");
+  }
+  
+  long long deadline = Deadline(timeout);
+  
+  int flags = 0;
+#ifdef MSG_DONTWAIT
+  if (deadline >= 0) {
+    flags |= MSG_DONTWAIT;
+  }
+#endif
+  
+  bool gso = SupportsGSO();
+  
+  size_t sent = 0;
+  // position in a segmented datagram split by hand
+  size_t offset = (partial ? *partial : 0);
+  
+  if (offset > 0 && (count == 0 || datagrams[0].segment == 0 || offset >= datagrams[0].len)) {
+    // nothing to resume
+    offset = 0;
+  }
+  
+  while (sent < count) {
+    
+    if (deadline >= 0 && mBlocking) {
+      if (!WaitFD(mFD, true, Remaining(deadline))) {
+        break;
+      }
+    }
+    
+    const Datagram &d = datagrams[sent];
+    const struct sockaddr *to = (d.host.family() != AF_UNSPEC ? (const struct sockaddr*) d.host : 0);
+    socklen_t tolen = (to ? d.host.length() : 0);
+    
+    if ((d.segment > 0 && d.segment < d.len && !gso) || offset > 0) {
+      // no segmentation offload or resuming a partial send, one segment at
+      // a time
+      size_t len = (d.len - offset < d.segment ? d.len - offset : d.segment);
+      
+      long rv = long(::sendto(mFD, d.bytes + offset, int(len), flags, to, tolen));
+      
+      if (rv < 0) {
+        if (!sendFailed(deadline)) {
+          break;
+        }
+        continue;
+      }
+      
+      offset += len;
+      if (offset >= d.len) {
+        offset = 0;
+        ++sent;
+      }
+      continue;
+    }
+
+#ifdef __linux__
+    // datagrams sent per system call
+    static const size_t MaxDatagrams = 64;
+    
+    struct mmsghdr msgs[MaxDatagrams];
+    struct iovec iovs[MaxDatagrams];
+    char control[MaxDatagrams][CMSG_SPACE(sizeof(uint16_t))];
+    
+    size_t n = 0;
+    
+    while (n < MaxDatagrams && sent + n < count) {
+      const Datagram &cur = datagrams[sent + n];
+      
+      if (cur.segment > 0 && cur.segment < cur.len && !gso) {
+        break;
+      }
+      
+      struct msghdr &m = msgs[n].msg_hdr;
+      memset(&(msgs[n]), 0, sizeof(struct mmsghdr));
+      
+      iovs[n].iov_base = cur.bytes;
+      iovs[n].iov_len = cur.len;
+      m.msg_iov = &(iovs[n]);
+      m.msg_iovlen = 1;
+      
+      if (cur.host.family() != AF_UNSPEC) {
+        m.msg_name = (void*) (const struct sockaddr*) cur.host;
+        m.msg_namelen = cur.host.length();
+      }
+      
+      if (cur.segment > 0 && cur.segment < cur.len) {
+        uint16_t segment = uint16_t(cur.segment);
+        m.msg_control = control[n];
+        m.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+        struct cmsghdr *c = CMSG_FIRSTHDR(&m);
+        c->cmsg_level = SOL_UDP;
+        c->cmsg_type = UDP_SEGMENT;
+        c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(c), &segment, sizeof(uint16_t));
+      }
+      
+      ++n;
+    }
+    
+    int rv = ::sendmmsg(mFD, msgs, (unsigned int) n, flags);
+    
+    if (rv > 0) {
+      sent += size_t(rv);
+      continue;
+    }
+#else
+    long rv = long(::sendto(mFD, d.bytes, int(d.len), flags, to, tolen));
+    
+    if (rv >= 0) {
+      ++sent;
+      continue;
+    }
+#endif
+    
+    if (!sendFailed(deadline)) {
+      break;
+    }
+  }
+  
+  if (partial) {
+    *partial = offset;
+  }
+  
+  return sent;
 }
 
 }
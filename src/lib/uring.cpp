@@ -0,0 +1,310 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+#include "uring.h"
+
+#ifdef GNET_URING
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+namespace gnet {
+
+static int Setup(unsigned entries, struct io_uring_params *p) {
+  return int(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int Enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void *arg, size_t argSize) {
+  return int(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+static int Register(int fd, unsigned opcode, void *arg, unsigned count) {
+  return int(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+// multishot recv needs linux 6.0, it can't be probed for
+static bool KernelAtLeast(int major, int minor) {
+  struct utsname u;
+  if (uname(&u) != 0) {
+    return false;
+  }
+  int M = 0, m = 0;
+  if (sscanf(u.release, "%d.%d", &M, &m) != 2) {
+    return false;
+  }
+  return (M > major || (M == major && m >= minor));
+}
+
+Uring* Uring::Create(unsigned entries, unsigned buffers, unsigned bufferSize) {
+  if (!KernelAtLeast(6, 0)) {
+    return NULL;
+  }
+  Uring *ring = new Uring();
+  if (!ring->setup(entries, buffers, bufferSize)) {
+    delete ring;
+    return NULL;
+  }
+  return ring;
+}
+
+Uring::Uring()
+  : mFD(-1), mSqRing(MAP_FAILED), mSqRingSize(0), mCqRing(MAP_FAILED), mCqRingSize(0)
+  , mSqes((struct io_uring_sqe*) MAP_FAILED), mSqesSize(0)
+  , mSqHead(0), mSqTail(0), mSqMask(0), mSqEntries(0), mSqLocalTail(0), mSqSubmitted(0)
+  , mCqHead(0), mCqTail(0), mCqMask(0), mCqes(0)
+  , mBufRing((struct io_uring_buf_ring*) MAP_FAILED), mBufRingSize(0), mBufMask(0), mBufTail(0)
+  , mBuffers(0), mBufferSize(0) {
+}
+
+Uring::~Uring() {
+  // closing the ring cancels pending requests
+  if (mFD != -1) {
+    ::close(mFD);
+  }
+  if (mBufRing != MAP_FAILED) {
+    ::munmap(mBufRing, mBufRingSize);
+  }
+  free(mBuffers);
+  if (mSqes != MAP_FAILED) {
+    ::munmap(mSqes, mSqesSize);
+  }
+  if (mCqRing != MAP_FAILED && mCqRing != mSqRing) {
+    ::munmap(mCqRing, mCqRingSize);
+  }
+  if (mSqRing != MAP_FAILED) {
+    ::munmap(mSqRing, mSqRingSize);
+  }
+}
+
+bool Uring::setup(unsigned entries, unsigned buffers, unsigned bufferSize) {
+  struct io_uring_params p;
+  
+  memset(&p, 0, sizeof(p));
+  // room for multishot completions piling up between two polls
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+  p.cq_entries = entries * 4;
+  
+  mFD = Setup(entries, &p);
+  
+  if (mFD == -1 && errno == EINVAL) {
+    // no cooperative task running (before 5.19)
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+    mFD = Setup(entries, &p);
+  }
+  
+  if (mFD == -1) {
+    return false;
+  }
+  
+  // timeouts are passed to io_uring_enter directly
+  if ((p.features & IORING_FEAT_EXT_ARG) == 0 || (p.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+    return false;
+  }
+  
+  mSqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  mCqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  
+  // both rings share a single mapping
+  if (mCqRingSize > mSqRingSize) {
+    mSqRingSize = mCqRingSize;
+  }
+  mCqRingSize = mSqRingSize;
+  
+  mSqRing = ::mmap(NULL, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFD, IORING_OFF_SQ_RING);
+  if (mSqRing == MAP_FAILED) {
+    return false;
+  }
+  mCqRing = mSqRing;
+  
+  mSqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+  mSqes = (struct io_uring_sqe*) ::mmap(NULL, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFD, IORING_OFF_SQES);
+  if (mSqes == MAP_FAILED) {
+    return false;
+  }
+  
+  char *sq = (char*) mSqRing;
+  char *cq = (char*) mCqRing;
+  
+  mSqHead = (unsigned*) (sq + p.sq_off.head);
+  mSqTail = (unsigned*) (sq + p.sq_off.tail);
+  mSqMask = *(unsigned*) (sq + p.sq_off.ring_mask);
+  mSqEntries = p.sq_entries;
+  mSqLocalTail = *mSqTail;
+  mSqSubmitted = mSqLocalTail;
+  
+  // entry i always uses slot i
+  unsigned *array = (unsigned*) (sq + p.sq_off.array);
+  for (unsigned i=0; i<p.sq_entries; ++i) {
+    array[i] = i;
+  }
+  
+  mCqHead = (unsigned*) (cq + p.cq_off.head);
+  mCqTail = (unsigned*) (cq + p.cq_off.tail);
+  mCqMask = *(unsigned*) (cq + p.cq_off.ring_mask);
+  mCqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+  
+  // provided buffer ring, group 0
+  mBufRingSize = buffers * sizeof(struct io_uring_buf);
+  mBufRing = (struct io_uring_buf_ring*) ::mmap(NULL, mBufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mBufRing == MAP_FAILED) {
+    return false;
+  }
+  // fault pages in before the kernel pins them
+  memset(mBufRing, 0, mBufRingSize);
+  
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (unsigned long long) mBufRing;
+  reg.ring_entries = buffers;
+  reg.bgid = 0;
+  
+  if (Register(mFD, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    return false;
+  }
+  
+  mBufferSize = bufferSize;
+  mBufMask = buffers - 1;
+  mBuffers = (char*) malloc(size_t(buffers) * bufferSize);
+  
+  if (!mBuffers) {
+    return false;
+  }
+  
+  for (unsigned i=0; i<buffers; ++i) {
+    recycle(i);
+  }
+  
+  return true;
+}
+
+struct io_uring_sqe* Uring::sqe() GNET_THROWS(Exception) {
+  if (mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE) >= mSqEntries) {
+    // queue full, hand it over to the kernel
+    enter(0);
+    // nothing was consumed when the kernel wants completions reaped first
+    // (EBUSY/EAGAIN): the next entry is still pending, don't overwrite it
+    if (mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE) >= mSqEntries) {
+      throw Exception("Uring", "Submission queue full, completions must be reaped first.");
+    }
+  }
+  
+  struct io_uring_sqe *e = &(mSqes[mSqLocalTail & mSqMask]);
+  memset(e, 0, sizeof(struct io_uring_sqe));
+  ++mSqLocalTail;
+  
+  return e;
+}
+
+int Uring::enter(int timeout) GNET_THROWS(Exception) {
+  unsigned toSubmit = mSqLocalTail - mSqSubmitted;
+  
+  __atomic_store_n(mSqTail, mSqLocalTail, __ATOMIC_RELEASE);
+  
+  // always reap: completions may be waiting for task work to post them
+  unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+  unsigned minComplete = (timeout != 0 ? 1 : 0);
+  
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  
+  memset(&arg, 0, sizeof(arg));
+  
+  if (timeout > 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+    arg.ts = (unsigned long long) &ts;
+  }
+  
+  int rv = Enter(mFD, toSubmit, minComplete, flags, &arg, sizeof(arg));
+  
+  if (rv < 0) {
+    if (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN) {
+      // EBUSY/EAGAIN: completions must be reaped first, nothing submitted
+      return 0;
+    }
+    throw Exception("Uring", "Could not enter ring.", true);
+  }
+  
+  mSqSubmitted += unsigned(rv);
+  
+  return rv;
+}
+
+void Uring::cancel(unsigned long long data) GNET_THROWS(Exception) {
+  // requests still in the submission queue can't be found otherwise
+  enter(0);
+  
+  struct io_uring_sync_cancel_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.addr = data;
+  reg.fd = -1;
+  reg.flags = IORING_ASYNC_CANCEL_ALL;
+  reg.timeout.tv_sec = -1;
+  reg.timeout.tv_nsec = -1;
+  
+  int rv;
+  do {
+    rv = Register(mFD, IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+  } while (rv < 0 && errno == EINTR);
+  
+  if (rv < 0 && errno != ENOENT) {
+    throw Exception("Uring", "Could not cancel request.", true);
+  }
+  
+  // run pending task work so that completions get posted
+  Enter(mFD, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+struct io_uring_cqe* Uring::peek() {
+  unsigned head = *mCqHead;
+  if (head == __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return &(mCqes[head & mCqMask]);
+}
+
+void Uring::advance() {
+  __atomic_store_n(mCqHead, *mCqHead + 1, __ATOMIC_RELEASE);
+}
+
+void Uring::recycle(unsigned id) {
+  // not mBufRing->bufs: the uapi flexible array declaration is offset when
+  // compiled as C++ (empty struct member)
+  struct io_uring_buf *b = ((struct io_uring_buf*) mBufRing) + (mBufTail & mBufMask);
+  b->addr = (unsigned long long) buffer(id);
+  b->len = mBufferSize;
+  b->bid = (unsigned short) id;
+  ++mBufTail;
+  __atomic_store_n(&(mBufRing->tail), mBufTail, __ATOMIC_RELEASE);
+}
+
+}
+
+#endif
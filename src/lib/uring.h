@@ -0,0 +1,123 @@
+/*
+
+Copyright (C) 2009  Gaetan Guidet
+
+This file is part of gnet.
+
+gnet is free software; you can redistribute it and/or modify it
+under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or (at
+your option) any later version.
+
+gnet is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,
+USA.
+
+*/
+#ifndef __gnet_uring_h_
+#define __gnet_uring_h_
+
+// Minimal io_uring wrapper used by Poller, not installed
+// Talks to the kernel with raw system calls, liburing is not required
+
+#include <gnet/config.h>
+
+#if defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#   include <linux/io_uring.h>
+#   ifdef IORING_RECV_MULTISHOT
+#     define GNET_URING
+#   endif
+# endif
+#endif
+
+#ifdef GNET_URING
+
+namespace gnet {
+  
+  class Uring {
+    
+    public:
+      
+      // Returns NULL if the kernel lacks features the Poller relies on:
+      // multishot accept and recv, provided buffer rings (linux 6.0)
+      // buffers (a power of 2) of bufferSize bytes are provided to recv
+      static Uring* Create(unsigned entries, unsigned buffers, unsigned bufferSize);
+      
+      ~Uring();
+      
+      // Next submission queue entry (zeroed), submits pending ones when full
+      // Throws if the kernel accepts none of them until completions are reaped
+      struct io_uring_sqe* sqe() GNET_THROWS(Exception);
+      
+      // Submit pending entries and wait for at least one completion, at most
+      // timeout milliseconds (-1 waits forever, 0 doesn't wait)
+      // Returns the number of entries submitted
+      int enter(int timeout) GNET_THROWS(Exception);
+      
+      // Cancel all requests submitted with user data, waiting for them to
+      // complete. Their completions are queued when it returns
+      void cancel(unsigned long long data) GNET_THROWS(Exception);
+      
+      // Completion queue access: peek returns NULL when empty
+      struct io_uring_cqe* peek();
+      void advance();
+      
+      // Provided buffers, group 0
+      inline char* buffer(unsigned id) const {
+        return mBuffers + size_t(id) * mBufferSize;
+      }
+      // Give buffer back to the kernel once its content has been consumed
+      void recycle(unsigned id);
+      
+    private:
+      
+      Uring();
+      Uring(const Uring&);
+      Uring& operator=(const Uring&);
+      
+      bool setup(unsigned entries, unsigned buffers, unsigned bufferSize);
+      
+    protected:
+      
+      int mFD;
+      
+      void *mSqRing;
+      size_t mSqRingSize;
+      void *mCqRing;
+      size_t mCqRingSize;
+      struct io_uring_sqe *mSqes;
+      size_t mSqesSize;
+      
+      unsigned *mSqHead;
+      unsigned *mSqTail;
+      unsigned mSqMask;
+      unsigned mSqEntries;
+      // entries filled but not submitted yet
+      unsigned mSqLocalTail;
+      unsigned mSqSubmitted;
+      
+      unsigned *mCqHead;
+      unsigned *mCqTail;
+      unsigned mCqMask;
+      struct io_uring_cqe *mCqes;
+      
+      struct io_uring_buf_ring *mBufRing;
+      size_t mBufRingSize;
+      unsigned mBufMask;
+      unsigned short mBufTail;
+      char *mBuffers;
+      unsigned mBufferSize;
+  };
+  
+}
+
+#endif
+
+#endif
@@ -0,0 +1,83 @@
+#include <gcore/all.h>
+#include <gnet/all.h>
+
+#ifndef GNET_COROUTINES
+
+int main(int, char**) {
+  std::cout << "Coroutines require C++20." << std::endl;
+  return 0;
+}
+
+#else
+
+// Line echo server written with coroutines: one task accepts, one task per
+// connection echoes until the peer goes quiet for 30 seconds.
+// "QUIT" cancels the accept loop, what stops the server once sessions end.
+
+static gnet::Task<void> Session(gnet::Scheduler &s, gnet::TCPSocket *socket, gnet::TCPConnection *conn, gnet::Cancellation *stop) {
+  std::string line;
+  
+  try {
+    while (co_await gnet::async::read(s, conn, line, "\n", 30000)) {
+      
+      std::cout << "Received: \"" << line.substr(0, line.length() - 1) << "\"" << std::endl;
+      
+      if (line == "QUIT\n" || line == "QUIT\r\n") {
+        stop->cancel();
+        break;
+      }
+      
+      co_await gnet::async::write(s, conn, line.data(), line.length());
+    }
+  } catch (gnet::Exception &e) {
+    std::cout << e.what() << std::endl;
+  }
+  
+  socket->closeConnection(conn);
+}
+
+static gnet::Task<void> Listen(gnet::Scheduler &s, gnet::TCPSocket *socket, gnet::Cancellation *stop) {
+  try {
+    while (true) {
+      gnet::TCPConnection *conn = co_await gnet::async::accept(s, socket, -1, stop);
+      std::cout << "New connection from " << conn->host().address() << ":" << conn->host().port() << std::endl;
+      Session(s, socket, conn, stop).detach();
+    }
+  } catch (gnet::Exception &e) {
+    std::cout << e.what() << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  
+  unsigned short port = 8080;
+  
+  if (argc >= 2) {
+    sscanf(argv[1], "%hu", &port);
+  }
+  
+  gnet::Initialize();
+  
+  try {
+    gnet::TCPSocket socket(port);
+    socket.bindAndListen(128);
+    
+    gnet::Scheduler scheduler;
+    gnet::Cancellation stop;
+    
+    Listen(scheduler, &socket, &stop).detach();
+    
+    std::cout << "Serving on port " << port << "..." << std::endl;
+    scheduler.run();
+    
+  } catch (gnet::Exception &e) {
+    
+    std::cout << e.what() << std::endl;
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
+
+#endif
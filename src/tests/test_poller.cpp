@@ -0,0 +1,78 @@
+#include <gcore/all.h>
+#include <gnet/all.h>
+
+class EchoHandler : public gnet::Poller::Handler {
+  public:
+    
+    EchoHandler(gnet::TCPSocket *socket)
+      : mSocket(socket) {
+    }
+    
+    virtual void onAccept(gnet::Poller &poller, gnet::TCPSocket *socket) {
+      gnet::TCPConnection *conn = socket->acceptConnection();
+      std::cout << "New connection from " << conn->host().address() << ":" << conn->host().port() << std::endl;
+      poller.add(conn, this);
+    }
+    
+    virtual void onRead(gnet::Poller &poller, gnet::Connection *conn) {
+      std::string data;
+      
+      try {
+        conn->reads(data);
+      } catch (gnet::Exception &e) {
+        std::cout << e.what() << std::endl;
+        onClose(poller, conn);
+        return;
+      }
+      
+      std::cout << "Received: \"" << data << "\"" << std::endl;
+      
+      if (data == "QUIT") {
+        poller.stop();
+      } else {
+        conn->writes(data);
+      }
+    }
+    
+    virtual void onClose(gnet::Poller &poller, gnet::Connection *conn) {
+      gnet::TCPConnection *tcpconn = (gnet::TCPConnection*) conn;
+      poller.remove(conn);
+      mSocket->closeConnection(tcpconn);
+    }
+    
+  private:
+    
+    gnet::TCPSocket *mSocket;
+};
+
+int main(int argc, char **argv) {
+  
+  unsigned short port = 8080;
+  
+  if (argc >= 2) {
+    sscanf(argv[1], "%hu", &port);
+  }
+  
+  gnet::Initialize();
+  
+  try {
+    gnet::TCPSocket socket(port);
+    socket.bindAndListen(128);
+    
+    EchoHandler handler(&socket);
+    
+    gnet::Poller poller;
+    poller.add(&socket, &handler);
+    
+    std::cout << "Serving on port " << port << "..." << std::endl;
+    poller.run();
+    
+  } catch (gnet::Exception &e) {
+    
+    std::cout << e.what() << std::endl;
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include <gcore/all.h>
+#include <gnet/all.h>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef _WIN32
+
+int main(int, char**) {
+  std::cout << "Descriptor passing is not supported on this platform." << std::endl;
+  return 0;
+}
+
+#else
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+// Master accepts TCP connections and hands them over to pre-forked workers
+// through a unix socket
+
+static void Worker(const std::string &path) {
+  
+  gnet::UnixSocket socket(path);
+  gnet::UnixConnection *master = socket.connect();
+  
+  while (true) {
+    gnet::TCPConnection *conn = master->receiveConnection();
+    
+    try {
+      std::string data;
+      while (conn->reads(data, "\n") && data.length() > 0) {
+        conn->writes(data);
+      }
+    } catch (gnet::Exception &) {
+    }
+    
+    delete conn;
+  }
+}
+
+int main(int argc, char **argv) {
+  
+  unsigned short port = 8080;
+  unsigned long workers = 4;
+  
+  if (argc >= 2) {
+    sscanf(argv[1], "%hu", &port);
+  }
+  if (argc >= 3) {
+    sscanf(argv[2], "%lu", &workers);
+  }
+  
+  gnet::Initialize();
+  
+  std::vector<pid_t> pids;
+  
+  try {
+    std::string path = "@gnet_test_prefork";
+    
+    gnet::UnixSocket local(path);
+    local.bindAndListen(int(workers));
+    
+    for (unsigned long i=0; i<workers; ++i) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        try {
+          Worker(path);
+        } catch (gnet::Exception &e) {
+          std::cout << e.what() << std::endl;
+        }
+        _exit(0);
+      }
+      pids.push_back(pid);
+    }
+    
+    std::vector<gnet::UnixConnection*> channels;
+    
+    for (unsigned long i=0; i<workers; ++i) {
+      channels.push_back(local.acceptConnection());
+    }
+    
+    gnet::TCPSocket socket(gnet::Host("0.0.0.0", port));
+    socket.setReuseAddress(true);
+    socket.bindAndListen(128);
+    
+    std::cout << "Serving on port " << port << " with " << workers << " worker process(es)..." << std::endl;
+    
+    size_t next = 0;
+    
+    while (true) {
+      gnet::TCPConnection *conn = socket.acceptConnection();
+      
+      // round robin, the connection is closed here once passed
+      channels[next]->sendConnection(conn);
+      socket.closeConnection(conn);
+      
+      next = (next + 1) % channels.size();
+    }
+    
+  } catch (gnet::Exception &e) {
+    
+    std::cout << e.what() << std::endl;
+  }
+  
+  for (size_t i=0; i<pids.size(); ++i) {
+    kill(pids[i], SIGTERM);
+    waitpid(pids[i], 0, 0);
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
+
+#endif
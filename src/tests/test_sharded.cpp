@@ -0,0 +1,77 @@
+#include <gcore/all.h>
+#include <gnet/all.h>
+
+class EchoHandler : public gnet::Poller::Handler {
+  public:
+    
+    EchoHandler() {
+    }
+    
+    virtual void onAccept(gnet::Poller &poller, gnet::TCPSocket *socket) {
+      std::vector<gnet::TCPConnection*> conns;
+      socket->acceptBatch(conns);
+      for (size_t i=0; i<conns.size(); ++i) {
+        poller.add(conns[i], this);
+      }
+    }
+    
+    virtual void onRead(gnet::Poller &poller, gnet::Connection *conn) {
+      std::string data;
+      
+      try {
+        conn->reads(data);
+      } catch (gnet::Exception &e) {
+        onClose(poller, conn);
+        return;
+      }
+      
+      if (data.length() == 0) {
+        onClose(poller, conn);
+      } else {
+        conn->writes(data);
+      }
+    }
+    
+    virtual void onClose(gnet::Poller &poller, gnet::Connection *conn) {
+      gnet::TCPConnection *tcpconn = (gnet::TCPConnection*) conn;
+      poller.remove(conn);
+      tcpconn->socket()->closeConnection(tcpconn);
+    }
+};
+
+int main(int argc, char **argv) {
+  
+  unsigned short port = 8080;
+  unsigned long shards = 0;
+  
+  if (argc >= 2) {
+    sscanf(argv[1], "%hu", &port);
+  }
+  if (argc >= 3) {
+    sscanf(argv[2], "%lu", &shards);
+  }
+  
+  gnet::Initialize();
+  
+  try {
+    EchoHandler handler;
+    
+    gnet::ShardedServer server(gnet::Host("0.0.0.0", port), &handler, shards);
+    server.start();
+    
+    std::cout << "Serving on port " << port << " with " << server.shards() << " shard(s), press enter to stop..." << std::endl;
+    
+    std::string line;
+    std::getline(std::cin, line);
+    
+    server.stop();
+    
+  } catch (gnet::Exception &e) {
+    
+    std::cout << e.what() << std::endl;
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
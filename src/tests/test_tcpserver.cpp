@@ -0,0 +1,61 @@
+#include <gcore/all.h>
+#include <gnet/all.h>
+
+class EchoHandler : public gnet::TCPServer::Handler {
+  public:
+    
+    EchoHandler() {
+    }
+    
+    virtual bool onRequest(gnet::TCPServer &, gnet::TCPConnection *conn) {
+      std::string line;
+      
+      if (!conn->reads(line, "\n") || line.length() == 0) {
+        // closed by peer
+        return false;
+      }
+      
+      conn->writes(line);
+      
+      return true;
+    }
+};
+
+int main(int argc, char **argv) {
+  
+  unsigned short port = 8080;
+  unsigned long workers = 0;
+  
+  if (argc >= 2) {
+    sscanf(argv[1], "%hu", &port);
+  }
+  if (argc >= 3) {
+    sscanf(argv[2], "%lu", &workers);
+  }
+  
+  gnet::Initialize();
+  
+  try {
+    EchoHandler handler;
+    
+    gnet::TCPServer server(gnet::Host("0.0.0.0", port), &handler, workers);
+    server.setIdleTimeout(30000);
+    server.start();
+    
+    std::cout << "Serving on port " << port << " with " << server.workers() << " worker(s), press enter to stop..." << std::endl;
+    
+    std::string line;
+    std::getline(std::cin, line);
+    
+    std::cout << "Draining " << server.connections() << " connection(s)..." << std::endl;
+    server.stop(5000);
+    
+  } catch (gnet::Exception &e) {
+    
+    std::cout << e.what() << std::endl;
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
@@ -0,0 +1,39 @@
+#include <gcore/all.h>
+#include <gnet/all.h>
+#include <iostream>
+#include <cstdio>
+
+int main(int argc, char **argv) {
+  
+  unsigned short port = 8080;
+  
+  if (argc >= 2) {
+    sscanf(argv[1], "%hu", &port);
+  }
+  
+  gnet::Initialize();
+  
+  try {
+    gnet::UDPSocket socket(gnet::Host("0.0.0.0", port));
+    socket.bind();
+    
+    gnet::DatagramBatch batch(32);
+    
+    std::cout << "Echoing datagrams on port " << port << "..." << std::endl;
+    
+    while (true) {
+      size_t n = socket.receive(batch);
+      
+      // received datagrams already carry their source address
+      socket.send(&batch[0], n);
+    }
+    
+  } catch (gnet::Exception &e) {
+    
+    std::cout << e.what() << std::endl;
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
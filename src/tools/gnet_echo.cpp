@@ -0,0 +1,123 @@
+#include <gnet/all.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <chrono>
+#include <thread>
+
+// Reference server for gnet_load: echoes every byte it receives, what
+// answers both line and frame requests. Runs one shard (listening socket,
+// Poller and thread) per hardware thread until interrupted.
+
+static const char *Usage =
+  "usage: gnet_echo [options] [port]\n"
+  "  -t n     shards (one per hardware thread)\n"
+  "  -u       use the io_uring poller backend\n"
+  "  -m       print I/O metrics (Prometheus text format) on exit\n";
+
+static volatile sig_atomic_t Interrupted = 0;
+
+static void OnSignal(int) {
+  Interrupted = 1;
+}
+
+class EchoHandler : public gnet::Poller::Handler {
+  public:
+    
+    EchoHandler() {
+    }
+    
+    virtual void onAccept(gnet::Poller &poller, gnet::TCPSocket *socket) {
+      std::vector<gnet::TCPConnection*> conns;
+      socket->acceptBatch(conns, 0);
+      for (size_t i=0; i<conns.size(); ++i) {
+        poller.add(conns[i], this);
+      }
+    }
+    
+    virtual void onRead(gnet::Poller &poller, gnet::Connection *conn) {
+      try {
+        const char *bytes;
+        size_t len;
+        while (conn->peek(bytes, len, 0, 0)) {
+          conn->write(bytes, len);
+          conn->consume(len);
+        }
+      } catch (gnet::Exception &) {
+        onClose(poller, conn);
+      }
+    }
+    
+    virtual void onClose(gnet::Poller &poller, gnet::Connection *conn) {
+      gnet::TCPConnection *tcpconn = (gnet::TCPConnection*) conn;
+      poller.remove(conn);
+      tcpconn->socket()->closeConnection(tcpconn);
+    }
+};
+
+int main(int argc, char **argv) {
+  
+  unsigned short port = 8080;
+  size_t shards = 0;
+  bool uring = false;
+  bool metrics = false;
+  
+  for (int i=1; i<argc; ++i) {
+    if (!strcmp(argv[i], "-u")) {
+      uring = true;
+    } else if (!strcmp(argv[i], "-m")) {
+      metrics = true;
+    } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      shards = size_t(strtoul(argv[++i], NULL, 10));
+    } else if (argv[i][0] != '-') {
+      port = (unsigned short) strtoul(argv[i], NULL, 10);
+    } else {
+      fprintf(stderr, "%s", Usage);
+      return 1;
+    }
+  }
+  
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+  
+  gnet::Initialize();
+  
+  try {
+    EchoHandler handler;
+    
+    // responses are small, don't let Nagle hold them back
+    gnet::SocketOptions options;
+    options.noDelay = 1;
+    
+    gnet::ShardedServer server(gnet::Host("0.0.0.0", port), &handler, shards, 1024);
+    server.setOptions(options);
+    if (uring) {
+      server.setBackend(gnet::Poller::IOUring);
+    }
+    server.start();
+    
+    fprintf(stdout, "Echoing on port %u with %lu shard(s)%s, interrupt to stop\n", (unsigned) port,
+            (unsigned long) server.shards(), (uring && server.poller(0)->backend() == gnet::Poller::IOUring ? " (io_uring)" : ""));
+    fflush(stdout);
+    
+    while (!Interrupted) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    
+    server.stop();
+    
+    if (metrics) {
+      gnet::Metrics::Snapshot snapshot;
+      gnet::Metrics::Collect(snapshot);
+      fprintf(stdout, "%s", snapshot.prometheus().c_str());
+    }
+    
+  } catch (gnet::Exception &e) {
+    fprintf(stderr, "%s\n", e.what());
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}
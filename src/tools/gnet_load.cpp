@@ -0,0 +1,617 @@
+#include <gnet/all.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <fstream>
+#include <thread>
+#ifndef _WIN32
+# include <time.h>
+#endif
+
+// Load generator: opens many connections split across threads, one Poller
+// per thread, and sends request after request, reporting throughput and the
+// latency distribution.
+//
+// Closed loop (no -R): every connection keeps -p requests in flight and
+//   sends the next one as soon as a response arrives. Latency is measured
+//   from the time a request is issued, it doesn't show the requests a slow
+//   server delays.
+// Open loop (-R rate): requests are scheduled at a fixed rate, whatever the
+//   responses. Latency is measured from the time a request was scheduled,
+//   not from the time it was sent, so that a stalled server (or generator)
+//   is charged for the requests it held back (coordinated omission).
+//
+// Sends never block: what a connection can't take right away is queued and
+// sent when the poller reports it writable, so that one slow connection
+// doesn't hold back the schedule of the others.
+//
+// Requests are lines (ending with \n) or length prefixed frames (see
+// gnet::Framing defaults), the server must answer each with one message of
+// the same kind, gnet_echo does.
+
+static const char *Usage =
+  "usage: gnet_load [options] host port\n"
+  "  -c n     connections (100)\n"
+  "  -t n     threads (one per hardware thread)\n"
+  "  -d s     duration in seconds (10)\n"
+  "  -R n     requests per second for all connections, open loop (closed loop)\n"
+  "  -p n     requests in flight per connection in closed loop (1)\n"
+  "  -m n     size of generated requests in bytes (64)\n"
+  "  -f kind  'line' or 'frame' (line)\n"
+  "  -s file  send the lines of file in turn instead of generated requests\n"
+  "  -u       use the io_uring poller backend\n"
+  "  -j       print results as JSON\n";
+
+static long long Now() {
+#ifdef _WIN32
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter(&c);
+  QueryPerformanceFrequency(&f);
+  return (long long)(double(c.QuadPart) * 1.0e9 / double(f.QuadPart));
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + (long long)ts.tv_nsec;
+#endif
+}
+
+struct Options {
+  std::string host;
+  unsigned short port;
+  size_t connections;
+  size_t threads;
+  double duration;
+  double rate;
+  size_t pipeline;
+  size_t size;
+  bool frames;
+  std::string script;
+  bool uring;
+  bool json;
+};
+
+// Requests as sent on the wire, already delimited or framed
+static std::vector<std::string> Requests;
+
+static bool MakeRequests(const Options &opts) {
+  gnet::Framing framing;
+  std::vector<std::string> bodies;
+  
+  if (opts.script.length() > 0) {
+    std::ifstream in(opts.script.c_str());
+    if (!in) {
+      fprintf(stderr, "Could not read %s\n", opts.script.c_str());
+      return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.length() > 0) {
+        bodies.push_back(line);
+      }
+    }
+    if (bodies.empty()) {
+      fprintf(stderr, "No request in %s\n", opts.script.c_str());
+      return false;
+    }
+  } else {
+    std::string body;
+    size_t n = (opts.frames ? opts.size : (opts.size > 1 ? opts.size - 1 : 0));
+    for (size_t i=0; i<n; ++i) {
+      body.push_back(char('a' + i % 26));
+    }
+    bodies.push_back(body);
+  }
+  
+  for (size_t i=0; i<bodies.size(); ++i) {
+    if (opts.frames) {
+      char header[10];
+      Requests.push_back(std::string(header, framing.encode(bodies[i].length(), header)) + bodies[i]);
+    } else {
+      Requests.push_back(bodies[i] + "\n");
+    }
+  }
+  
+  return true;
+}
+
+class Worker : public gnet::Poller::Handler {
+  public:
+    
+    Worker(const Options &opts, size_t connections, double rate)
+      : mOpts(opts)
+      , mPoller(opts.uring ? gnet::Poller::IOUring : gnet::Poller::Default)
+      , mConnections(connections)
+      , mInterval(rate > 0.0 ? (long long)(1.0e9 / rate) : 0)
+      , mNext(0)
+      , mTurn(0)
+      , mAlive(0)
+      , mEnd(0)
+      , mRequests(0)
+      , mResponses(0)
+      , mBytesOut(0)
+      , mBytesIn(0)
+      , mErrors(0) {
+      if (mInterval == 0 && rate > 0.0) {
+        mInterval = 1;
+      }
+    }
+    
+    virtual ~Worker() {
+      close();
+    }
+    
+    // Called from the main thread before run
+    void connect() {
+      gnet::Host host(mOpts.host, mOpts.port);
+      gnet::SocketOptions options;
+      options.noDelay = 1;
+      
+      for (size_t i=0; i<mConnections; ++i) {
+        Client *c = new Client();
+        c->index = 0;
+        c->alive = false;
+        c->written = 0;
+        c->writing = false;
+        c->socket = new gnet::TCPSocket(host);
+        c->socket->setOptions(options);
+        c->conn = 0;
+        mClients.push_back(c);
+        try {
+          c->conn = c->socket->connect(5000);
+        } catch (gnet::Exception &e) {
+          fprintf(stderr, "%s\n", e.what());
+        }
+        if (c->conn) {
+          c->alive = true;
+          mOwners[c->conn] = c;
+          mPoller.add(c->conn, this);
+          ++mAlive;
+        } else {
+          ++mErrors;
+        }
+      }
+    }
+    
+    void start(long long start, long long end) {
+      mNext = start;
+      mEnd = end;
+      mThread = std::thread(&Worker::run, this);
+    }
+    
+    void join() {
+      mThread.join();
+    }
+    
+    virtual void onRead(gnet::Poller &poller, gnet::Connection *conn) {
+      std::map<gnet::Connection*, Client*>::iterator it = mOwners.find(conn);
+      if (it == mOwners.end()) {
+        return;
+      }
+      Client *c = it->second;
+      
+      try {
+        const char *bytes;
+        size_t len;
+        
+        while (c->alive && !c->pending.empty()) {
+          if (mOpts.frames) {
+            if (!conn->peekFrame(bytes, len, 0)) {
+              break;
+            }
+          } else {
+            if (!conn->peek(bytes, len, "\n", 0)) {
+              break;
+            }
+          }
+          conn->consume(len);
+          
+          if (mOpts.frames) {
+            // count the header too, as for bytes out
+            char header[10];
+            len += mFraming.encode(len, header);
+          }
+          
+          long long now = Now();
+          Pending &p = c->pending.front();
+          if (now <= mEnd) {
+            mCorrected.record(now - p.scheduled);
+            mUncorrected.record(now - p.sent);
+            mBytesIn += len;
+            ++mResponses;
+          }
+          c->pending.pop_front();
+          
+          if (mInterval == 0 && now < mEnd) {
+            send(c, now);
+          }
+        }
+      } catch (gnet::Exception &) {
+        onClose(poller, conn);
+      }
+    }
+    
+    virtual void onWrite(gnet::Poller &, gnet::Connection *conn) {
+      std::map<gnet::Connection*, Client*>::iterator it = mOwners.find(conn);
+      if (it != mOwners.end()) {
+        transmit(it->second);
+      }
+    }
+    
+    virtual void onClose(gnet::Poller &, gnet::Connection *conn) {
+      std::map<gnet::Connection*, Client*>::iterator it = mOwners.find(conn);
+      if (it != mOwners.end()) {
+        fail(it->second);
+      }
+    }
+    
+    const gnet::Histogram& corrected() const {
+      return mCorrected;
+    }
+    
+    const gnet::Histogram& uncorrected() const {
+      return mUncorrected;
+    }
+    
+    unsigned long long requests() const {
+      return mRequests;
+    }
+    
+    unsigned long long responses() const {
+      return mResponses;
+    }
+    
+    unsigned long long bytesOut() const {
+      return mBytesOut;
+    }
+    
+    unsigned long long bytesIn() const {
+      return mBytesIn;
+    }
+    
+    unsigned long long errors() const {
+      return mErrors;
+    }
+  
+  private:
+    
+    struct Pending {
+      long long scheduled;
+      long long sent;
+    };
+    
+    struct Client {
+      gnet::TCPSocket *socket;
+      gnet::TCPConnection *conn;
+      size_t index;
+      bool alive;
+      std::deque<Pending> pending;
+      // requests not sent yet, from written on
+      std::string output;
+      size_t written;
+      // Write watched
+      bool writing;
+    };
+    
+    void run() {
+      try {
+        long long now = Now();
+        
+        if (mInterval == 0) {
+          for (size_t i=0; i<mClients.size(); ++i) {
+            for (size_t j=0; j<mOpts.pipeline && mClients[i]->alive; ++j) {
+              send(mClients[i], now);
+            }
+          }
+        }
+        
+        while (mAlive > 0 && (now = Now()) < mEnd) {
+          long long wake = mEnd;
+          
+          if (mInterval > 0) {
+            // catch up with the schedule: late requests keep their scheduled time
+            while (mNext <= now && mAlive > 0) {
+              Client *c = nextClient();
+              send(c, mNext);
+              mNext += mInterval;
+            }
+            if (mNext < wake) {
+              wake = mNext;
+            }
+          }
+          
+          now = Now();
+          int timeout = (wake > now ? int((wake - now + 999999) / 1000000) : 0);
+          mPoller.poll(timeout);
+        }
+      
+      } catch (gnet::Exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        ++mErrors;
+      }
+    }
+    
+    Client* nextClient() {
+      while (true) {
+        Client *c = mClients[mTurn];
+        mTurn = (mTurn + 1) % mClients.size();
+        if (c->alive) {
+          return c;
+        }
+      }
+    }
+    
+    void send(Client *c, long long scheduled) {
+      const std::string &req = Requests[c->index];
+      c->index = (c->index + 1) % Requests.size();
+      
+      Pending p;
+      p.scheduled = scheduled;
+      p.sent = Now();
+      
+      c->pending.push_back(p);
+      c->output.append(req);
+      ++mRequests;
+      
+      transmit(c);
+    }
+    
+    // Send queued requests without blocking, watch Write while some remain
+    void transmit(Client *c) {
+      if (!c->alive) {
+        return;
+      }
+      
+      try {
+        while (c->written < c->output.length()) {
+          size_t n = c->conn->writeSome(c->output.data() + c->written, c->output.length() - c->written);
+          if (n == 0) {
+            break;
+          }
+          c->written += n;
+          mBytesOut += n;
+        }
+        
+        if (c->written == c->output.length()) {
+          c->output.clear();
+          c->written = 0;
+        } else if (c->written >= 65536) {
+          c->output.erase(0, c->written);
+          c->written = 0;
+        }
+        
+        bool writing = !c->output.empty();
+        if (writing != c->writing) {
+          c->writing = writing;
+          mPoller.modify(c->conn, gnet::Poller::Read | (writing ? gnet::Poller::Write : 0));
+        }
+      
+      } catch (gnet::Exception &) {
+        fail(c);
+      }
+    }
+    
+    void fail(Client *c) {
+      if (c->alive) {
+        c->alive = false;
+        mPoller.remove(c->conn);
+        --mAlive;
+        ++mErrors;
+      }
+    }
+    
+    void close() {
+      for (size_t i=0; i<mClients.size(); ++i) {
+        Client *c = mClients[i];
+        if (c->alive) {
+          mPoller.remove(c->conn);
+        }
+        delete c->socket;
+        delete c;
+      }
+      mClients.clear();
+      mOwners.clear();
+    }
+  
+  private:
+    
+    const Options &mOpts;
+    gnet::Poller mPoller;
+    size_t mConnections;
+    std::vector<Client*> mClients;
+    std::map<gnet::Connection*, Client*> mOwners;
+    std::thread mThread;
+    gnet::Framing mFraming;
+    
+    // open loop schedule, requests go to connections in turn
+    long long mInterval;
+    long long mNext;
+    size_t mTurn;
+    
+    size_t mAlive;
+    long long mEnd;
+    
+    gnet::Histogram mCorrected;
+    gnet::Histogram mUncorrected;
+    unsigned long long mRequests;
+    unsigned long long mResponses;
+    unsigned long long mBytesOut;
+    unsigned long long mBytesIn;
+    unsigned long long mErrors;
+};
+
+static const double Percentiles[] = {50.0, 75.0, 90.0, 99.0, 99.9, 99.99};
+static const size_t PercentileCount = sizeof(Percentiles) / sizeof(Percentiles[0]);
+
+static void PrintLatency(const char *label, const gnet::Histogram &h) {
+  fprintf(stdout, "%s (us)\n", label);
+  fprintf(stdout, "  mean %10.1f  stdev %10.1f  max %10.1f\n", 1.0e-3 * h.mean(), 1.0e-3 * h.stddev(), 1.0e-3 * double(h.max()));
+  for (size_t i=0; i<PercentileCount; ++i) {
+    fprintf(stdout, "  %6.2f%% %10.1f\n", Percentiles[i], 1.0e-3 * double(h.percentile(Percentiles[i])));
+  }
+}
+
+static void PrintLatencyJSON(const char *label, const gnet::Histogram &h) {
+  fprintf(stdout, "  \"%s\": {\"mean\": %.0f, \"stdev\": %.0f, \"max\": %lld", label, h.mean(), h.stddev(), h.max());
+  for (size_t i=0; i<PercentileCount; ++i) {
+    fprintf(stdout, ", \"p%g\": %lld", Percentiles[i], h.percentile(Percentiles[i]));
+  }
+  fprintf(stdout, "}");
+}
+
+int main(int argc, char **argv) {
+  
+  Options opts;
+  opts.port = 0;
+  opts.connections = 100;
+  opts.threads = std::thread::hardware_concurrency();
+  opts.duration = 10.0;
+  opts.rate = 0.0;
+  opts.pipeline = 1;
+  opts.size = 64;
+  opts.frames = false;
+  opts.uring = false;
+  opts.json = false;
+  
+  std::vector<const char*> args;
+  
+  for (int i=1; i<argc; ++i) {
+    const char *a = argv[i];
+    const char *v = (i + 1 < argc ? argv[i+1] : 0);
+    if (!strcmp(a, "-u")) {
+      opts.uring = true;
+    } else if (!strcmp(a, "-j")) {
+      opts.json = true;
+    } else if (a[0] == '-' && a[1] != '\0' && a[2] == '\0' && strchr("ctdRpmfs", a[1])) {
+      if (!v) {
+        fprintf(stderr, "%s", Usage);
+        return 1;
+      }
+      switch (a[1]) {
+        case 'c': opts.connections = size_t(strtoul(v, NULL, 10)); break;
+        case 't': opts.threads = size_t(strtoul(v, NULL, 10)); break;
+        case 'd': opts.duration = strtod(v, NULL); break;
+        case 'R': opts.rate = strtod(v, NULL); break;
+        case 'p': opts.pipeline = size_t(strtoul(v, NULL, 10)); break;
+        case 'm': opts.size = size_t(strtoul(v, NULL, 10)); break;
+        case 'f': opts.frames = !strcmp(v, "frame"); break;
+        case 's': opts.script = v; break;
+      }
+      ++i;
+    } else {
+      args.push_back(a);
+    }
+  }
+  
+  if (args.size() != 2 || opts.connections == 0 || opts.duration <= 0.0) {
+    fprintf(stderr, "%s", Usage);
+    return 1;
+  }
+  
+  opts.host = args[0];
+  opts.port = (unsigned short) strtoul(args[1], NULL, 10);
+  if (opts.threads == 0) {
+    opts.threads = 1;
+  }
+  if (opts.threads > opts.connections) {
+    opts.threads = opts.connections;
+  }
+  if (opts.pipeline == 0) {
+    opts.pipeline = 1;
+  }
+  
+  if (!MakeRequests(opts)) {
+    return 1;
+  }
+  
+  gnet::Initialize();
+  
+  std::vector<Worker*> workers;
+  
+  try {
+    for (size_t i=0; i<opts.threads; ++i) {
+      // spread connections and rate evenly
+      size_t n = opts.connections / opts.threads + (i < opts.connections % opts.threads ? 1 : 0);
+      workers.push_back(new Worker(opts, n, opts.rate * double(n) / double(opts.connections)));
+      workers.back()->connect();
+    }
+    
+    long long start = Now() + 10000000LL;
+    long long end = start + (long long)(opts.duration * 1.0e9);
+    
+    for (size_t i=0; i<workers.size(); ++i) {
+      workers[i]->start(start, end);
+    }
+    for (size_t i=0; i<workers.size(); ++i) {
+      workers[i]->join();
+    }
+    
+    gnet::Histogram corrected;
+    gnet::Histogram uncorrected;
+    unsigned long long requests = 0;
+    unsigned long long responses = 0;
+    unsigned long long bytesOut = 0;
+    unsigned long long bytesIn = 0;
+    unsigned long long errors = 0;
+    
+    for (size_t i=0; i<workers.size(); ++i) {
+      corrected.merge(workers[i]->corrected());
+      uncorrected.merge(workers[i]->uncorrected());
+      requests += workers[i]->requests();
+      responses += workers[i]->responses();
+      bytesOut += workers[i]->bytesOut();
+      bytesIn += workers[i]->bytesIn();
+      errors += workers[i]->errors();
+    }
+    
+    double seconds = opts.duration;
+    
+    if (opts.json) {
+      fprintf(stdout, "{\n  \"connections\": %lu, \"threads\": %lu, \"duration\": %.3f, \"rate\": %.1f,\n",
+              (unsigned long) opts.connections, (unsigned long) opts.threads, seconds, opts.rate);
+      fprintf(stdout, "  \"requests\": %llu, \"responses\": %llu, \"errors\": %llu,\n", requests, responses, errors);
+      fprintf(stdout, "  \"responses_per_sec\": %.1f, \"bytes_out\": %llu, \"bytes_in\": %llu,\n",
+              double(responses) / seconds, bytesOut, bytesIn);
+      if (opts.rate > 0.0) {
+        PrintLatencyJSON("latency_ns", corrected);
+        fprintf(stdout, ",\n");
+        PrintLatencyJSON("uncorrected_latency_ns", uncorrected);
+      } else {
+        PrintLatencyJSON("latency_ns", uncorrected);
+      }
+      fprintf(stdout, "\n}\n");
+      
+    } else {
+      fprintf(stdout, "%lu connection(s), %lu thread(s), %.1f s, %s",
+              (unsigned long) opts.connections, (unsigned long) opts.threads, seconds,
+              (opts.rate > 0.0 ? "open loop" : "closed loop"));
+      if (opts.rate > 0.0) {
+        fprintf(stdout, " at %.0f requests/s", opts.rate);
+      }
+      fprintf(stdout, "\n");
+      fprintf(stdout, "%llu requests, %llu responses, %llu error(s)\n", requests, responses, errors);
+      fprintf(stdout, "%.1f responses/s, %.2f MB/s out, %.2f MB/s in\n", double(responses) / seconds,
+              double(bytesOut) / (1024.0 * 1024.0 * seconds), double(bytesIn) / (1024.0 * 1024.0 * seconds));
+      if (opts.rate > 0.0) {
+        PrintLatency("latency from schedule", corrected);
+        PrintLatency("latency from send", uncorrected);
+      } else {
+        PrintLatency("latency", uncorrected);
+      }
+    }
+  
+  } catch (gnet::Exception &e) {
+    fprintf(stderr, "%s\n", e.what());
+  }
+  
+  for (size_t i=0; i<workers.size(); ++i) {
+    delete workers[i];
+  }
+  
+  gnet::Uninitialize();
+  
+  return 0;
+}